@@ -0,0 +1,555 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "colors.h"
+#include "compressor_funcs.h"
+#include "image_transforms.h"
+#include "images.h"
+#include "bmp_stream.h"
+#include "libbmp.h"
+#include "pixel_convert.h"
+#include "scratch_arena.h"
+#include "stream_transforms.h"
+#include "thread_pool.h"
+
+/*
+ * Micro benchmarks for the hot paths of the library.
+ * Run all of them with `make bench`, or only some with `make bench BENCH="name1 name2"`.
+ * Every measurement is the best of several runs, to filter out the noise.
+ */
+
+// every heap allocation of the benchmark binary is counted
+size_t heap_allocations = 0;
+
+// not inlined, so that GCC does not pair malloc() and free() with the new and delete
+// expressions of the callers (-Wmismatched-new-delete)
+__attribute__((noinline)) void* operator new(size_t size) {
+    ++heap_allocations;
+    if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* memory) noexcept { std::free(memory); }
+__attribute__((noinline)) void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+template <typename Func>
+double bestSeconds(Func&& func, int runs = 5) {
+    double best = 1e30;
+    for (int run = 0; run < runs; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+void reportThroughput(const std::string& name, size_t bytes, double seconds) {
+    printf("  %-44s %9.2f ms %10.1f MB/s\n", name.c_str(), seconds * 1e3, bytes / seconds / 1e6);
+}
+
+UncompressedImage syntheticImage(uint32_t width, uint32_t height) {
+    UncompressedImage img;
+    img.width = width;
+    img.height = height;
+    img.image_data.resize(width, height);
+    for (uint32_t y = 0; y < height; ++y) {
+        std::span<ColorRGB> row = img.image_data[y];
+        for (uint32_t x = 0; x < width; ++x) {
+            row[x] = {
+                static_cast<uint8_t>(x * 7 + y),
+                static_cast<uint8_t>(x ^ y),
+                static_cast<uint8_t>((x * y) >> 3)};
+        }
+    }
+    return img;
+}
+
+void benchBmpRowConversion() {
+    // ~50 MP, the size of the scans the BMP loading is tuned for
+    constexpr uint32_t width = 8192, height = 6144;
+    UncompressedImage img = syntheticImage(width, height);
+    size_t bytes = size_t(width) * height * sizeof(ColorRGB);
+
+    for (bool has_alpha : {false, true}) {
+        BMP bmp(width, height, has_alpha);
+        std::string format = has_alpha ? "BGRA" : "BGR";
+        printf("%s <-> RGB, %ux%u\n", format.c_str(), width, height);
+
+        reportThroughput("per pixel BMP::get_pixel", bytes, bestSeconds([&] {
+                             for (uint32_t y = 0; y < height; ++y) {
+                                 std::span<ColorRGB> row = img.image_data[y];
+                                 for (uint32_t x = 0; x < width; ++x) {
+                                     bmp.get_pixel(x, y, row[x].r, row[x].g, row[x].b);
+                                 }
+                             }
+                         }));
+        reportThroughput("row bgrToRgbRowScalar", bytes, bestSeconds([&] {
+                             for (uint32_t y = 0; y < height; ++y) {
+                                 bgrToRgbRowScalar(
+                                     bmp.row_data(y), img.image_data[y].data(), width,
+                                     bmp.get_channels());
+                             }
+                         }));
+        reportThroughput("row bgrToRgbRow (dispatched)", bytes, bestSeconds([&] {
+                             for (uint32_t y = 0; y < height; ++y) {
+                                 bgrToRgbRow(
+                                     bmp.row_data(y), img.image_data[y].data(), width,
+                                     bmp.get_channels());
+                             }
+                         }));
+
+        reportThroughput("per pixel BMP::set_pixel", bytes, bestSeconds([&] {
+                             for (uint32_t y = 0; y < height; ++y) {
+                                 std::span<const ColorRGB> row = img.image_data[y];
+                                 for (uint32_t x = 0; x < width; ++x) {
+                                     bmp.set_pixel(x, y, row[x].r, row[x].g, row[x].b, 255);
+                                 }
+                             }
+                         }));
+        reportThroughput("row rgbToBgrRowScalar", bytes, bestSeconds([&] {
+                             for (uint32_t y = 0; y < height; ++y) {
+                                 rgbToBgrRowScalar(
+                                     img.image_data[y].data(), bmp.row_data(y), width,
+                                     bmp.get_channels());
+                             }
+                         }));
+        reportThroughput("row rgbToBgrRow (dispatched)", bytes, bestSeconds([&] {
+                             for (uint32_t y = 0; y < height; ++y) {
+                                 rgbToBgrRow(
+                                     img.image_data[y].data(), bmp.row_data(y), width,
+                                     bmp.get_channels());
+                             }
+                         }));
+    }
+}
+
+// Peak resident set size is reset before every measured run (Linux only)
+void resetPeakMemory() { std::ofstream("/proc/self/clear_refs") << "5"; }
+
+size_t peakMemoryKiB() {
+    std::ifstream status("/proc/self/status");
+    std::string key;
+    while (status >> key) {
+        if (key == "VmHWM:") {
+            size_t kib = 0;
+            status >> kib;
+            return kib;
+        }
+    }
+    return 0;
+}
+
+void benchBmpStream() {
+    // the peak memory of the streaming transforms should not grow with the image height
+    constexpr uint32_t width = 4096;
+    const std::vector<std::vector<int>> blur_kernel = {
+        {1, 4, 6, 4, 1},
+        {4, 16, 24, 16, 4},
+        {6, 24, 36, 24, 6},
+        {4, 16, 24, 16, 4},
+        {1, 4, 6, 4, 1}};
+    std::filesystem::path dir = std::filesystem::temp_directory_path();
+    std::string input = (dir / "bench_stream_input.bmp").string();
+    std::string output = (dir / "bench_stream_output.bmp").string();
+
+    for (uint32_t height : {2048u, 8192u, 16384u}) {
+        {
+            UncompressedImage band = syntheticImage(width, kDefaultBandRows);
+            BMPStreamWriter writer(input, width, height);
+            for (uint32_t y = 0; y < height; y += kDefaultBandRows) {
+                writer.writeRows(band.image_data, 0, std::min(kDefaultBandRows, height - y));
+            }
+        }
+        size_t bytes = size_t(width) * height * sizeof(ColorRGB);
+        printf("%ux%u (%.0f MB of pixels)\n", width, height, bytes / 1e6);
+
+        resetPeakMemory();
+        double seconds = bestSeconds([&] { negativeBMPStream(input, output); }, 1);
+        reportThroughput("negativeBMPStream", bytes, seconds);
+        printf("  %-44s %9.1f MB\n", "  peak RSS", peakMemoryKiB() / 1024.0);
+
+        resetPeakMemory();
+        seconds = bestSeconds([&] { applyKernelBMPStream(input, output, blur_kernel, 256); }, 1);
+        reportThroughput("applyKernelBMPStream (5x5)", bytes, seconds);
+        printf("  %-44s %9.1f MB\n", "  peak RSS", peakMemoryKiB() / 1024.0);
+    }
+    std::filesystem::remove(input);
+    std::filesystem::remove(output);
+}
+
+void benchTransformBatch() {
+    // after the first image of a batch the transforms should not touch the heap at all
+    constexpr uint32_t width = 4096, height = 3072;
+    constexpr int batch_size = 8;
+    const UncompressedImage original = syntheticImage(width, height);
+    UncompressedImage img = original;
+    size_t bytes = size_t(width) * height * sizeof(ColorRGB);
+    printf("sharpen + blur + smart rotate, %ux%u, %d images\n", width, height, batch_size);
+
+    for (bool huge_pages : {false, true}) {
+        ScratchArena& arena = threadScratchArena();
+        arena.release();
+        arena.setUseHugePages(huge_pages);
+        for (int i = 0; i < batch_size; ++i) {
+            const size_t heap_before = heap_allocations;
+            const size_t arena_before = arena.stats().heap_allocations;
+            img = original;
+            double seconds = bestSeconds(
+                [&] {
+                    sharpen(img);
+                    gaussianBlurApprox(img, true);
+                    rotate(img, 30, {0, 0, 0}, true);
+                },
+                1);
+            const size_t heap_used = heap_allocations - heap_before;
+            const size_t arena_used = arena.stats().heap_allocations - arena_before;
+            char name[64];
+            snprintf(name, sizeof(name), "image %d%s", i, huge_pages ? " (huge pages)" : "");
+            reportThroughput(name, bytes, seconds);
+            printf("  %-44s %9zu heap, %zu arena allocations\n", "", heap_used, arena_used);
+        }
+        printf(
+            "  arena: %.1f MB reserved, %.1f MB on huge pages, %.1f MB peak use\n",
+            arena.stats().reserved_bytes / 1e6, arena.stats().huge_page_bytes / 1e6,
+            arena.stats().peak_used_bytes / 1e6);
+    }
+}
+
+void benchKernels() {
+    constexpr uint32_t width = 4096, height = 3072;
+    const UncompressedImage original = syntheticImage(width, height);
+    UncompressedImage img = original;
+    size_t bytes = size_t(width) * height * sizeof(ColorRGB);
+    printf("applyKernel, %ux%u\n", width, height);
+
+    // the named filters are the same kernels unrolled at compile time (applyFixedKernel)
+    struct KernelCase {
+        std::string name;
+        std::vector<std::vector<int>> kernel;
+        int divisor;
+        std::function<void(UncompressedImage&)> filter;
+    };
+    const std::vector<KernelCase> kernels = {
+        {"sharpen 3x3",
+         {{0, -1, 0}, {-1, 5, -1}, {0, -1, 0}},
+         1,
+         [](UncompressedImage& img) { sharpen(img); }},
+        {"edge detect 3x3",
+         {{-1, -1, -1}, {-1, 8, -1}, {-1, -1, -1}},
+         1,
+         [](UncompressedImage& img) { edgeDetect(img); }},
+        {"blur 3x3 / 16",
+         {{1, 2, 1}, {2, 4, 2}, {1, 2, 1}},
+         16,
+         [](UncompressedImage& img) { gaussianBlurApprox(img, false); }},
+        {"blur 5x5 / 256",
+         {{1, 4, 6, 4, 1},
+          {4, 16, 24, 16, 4},
+          {6, 24, 36, 24, 6},
+          {4, 16, 24, 16, 4},
+          {1, 4, 6, 4, 1}},
+         256,
+         [](UncompressedImage& img) { gaussianBlurApprox(img, true); }},
+        {"box 5x5 / 25",
+         {{1, 1, 1, 1, 1}, {1, 1, 1, 1, 1}, {1, 1, 1, 1, 1}, {1, 1, 1, 1, 1}, {1, 1, 1, 1, 1}},
+         25,
+         nullptr},
+    };
+    for (const auto& [name, kernel, divisor, filter] : kernels) {
+        reportThroughput(name + " scalar", bytes, bestSeconds([&] {
+                             img = original;
+                             applyKernelScalar(img, kernel, divisor);
+                         }));
+        reportThroughput(name + " (dispatched)", bytes, bestSeconds([&] {
+                             img = original;
+                             applyKernel(img, kernel, divisor);
+                         }));
+        if (filter) {
+            reportThroughput(name + " named filter", bytes, bestSeconds([&] {
+                                 img = original;
+                                 filter(img);
+                             }));
+        }
+    }
+}
+
+void benchKernelThreads() {
+    // ~50 MP, from one thread to every hardware thread (at least 2, so the pool is exercised)
+    constexpr uint32_t width = 8192, height = 6144;
+    const UncompressedImage original = syntheticImage(width, height);
+    UncompressedImage img = original;
+    size_t bytes = size_t(width) * height * sizeof(ColorRGB);
+    const size_t max_threads = std::max(std::thread::hardware_concurrency(), 2u);
+    printf("filters on 1 to %zu threads, %ux%u\n", max_threads, width, height);
+
+    std::vector<size_t> thread_counts;
+    for (size_t threads = 1; threads < max_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+
+    const std::vector<std::vector<int>> kernel_5x5 = {
+        {1, 2, 3, 2, 1}, {2, 4, 6, 4, 2}, {3, 6, -9, 6, 3}, {2, 4, 6, 4, 2}, {1, 2, 3, 2, 1}};
+    const std::vector<int> binomial = {1, 6, 15, 20, 15, 6, 1};
+    std::vector<std::vector<int>> kernel_7x7;
+    for (int vertical : binomial) {
+        kernel_7x7.emplace_back();
+        for (int horizontal : binomial) {
+            kernel_7x7.back().push_back(vertical * horizontal);
+        }
+    }
+    const std::vector<std::pair<std::string, std::function<void(UncompressedImage&)>>> filters = {
+        {"sharpen", [](UncompressedImage& img) { sharpen(img); }},
+        {"hard blur", [](UncompressedImage& img) { gaussianBlurApprox(img, true); }},
+        {"applyKernel 5x5 / 50", [&](UncompressedImage& img) { applyKernel(img, kernel_5x5, 50); }},
+        {"applyKernel 7x7 / 4096 (separable)",
+         [&](UncompressedImage& img) { applyKernel(img, kernel_7x7, 4096); }},
+    };
+    for (const auto& [name, filter] : filters) {
+        double single_thread_seconds = 0;
+        for (size_t threads : thread_counts) {
+            setTransformThreadCount(threads);
+            double seconds = bestSeconds(
+                [&] {
+                    img = original;
+                    filter(img);
+                },
+                3);
+            if (threads == 1) {
+                single_thread_seconds = seconds;
+            }
+            char label[64];
+            snprintf(label, sizeof(label), "%s, %zu threads", name.c_str(), threads);
+            reportThroughput(label, bytes, seconds);
+            printf("  %-44s %9.2fx\n", "", single_thread_seconds / seconds);
+        }
+    }
+    setTransformThreadCount(0);
+}
+
+void benchLargeBlur() {
+    // the running sums make the time per pixel the same for every radius
+    constexpr uint32_t width = 4096, height = 3072;
+    const UncompressedImage original = syntheticImage(width, height);
+    UncompressedImage img = original;
+    size_t bytes = size_t(width) * height * sizeof(ColorRGB);
+    printf("box and gaussian blur, %ux%u\n", width, height);
+
+    for (uint32_t radius : {1, 10, 30, 100}) {
+        reportThroughput("boxBlur radius " + std::to_string(radius), bytes, bestSeconds([&] {
+                             img = original;
+                             boxBlur(img, radius);
+                         }));
+    }
+    for (double sigma : {3.0, 10.0, 33.0}) {
+        char name[64];
+        snprintf(name, sizeof(name), "gaussianBlur sigma %.0f (3 boxes)", sigma);
+        reportThroughput(name, bytes, bestSeconds([&] {
+                             img = original;
+                             gaussianBlur(img, sigma);
+                         }));
+    }
+}
+
+void benchFilterChain() {
+    // one pass over the image for the whole chain against one pass (and one copy) per filter
+    constexpr uint32_t width = 4096, height = 3072;
+    const UncompressedImage original = syntheticImage(width, height);
+    UncompressedImage img = original;
+    size_t bytes = size_t(width) * height * sizeof(ColorRGB);
+    const std::vector<std::vector<int>> emboss = {{-2, -1, 0}, {-1, 1, 1}, {0, 1, 2}};
+    printf("filter chains, %ux%u\n", width, height);
+
+    reportThroughput("blur, sharpen one by one", bytes, bestSeconds([&] {
+                         img = original;
+                         gaussianBlurApprox(img);
+                         sharpen(img);
+                     }));
+    const FilterChain blur_sharpen = FilterChain().addGaussianBlurApprox().addSharpen();
+    reportThroughput("blur, sharpen chained", bytes, bestSeconds([&] {
+                         img = original;
+                         blur_sharpen.apply(img);
+                     }));
+
+    reportThroughput("hard blur, emboss, negative one by one", bytes, bestSeconds([&] {
+                         img = original;
+                         gaussianBlurApprox(img, true);
+                         applyKernel(img, emboss);
+                         negative(img);
+                     }));
+    const FilterChain long_chain =
+        FilterChain().addGaussianBlurApprox(true).addKernel(emboss).addNegative();
+    reportThroughput("hard blur, emboss, negative chained", bytes, bestSeconds([&] {
+                         img = original;
+                         long_chain.apply(img);
+                     }));
+}
+
+void benchFftKernels() {
+    // the direct 2D loop against the FFT for square kernels of growing size, the crossover is
+    // kFftMinKernelTaps in image_transforms.cpp
+    constexpr uint32_t width = 2048, height = 1536;
+    const UncompressedImage original = syntheticImage(width, height);
+    const UncompressedImageRGBA original_rgba = toRGBA(original);
+    UncompressedImage img = original;
+    UncompressedImageRGBA rgba = original_rgba;
+    size_t bytes = size_t(width) * height * sizeof(ColorRGB);
+    printf("direct and FFT convolution, %ux%u\n", width, height);
+
+    for (int size : {5, 7, 9, 11, 13, 15, 19, 25, 31}) {
+        // of full rank, so it is not applied as two 1D passes
+        std::vector<std::vector<int>> kernel(size, std::vector<int>(size));
+        for (int ky = 0; ky < size; ++ky) {
+            for (int kx = 0; kx < size; ++kx) {
+                kernel[ky][kx] = (ky * 7 + kx * 3) % 11 - 4;
+            }
+        }
+        const std::string name = std::to_string(size) + "x" + std::to_string(size);
+        const int runs = size <= 15 ? 3 : 1;
+        reportThroughput(name + " direct", bytes, bestSeconds([&] {
+                             img = original;
+                             applyKernelScalar(img, kernel, 9);
+                         }, runs));
+        reportThroughput(name + " FFT", bytes, bestSeconds([&] {
+                             img = original;
+                             applyKernelFft(img, kernel, 9);
+                         }, runs));
+        reportThroughput(name + " applyKernel RGBA", bytes, bestSeconds([&] {
+                             rgba = original_rgba;
+                             applyKernel(rgba.image_data.view(), kernel, 9);
+                         }, runs));
+        reportThroughput(name + " FFT RGBA", bytes, bestSeconds([&] {
+                             rgba = original_rgba;
+                             applyKernelFft(rgba, kernel, 9);
+                         }, runs));
+    }
+}
+
+void benchEdgeMap() {
+    // edgeDetect filters the three channels, the gradient engine one luma plane
+    constexpr uint32_t width = 4096, height = 3072;
+    const UncompressedImage original = syntheticImage(width, height);
+    UncompressedImage img = original;
+    size_t bytes = size_t(width) * height * sizeof(ColorRGB);
+    printf("edge maps, %ux%u\n", width, height);
+
+    reportThroughput("edgeDetect (3 channels)", bytes, bestSeconds([&] {
+                         img = original;
+                         edgeDetect(img);
+                     }));
+    ImageBuffer<uint8_t> map;
+    ImageBuffer<uint8_t> direction;
+    reportThroughput("edgeMap sobel", bytes, bestSeconds([&] { map = edgeMap(original); }));
+    reportThroughput("edgeMap scharr", bytes, bestSeconds([&] {
+                         map = edgeMap(original, {GradientOperator::Scharr});
+                     }));
+    reportThroughput("edgeMap sobel + suppression", bytes, bestSeconds([&] {
+                         map = edgeMap(original, {GradientOperator::Sobel, true});
+                     }));
+    reportThroughput("edgeMap sobel + direction", bytes, bestSeconds([&] {
+                         map = edgeMap(original, {}, &direction);
+                     }));
+}
+
+void benchRotate() {
+    constexpr uint32_t width = 4096, height = 3072;
+    const UncompressedImage original = syntheticImage(width, height);
+    const UncompressedImageRGBA original_rgba = toRGBA(original);
+    UncompressedImage img = original;
+    UncompressedImageRGBA rgba = original_rgba;
+    size_t bytes = size_t(width) * height * sizeof(ColorRGB);
+    printf("rotation, %ux%u\n", width, height);
+
+    for (int angle : {90, 180, 270, 30}) {
+        const std::string name = std::to_string(angle) + " degrees";
+        reportThroughput(name, bytes, bestSeconds([&] {
+                             img = original;
+                             rotate(img, angle);
+                         }));
+        reportThroughput(name + " RGBA", bytes, bestSeconds([&] {
+                             rgba = original_rgba;
+                             rotate(rgba, angle);
+                         }));
+        reportThroughput(name + " with gap interpolation", bytes, bestSeconds([&] {
+                             img = original;
+                             rotate(img, angle, {0, 0, 0}, true);
+                         }));
+    }
+}
+
+void benchShearRotate() {
+    // nearest neighbour gathers a source pixel per output pixel, the shears stream whole rows
+    constexpr uint32_t width = 5472, height = 3648;
+    const UncompressedImage original = syntheticImage(width, height);
+    const UncompressedImageRGBA original_rgba = toRGBA(original);
+    UncompressedImage img = original;
+    UncompressedImageRGBA rgba = original_rgba;
+    size_t bytes = size_t(width) * height * sizeof(ColorRGB);
+    printf("nearest neighbour and three-shear rotation, %ux%u\n", width, height);
+
+    for (int angle : {10, 30, 45, 120}) {
+        const std::string name = std::to_string(angle) + " degrees";
+        reportThroughput(name + " nearest neighbour", bytes, bestSeconds([&] {
+                             img = original;
+                             rotate(img, angle);
+                         }, 3));
+        reportThroughput(name + " shear", bytes, bestSeconds([&] {
+                             img = original;
+                             rotateShear(img, angle);
+                         }, 3));
+        reportThroughput(name + " nearest neighbour RGBA", bytes, bestSeconds([&] {
+                             rgba = original_rgba;
+                             rotate(rgba, angle);
+                         }, 3));
+        reportThroughput(name + " shear RGBA", bytes, bestSeconds([&] {
+                             rgba = original_rgba;
+                             rotateShear(rgba, angle);
+                         }, 3));
+    }
+}
+
+struct Benchmark {
+    std::string name;
+    std::function<void()> run;
+};
+
+int main(int argc, char** argv) {
+    const std::vector<Benchmark> benchmarks = {
+        {"bmp_row_conversion", benchBmpRowConversion},
+        {"bmp_stream", benchBmpStream},
+        {"transform_batch", benchTransformBatch},
+        {"kernels", benchKernels},
+        {"kernel_threads", benchKernelThreads},
+        {"large_blur", benchLargeBlur},
+        {"filter_chain", benchFilterChain},
+        {"fft_kernels", benchFftKernels},
+        {"edge_map", benchEdgeMap},
+        {"rotate", benchRotate},
+        {"shear_rotate", benchShearRotate},
+    };
+
+    std::vector<std::string> selected(argv + 1, argv + argc);
+    for (const Benchmark& benchmark : benchmarks) {
+        if (!selected.empty()
+            && std::find(selected.begin(), selected.end(), benchmark.name) == selected.end()) {
+            continue;
+        }
+        printf("== %s\n", benchmark.name.c_str());
+        benchmark.run();
+    }
+    return 0;
+}
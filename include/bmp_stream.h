@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "colors.h"
+#include "image_buffer.h"
+#include "libbmp.h"
+
+// Row by row BMP decoding and encoding. Only one file row is kept in memory,
+// so images of any height can be processed in bands of a fixed number of rows.
+// Rows come bottom first as everywhere else, top-down files are read from their end.
+
+class BMPStreamReader {
+  public:
+    explicit BMPStreamReader(const std::string& filename);
+
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+    uint32_t rowsLeft() const { return height_ - next_row_; }
+
+    // Reads up to count next rows of the file into rows [first_row, first_row + count) of band,
+    // returns the number of rows read (0 once the whole image is read)
+    uint32_t readRows(ImageBuffer<ColorRGB>& band, uint32_t first_row, uint32_t count);
+
+  private:
+    std::ifstream file_;
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+    uint32_t channels_ = 0;
+    uint32_t next_row_ = 0;
+    bool top_down_ = false;             // rows are stored from the top one
+    std::streamoff pixels_offset_ = 0;  // start of the first stored row in the file
+    std::vector<uint8_t> row_buffer_;   // one file row, padding included
+};
+
+class BMPStreamWriter {
+  public:
+    // The headers are written right away, the rows are expected to come in order
+    BMPStreamWriter(const std::string& filename, uint32_t width, uint32_t height);
+
+    uint32_t rowsLeft() const { return height_ - next_row_; }
+
+    // Writes rows [first_row, first_row + count) of band as the next rows of the file
+    void writeRows(const ImageBuffer<ColorRGB>& band, uint32_t first_row, uint32_t count);
+
+  private:
+    std::ofstream file_;
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+    uint32_t next_row_ = 0;
+    std::vector<uint8_t> row_buffer_;  // one file row, padding included
+};
@@ -23,6 +23,28 @@ inline std::ostream& operator<<(std::ostream& os, const ColorRGB& color) {
     return os;
 }
 
+// 4 byte pixel (R, G, B and alpha or padding), so whole pixels fit SIMD lanes
+struct alignas(4) ColorRGBA {
+    uint8_t r = 0;
+    uint8_t g = 0;
+    uint8_t b = 0;
+    uint8_t a = 255;
+
+    bool operator==(const ColorRGBA& other) const {
+        return r == other.r && g == other.g && b == other.b && a == other.a;
+    }
+
+    bool operator!=(const ColorRGBA& other) const { return !(*this == other); }
+};
+
+static_assert(sizeof(ColorRGBA) == 4);
+
+inline std::ostream& operator<<(std::ostream& os, const ColorRGBA& color) {
+    os << "ColorRGBA(" << static_cast<int>(color.r) << ", " << static_cast<int>(color.g) << ", "
+       << static_cast<int>(color.b) << ", " << static_cast<int>(color.a) << ")";
+    return os;
+}
+
 struct ColorHash {
     size_t operator()(const ColorRGB& color) const {
         return (std::hash<uint8_t>()(color.r) << 16) ^ (std::hash<uint8_t>()(color.g) << 8)
@@ -37,5 +59,6 @@ struct ColorHash {
 int64_t colorDistanceSq(const ColorRGB& color1, const ColorRGB& color2);
 
 uint8_t colorToGrayscale(const ColorRGB& color);
+uint8_t colorToGrayscale(const ColorRGBA& color);
 
 ColorRGB readFromFileStream(std::fstream& stream);
@@ -7,12 +7,24 @@
 
 #include "colors.h"
 #include "images.h"
+#include "libbmp.h"
 
 uint8_t findClosestColorId(const ColorRGB& color, const std::map<uint8_t, ColorRGB>& colorTable);
 
 void saveAsBMP(const UncompressedImage& img, const std::string& filename);
 UncompressedImage loadFromBMP(const std::string& filename);
 
+// 32 bits per pixel BMP files keep their alpha channel, other files get an opaque one
+void saveAsBMP(const UncompressedImageRGBA& img, const std::string& filename);
+UncompressedImageRGBA loadFromBMPAsRGBA(const std::string& filename);
+
+UncompressedImageRGBA toRGBA(const UncompressedImage& img, uint8_t alpha = 255);
+UncompressedImage toRGB(const UncompressedImageRGBA& img);
+
+// 8 bits per pixel BMP files, the color table is the pallette and the pixels are pallette ids
+void saveAsIndexedBMP(const CompressedImage& img, const std::string& filename);
+CompressedImage loadFromIndexedBMP(const std::string& filename);
+
 UncompressedImage readUncompressedFile(const std::string& filename);
 void writeUncompressedFile(const std::string& filename, const UncompressedImage& file);
 
@@ -21,7 +33,20 @@ CompressedImage toCompressed(
     bool approximate = false, bool allow_color_add = true);
 UncompressedImage toUncompressed(const CompressedImage& img);
 
+// Read-only operations right on BMP pixels (e.g. MappedBMP::pixels()), without loading the image.
+// The indices of an indexed image are expanded through its color table like loadFromBMP does.
+CompressedImage toCompressed(
+    const BMPPixelView& pixels, const std::map<uint8_t, ColorRGB>& color_table = {},
+    bool approximate = false, bool allow_color_add = true);
+bool matchUncompressedImages(
+    const UncompressedImage& img, const BMPPixelView& pixels, bool verbose = true);
+
 CompressedImage readCompressedFile(const std::string& filename);
 void writeCompressedFile(const std::string& filename, const CompressedImage& file);
 
+// Compresses a BMP file with a fixed pallette, reading it band_rows rows at a time
+void compressBMPStream(
+    const std::string& bmp_filename, const std::string& filename,
+    const std::map<uint8_t, ColorRGB>& color_table, uint32_t band_rows = 64);
+
 ColorRGB getColor(const CompressedImage& img, int x, int y);
@@ -0,0 +1,8 @@
+#pragma once
+
+// Instruction set extensions of the CPU the program runs on, detected on the first call.
+// All of them are reported as missing on non-x86 CPUs.
+
+bool cpuHasSsse3();
+bool cpuHasSse41();
+bool cpuHasAvx2();
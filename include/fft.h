@@ -0,0 +1,39 @@
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Radix 2 fast Fourier transform of a fixed power of 2 size, in place.
+// The twiddle factors and the bit reversed order of the indices are computed once, by the
+// constructor; the transforms themselves do not allocate.
+class FftPlan {
+  public:
+    // Throws std::invalid_argument if size is not a power of 2
+    explicit FftPlan(size_t size);
+
+    size_t size() const { return size_; }
+
+    // X[f] = sum of x[n] * e^(-2 pi i f n / size)
+    void forward(std::complex<double>* data) const { transform(data, false); }
+    // The inverse transform without the 1 / size factor
+    void inverse(std::complex<double>* data) const { transform(data, true); }
+
+    // 2D transform of a size x size block stored row by row. The spectrum comes out transposed
+    // (X[fx][fy]), which makes no difference to products of spectra and to inverse2D.
+    void forward2D(std::complex<double>* data) const;
+    // Inverse of forward2D without the 1 / size^2 factor
+    void inverse2D(std::complex<double>* data) const;
+
+  private:
+    void transform(std::complex<double>* data, bool inverse) const;
+    // every column at once, the butterflies run along the rows, contiguous in memory
+    void transformColumns(std::complex<double>* data, bool inverse) const;
+    void transpose(std::complex<double>* data) const;
+
+    size_t size_;
+    // e^(-pi i k / h) for k < h, for every stage of half size h = 1, 2, 4, ..., size / 2
+    std::vector<std::complex<double>> twiddles_;
+    std::vector<uint32_t> bit_reversed_;
+};
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+
+#include "cpu_features.h"
+#include "image_view.h"
+#include "in_place_rows.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FIXED_KERNEL_X86 1
+#endif
+
+// Kernel known at compile time, indexed kernel[ky][kx] like the kernels of applyKernel.
+// It is passed by value as a template argument: applyFixedKernel<FixedKernel<3, 3>{...}, 16>.
+template <size_t Height, size_t Width>
+using FixedKernel = std::array<std::array<int, Width>, Height>;
+
+namespace fixed_kernel_detail {
+
+template <auto Kernel>
+constexpr long long kHeight = Kernel.size();
+template <auto Kernel>
+constexpr long long kWidth = Kernel[0].size();
+
+// weight of a tap, the taps are numbered row by row
+template <auto Kernel>
+constexpr int weight(size_t tap) {
+    return Kernel[tap / kWidth<Kernel>][tap % kWidth<Kernel>];
+}
+
+// How the sums of the kernel are kept in the 16 bit lanes of the vector code
+template <auto Kernel, int Divisor>
+struct Lanes {
+    static constexpr long long max_abs_sum = [] {
+        long long weight_sum = 0;
+        for (const auto& row : Kernel) {
+            for (int w : row) {
+                weight_sum += w < 0 ? -static_cast<long long>(w) : w;
+            }
+        }
+        return 255 * weight_sum;
+    }();
+    static constexpr bool is_unsigned = [] {
+        for (const auto& row : Kernel) {
+            for (int w : row) {
+                if (w < 0) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }();
+    static constexpr bool is_power_of_two = Divisor > 0 && std::has_single_bit(unsigned(Divisor));
+
+    // Sums of kernels without negative weights fit into unsigned lanes up to 65535, but the
+    // multiply-high division below is only exact for sums below 2^15
+    static constexpr bool fit = Divisor > 0
+                                && (max_abs_sum <= 32767
+                                    || (is_unsigned && is_power_of_two && max_abs_sum <= 65535));
+    // larger sums give 255 after the division anyway
+    static constexpr int max_sum = std::min(256 * Divisor - 1, is_unsigned ? 65535 : 32767);
+
+    // sum / Divisor == mulhi(sum, multiplier) >> shift for sums below 2^15 (Granlund, Montgomery)
+    static constexpr int l = std::bit_width(unsigned(Divisor - 1));
+    static constexpr int shift = is_power_of_two ? l : l - 1;
+    static constexpr uint16_t multiplier =
+        is_power_of_two ? 0 : ((uint32_t(1) << (15 + l)) + Divisor - 1) / Divisor;
+};
+
+/*
+ * The pixels [x_begin, x_end) of a row, the reference and the code for the tail of the row.
+ * The rows are padded, so every tap is a plain load. The sum is clamped before the division,
+ * so a power of two divisor is a shift, and
+ * clamp(sum, 0, 256 * Divisor - 1) / Divisor == clamp(sum / Divisor, 0, 255).
+ */
+template <auto Kernel, int Divisor, typename Pixel>
+void fixedKernelPixels(
+    const Pixel* const* rows, long long x_begin, long long x_end, std::span<Pixel> dst_row) {
+    constexpr long long kernel_width = kWidth<Kernel>;
+    for (long long x = x_begin; x < x_end; ++x) {
+        int sum_r = 0, sum_g = 0, sum_b = 0;
+        [&]<size_t... Taps>(std::index_sequence<Taps...>) {
+            auto add_tap = [&]<size_t Tap>(std::integral_constant<size_t, Tap>) {
+                constexpr int w = weight<Kernel>(Tap);
+                if constexpr (w != 0) {
+                    constexpr long long dx = static_cast<long long>(Tap % kernel_width)
+                                             - kernel_width / 2;
+                    const Pixel& pixel = rows[Tap / kernel_width][x + dx];
+                    sum_r += w * pixel.r;
+                    sum_g += w * pixel.g;
+                    sum_b += w * pixel.b;
+                }
+            };
+            (add_tap(std::integral_constant<size_t, Taps>{}), ...);
+        }(std::make_index_sequence<kHeight<Kernel> * kWidth<Kernel>>{});
+        dst_row[x].r = std::clamp(sum_r, 0, 256 * Divisor - 1) / Divisor;
+        dst_row[x].g = std::clamp(sum_g, 0, 256 * Divisor - 1) / Divisor;
+        dst_row[x].b = std::clamp(sum_b, 0, 256 * Divisor - 1) / Divisor;
+    }
+}
+
+#ifdef FIXED_KERNEL_X86
+
+// The bytes [begin, end) of a row, every channel of every pixel is a 16 bit lane and a tap
+// is the same lane of a row shifted by whole pixels. Returns where the vector loop stopped.
+using FixedKernelRowFunc = size_t (*)(const uint8_t* const*, size_t, size_t, uint8_t*);
+
+// The taps are unrolled with fold expressions over plain functions, lambdas would not inherit
+// the target attribute
+
+template <auto Kernel, size_t PixelBytes, size_t Tap>
+__attribute__((target("sse4.1"))) inline __m128i addTapSse41(
+    __m128i sum, const uint8_t* const* rows, size_t i) {
+    constexpr int w = weight<Kernel>(Tap);
+    constexpr long long dx = static_cast<long long>(Tap % kWidth<Kernel>) - kWidth<Kernel> / 2;
+    if constexpr (w == 0) {
+        return sum;
+    } else {
+        const uint8_t* taps = rows[Tap / kWidth<Kernel>] + i + dx * PixelBytes;
+        __m128i values =
+            _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(taps)));
+        if constexpr (w == 1) {
+            return _mm_add_epi16(sum, values);
+        } else if constexpr (w == -1) {
+            return _mm_sub_epi16(sum, values);
+        } else {
+            return _mm_add_epi16(sum, _mm_mullo_epi16(values, _mm_set1_epi16(w)));
+        }
+    }
+}
+
+template <auto Kernel, size_t PixelBytes, size_t... Taps>
+__attribute__((target("sse4.1"))) inline __m128i sumTapsSse41(
+    const uint8_t* const* rows, size_t i, std::index_sequence<Taps...>) {
+    __m128i sum = _mm_setzero_si128();
+    ((sum = addTapSse41<Kernel, PixelBytes, Taps>(sum, rows, i)), ...);
+    return sum;
+}
+
+template <auto Kernel, int Divisor, size_t PixelBytes>
+__attribute__((target("sse4.1"))) size_t fixedKernelRowSse41(
+    const uint8_t* const* rows, size_t begin, size_t end, uint8_t* dst) {
+    using L = Lanes<Kernel, Divisor>;
+    constexpr auto kTaps = std::make_index_sequence<kHeight<Kernel> * kWidth<Kernel>>{};
+    const __m128i max_sum = _mm_set1_epi16(static_cast<short>(L::max_sum));
+    // the alpha of 4 byte pixels is kept, begin is a multiple of the pixel size
+    const __m128i alpha_mask = _mm_set1_epi32(PixelBytes == 4 ? static_cast<int>(0xFF000000u) : 0);
+    const uint8_t* center_row = rows[kHeight<Kernel> / 2];
+
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m128i sum = sumTapsSse41<Kernel, PixelBytes>(rows, i, kTaps);
+
+        if constexpr (L::is_unsigned) {
+            sum = _mm_min_epu16(sum, max_sum);
+        } else {
+            sum = _mm_min_epi16(_mm_max_epi16(sum, _mm_setzero_si128()), max_sum);
+        }
+        if constexpr (!L::is_power_of_two) {
+            sum = _mm_mulhi_epu16(sum, _mm_set1_epi16(static_cast<short>(L::multiplier)));
+        }
+        if constexpr (L::shift > 0) {
+            sum = _mm_srli_epi16(sum, L::shift);
+        }
+        __m128i center = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(center_row + i));
+        __m128i result = _mm_blendv_epi8(_mm_packus_epi16(sum, sum), center, alpha_mask);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), result);
+    }
+    return i;
+}
+
+template <auto Kernel, size_t PixelBytes, size_t Tap>
+__attribute__((target("avx2"))) inline __m256i addTapAvx2(
+    __m256i sum, const uint8_t* const* rows, size_t i) {
+    constexpr int w = weight<Kernel>(Tap);
+    constexpr long long dx = static_cast<long long>(Tap % kWidth<Kernel>) - kWidth<Kernel> / 2;
+    if constexpr (w == 0) {
+        return sum;
+    } else {
+        const uint8_t* taps = rows[Tap / kWidth<Kernel>] + i + dx * PixelBytes;
+        __m256i values =
+            _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(taps)));
+        if constexpr (w == 1) {
+            return _mm256_add_epi16(sum, values);
+        } else if constexpr (w == -1) {
+            return _mm256_sub_epi16(sum, values);
+        } else {
+            return _mm256_add_epi16(sum, _mm256_mullo_epi16(values, _mm256_set1_epi16(w)));
+        }
+    }
+}
+
+template <auto Kernel, size_t PixelBytes, size_t... Taps>
+__attribute__((target("avx2"))) inline __m256i sumTapsAvx2(
+    const uint8_t* const* rows, size_t i, std::index_sequence<Taps...>) {
+    __m256i sum = _mm256_setzero_si256();
+    ((sum = addTapAvx2<Kernel, PixelBytes, Taps>(sum, rows, i)), ...);
+    return sum;
+}
+
+template <auto Kernel, int Divisor, size_t PixelBytes>
+__attribute__((target("avx2"))) size_t fixedKernelRowAvx2(
+    const uint8_t* const* rows, size_t begin, size_t end, uint8_t* dst) {
+    using L = Lanes<Kernel, Divisor>;
+    constexpr auto kTaps = std::make_index_sequence<kHeight<Kernel> * kWidth<Kernel>>{};
+    const __m256i max_sum = _mm256_set1_epi16(static_cast<short>(L::max_sum));
+    const __m128i alpha_mask = _mm_set1_epi32(PixelBytes == 4 ? static_cast<int>(0xFF000000u) : 0);
+    const uint8_t* center_row = rows[kHeight<Kernel> / 2];
+
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16) {
+        __m256i sum = sumTapsAvx2<Kernel, PixelBytes>(rows, i, kTaps);
+
+        if constexpr (L::is_unsigned) {
+            sum = _mm256_min_epu16(sum, max_sum);
+        } else {
+            sum = _mm256_min_epi16(_mm256_max_epi16(sum, _mm256_setzero_si256()), max_sum);
+        }
+        if constexpr (!L::is_power_of_two) {
+            sum = _mm256_mulhi_epu16(sum, _mm256_set1_epi16(static_cast<short>(L::multiplier)));
+        }
+        if constexpr (L::shift > 0) {
+            sum = _mm256_srli_epi16(sum, L::shift);
+        }
+        // packus works within the 128 bit lanes, the permutation joins the two halves
+        __m256i packed = _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(sum, sum), _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i center = _mm_loadu_si128(reinterpret_cast<const __m128i*>(center_row + i));
+        __m128i result = _mm_blendv_epi8(_mm256_castsi256_si128(packed), center, alpha_mask);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), result);
+    }
+    return fixedKernelRowSse41<Kernel, Divisor, PixelBytes>(rows, i, end, dst);
+}
+
+template <auto Kernel, int Divisor, size_t PixelBytes>
+FixedKernelRowFunc selectFixedKernelRow() {
+    if constexpr (Lanes<Kernel, Divisor>::fit && (PixelBytes == 3 || PixelBytes == 4)) {
+        if (cpuHasAvx2()) {
+            return fixedKernelRowAvx2<Kernel, Divisor, PixelBytes>;
+        }
+        if (cpuHasSse41()) {
+            return fixedKernelRowSse41<Kernel, Divisor, PixelBytes>;
+        }
+    }
+    return nullptr;
+}
+
+#endif
+
+}  // namespace fixed_kernel_detail
+
+// One row of applyFixedKernel: dst_row from the kernel height source rows around it, padded like
+// the rows of filterRowsInPlace (rows[kernel height / 2] is the row of dst_row itself)
+template <auto Kernel, int Divisor, typename Pixel>
+void applyFixedKernelRow(const Pixel* const* rows, std::span<Pixel> dst_row) {
+    using namespace fixed_kernel_detail;
+    static_assert(Divisor > 0, "the divisor of a fixed kernel has to be positive");
+    const long long width = dst_row.size();
+
+    long long scalar_begin = 0;
+#ifdef FIXED_KERNEL_X86
+    static const FixedKernelRowFunc row_func =
+        selectFixedKernelRow<Kernel, Divisor, sizeof(Pixel)>();
+    if (row_func != nullptr) {
+        std::array<const uint8_t*, kHeight<Kernel>> byte_rows;
+        for (long long ky = 0; ky < kHeight<Kernel>; ++ky) {
+            byte_rows[ky] = reinterpret_cast<const uint8_t*>(rows[ky]);
+        }
+        const size_t done_bytes = row_func(
+            byte_rows.data(), 0, width * sizeof(Pixel),
+            reinterpret_cast<uint8_t*>(dst_row.data()));
+        scalar_begin = done_bytes / sizeof(Pixel);
+    }
+#endif
+    fixedKernelPixels<Kernel, Divisor>(rows, scalar_begin, width, dst_row);
+}
+
+// applyKernel with the kernel and the divisor known at compile time: the taps are unrolled,
+// zero taps are dropped, taps of weight 1 and -1 need no multiplication and a power of two
+// divisor is a shift. The result is exactly the one of applyKernel(view, kernel, Divisor) with
+// the same border. Like applyKernel, the rows are filtered in place, in bands on the transform
+// thread pool.
+template <auto Kernel, int Divisor, typename Pixel>
+void applyFixedKernel(
+    ImageView<Pixel> view, BorderMode border = BorderMode::Clamp, Pixel border_color = {}) {
+    filterRowsInPlace(
+        view, fixed_kernel_detail::kHeight<Kernel>, fixed_kernel_detail::kWidth<Kernel>,
+        ViewBorder<Pixel>{border, border_color},
+        [](const Pixel* const* rows, std::span<Pixel> dst_row) {
+            applyFixedKernelRow<Kernel, Divisor>(rows, dst_row);
+        });
+}
+
+template <auto Kernel, int Divisor, typename Image>
+void applyFixedKernel(Image& img) {
+    applyFixedKernel<Kernel, Divisor>(img.image_data.view());
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <span>
+#include <vector>
+
+#include "image_view.h"
+
+// Allocator for the pixel storage, the first row starts on a cache line
+template <typename T>
+struct CacheAlignedAllocator {
+    using value_type = T;
+    static constexpr std::align_val_t kAlignment{64};
+
+    CacheAlignedAllocator() = default;
+    template <typename U>
+    CacheAlignedAllocator(const CacheAlignedAllocator<U>&) {}
+
+    T* allocate(size_t count) {
+        return static_cast<T*>(::operator new(count * sizeof(T), kAlignment));
+    }
+    void deallocate(T* pointer, size_t) { ::operator delete(pointer, kAlignment); }
+
+    template <typename U>
+    bool operator==(const CacheAlignedAllocator<U>&) const {
+        return true;
+    }
+};
+
+// Rows of 4 byte pixels are padded to 32 bytes, so every row can be processed with aligned
+// 16 and 32 byte vector loads. Other pixels are stored without padding.
+template <typename Pixel>
+constexpr size_t kRowAlignment = sizeof(Pixel) == 4 ? 32 : sizeof(Pixel);
+
+// Contiguous, row-strided 2D pixel storage.
+//
+// All rows live in a single allocation, row y starts at data() + y * stride().
+// The stride is the width rounded up to kRowAlignment bytes.
+// Indexing with [] yields a std::span over the row, so buffer[y][x] keeps working
+// the same way the old vector<vector<...>> layout did.
+template <typename Pixel>
+class ImageBuffer {
+  public:
+    ImageBuffer() = default;
+
+    ImageBuffer(uint32_t width, uint32_t height, const Pixel& value = {}) {
+        resize(width, height, value);
+    }
+
+    // Builds a buffer out of nested rows, all rows are expected to be of the same length
+    ImageBuffer(const std::vector<std::vector<Pixel>>& rows) {
+        resize(rows.empty() ? 0 : rows.front().size(), rows.size());
+        for (size_t y = 0; y < height_; ++y) {
+            std::copy_n(rows[y].begin(), width_, row(y).begin());
+        }
+    }
+
+    void resize(uint32_t width, uint32_t height, const Pixel& value = {}) {
+        width_ = width;
+        height_ = height;
+        constexpr size_t row_pixels = kRowAlignment<Pixel> / sizeof(Pixel);
+        stride_ = (size_t(width) + row_pixels - 1) / row_pixels * row_pixels;
+        pixels_.assign(stride_ * height_, value);
+    }
+
+    void clear() {
+        width_ = height_ = 0;
+        stride_ = 0;
+        pixels_.clear();
+    }
+
+    void swap(ImageBuffer& other) noexcept {
+        std::swap(width_, other.width_);
+        std::swap(height_, other.height_);
+        std::swap(stride_, other.stride_);
+        pixels_.swap(other.pixels_);
+    }
+
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+    // distance between two consecutive rows, in pixels
+    size_t stride() const { return stride_; }
+
+    // number of rows, so the buffer can be used as a drop-in for a container of rows
+    size_t size() const { return height_; }
+    bool empty() const { return height_ == 0 || width_ == 0; }
+
+    Pixel* data() { return pixels_.data(); }
+    const Pixel* data() const { return pixels_.data(); }
+
+    std::span<Pixel> row(size_t y) { return {pixels_.data() + y * stride_, width_}; }
+    std::span<const Pixel> row(size_t y) const { return {pixels_.data() + y * stride_, width_}; }
+
+    std::span<Pixel> operator[](size_t y) { return row(y); }
+    std::span<const Pixel> operator[](size_t y) const { return row(y); }
+
+    ImageView<Pixel> view() { return {pixels_.data(), width_, height_, byteStride()}; }
+    ConstImageView<Pixel> view() const { return {pixels_.data(), width_, height_, byteStride()}; }
+
+    ImageView<Pixel> view(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+        return view().subview(x, y, width, height);
+    }
+    ConstImageView<Pixel> view(uint32_t x, uint32_t y, uint32_t width, uint32_t height) const {
+        return view().subview(x, y, width, height);
+    }
+
+    bool operator==(const ImageBuffer& other) const {
+        if (width_ != other.width_ || height_ != other.height_) {
+            return false;
+        }
+        for (size_t y = 0; y < height_; ++y) {
+            if (!std::equal(row(y).begin(), row(y).end(), other.row(y).begin())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool operator!=(const ImageBuffer& other) const { return !(*this == other); }
+
+  private:
+    ptrdiff_t byteStride() const { return static_cast<ptrdiff_t>(stride_ * sizeof(Pixel)); }
+
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+    size_t stride_ = 0;
+    std::vector<Pixel, CacheAlignedAllocator<Pixel>> pixels_;
+};
@@ -1,28 +1,239 @@
+#pragma once
+
+#include <algorithm>
 #include <vector>
 #include <cstdint>
 
 #include "colors.h"
 #include "compressor_funcs.h"
 
+// What smart_gap_interpolation of rotate did
+struct RotationStats {
+    // pixels of the canvas no source pixel was mapped to
+    size_t gap_pixels = 0;
+    // gap pixels next to a mapped one, which got the average of their mapped neighbours,
+    // the others keep the fill color
+    size_t filled_gap_pixels = 0;
+};
+
+// stats, if given, gets the counts of the gap interpolation (zeros without it)
 void rotate(UncompressedImage& img, int angle, ColorRGB fill_color={0, 0, 0},
-bool smart_gap_interpolation = false);
+bool smart_gap_interpolation = false, RotationStats* stats = nullptr);
 
+// Rotation by three shears, the angle in degrees in the same direction as rotate. Every shear
+// moves whole rows (or columns) by a fraction of a pixel and blends the two pixels each output
+// pixel falls between, so the rows are read one after another instead of gathering a source pixel
+// for every output pixel, and the edges are smooth where nearest neighbour rotation leaves steps.
+// The canvas and the center are the ones of rotate, fill_color is blended in along the edges of
+// the rotated image. Multiples of 90 degrees give exactly the result of rotate.
+void rotateShear(UncompressedImage& img, double angle, ColorRGB fill_color = {0, 0, 0});
 
+
+// Kernels of rank 1 (kernel[ky][kx] == vertical[ky] * horizontal[kx], like the gaussian
+// approximations) are detected and applied as a horizontal and a vertical pass, other large
+// kernels go through the FFT. The pixels outside of the image are given by the border mode
+// (border_color for BorderMode::Constant). The rows are padded with them once, so the loop over
+// the pixels never looks at the borders.
 void applyKernel(
-    UncompressedImage& img, const std::vector<std::vector<int>>& kernel, int divisor = 1);
+    UncompressedImage& img, const std::vector<std::vector<int>>& kernel, int divisor = 1,
+    BorderMode border = BorderMode::Clamp, ColorRGB border_color = {0, 0, 0});
+
+// Reference implementation of applyKernel: the plain 2D loop, without the SIMD code (chosen at
+// runtime by the CPU features), the separable passes and the FFT. The results are the same.
+void applyKernelScalar(
+    UncompressedImage& img, const std::vector<std::vector<int>>& kernel, int divisor = 1,
+    BorderMode border = BorderMode::Clamp, ColorRGB border_color = {0, 0, 0});
+
+// FFT implementation of applyKernel (tiled overlap-save), which applyKernel picks by itself for
+// large kernels that are not of rank 1. The result is the same as the one of the direct loop.
+// Throws std::invalid_argument for an empty kernel, a kernel larger than 512 in either direction
+// or one whose sums may overflow an int.
+void applyKernelFft(
+    UncompressedImage& img, const std::vector<std::vector<int>>& kernel, int divisor = 1,
+    BorderMode border = BorderMode::Clamp, ColorRGB border_color = {0, 0, 0});
+
+// Applies the kernel vertical[ky] * horizontal[kx] as two passes, the result is exactly the one
+// of applyKernel with the full kernel
+void applySeparableKernel(
+    UncompressedImage& img, const std::vector<int>& horizontal, const std::vector<int>& vertical,
+    int divisor = 1);
 
 void sharpen(UncompressedImage& img);
 void gaussianBlurApprox(UncompressedImage& img, bool hard_blur=false);
 void edgeDetect(UncompressedImage& img);
 
+// Mean of the (2 * radius + 1)^2 pixels around every pixel, as a horizontal and a vertical pass
+// that each round to the nearest value. Both passes keep running sums, so the time per pixel
+// does not depend on the radius. Throws std::invalid_argument for a radius above 32767.
+void boxBlur(UncompressedImage& img, uint32_t radius);
+// Approximation of a gaussian blur of the given standard deviation by passes box blurs
+// (3 are within a few percent of the true gaussian), as fast for any sigma as boxBlur
+void gaussianBlur(UncompressedImage& img, double sigma, int passes = 3);
+
 void negative(UncompressedImage& img);
 void negative(CompressedImage& img);
 
 void toGrayscale(UncompressedImage& img);
 void toGrayscale(CompressedImage& img);
 
+// The same transforms on a view (e.g. a region of interest or a tile of an image),
+// the borders of the view are treated as the borders of the image
+
+void applyKernel(
+    ImageView<ColorRGB> view, const std::vector<std::vector<int>>& kernel, int divisor = 1,
+    BorderMode border = BorderMode::Clamp, ColorRGB border_color = {0, 0, 0});
+void applySeparableKernel(
+    ImageView<ColorRGB> view, const std::vector<int>& horizontal, const std::vector<int>& vertical,
+    int divisor = 1);
+
+void sharpen(ImageView<ColorRGB> view);
+void gaussianBlurApprox(ImageView<ColorRGB> view, bool hard_blur = false);
+void edgeDetect(ImageView<ColorRGB> view);
+void boxBlur(ImageView<ColorRGB> view, uint32_t radius);
+void gaussianBlur(ImageView<ColorRGB> view, double sigma, int passes = 3);
+
+void negative(ImageView<ColorRGB> view);
+void toGrayscale(ImageView<ColorRGB> view);
+
+// Overloads for 4 byte pixels, the alpha channel is kept as it is (rotation moves it together
+// with the color and the fill color brings its own)
+
+void rotate(
+    UncompressedImageRGBA& img, int angle, ColorRGBA fill_color = {0, 0, 0, 255},
+    bool smart_gap_interpolation = false, RotationStats* stats = nullptr);
+void rotateShear(UncompressedImageRGBA& img, double angle, ColorRGBA fill_color = {0, 0, 0, 255});
+
+void applyKernel(
+    UncompressedImageRGBA& img, const std::vector<std::vector<int>>& kernel, int divisor = 1,
+    BorderMode border = BorderMode::Clamp, ColorRGBA border_color = {0, 0, 0, 255});
+void applyKernel(
+    ImageView<ColorRGBA> view, const std::vector<std::vector<int>>& kernel, int divisor = 1,
+    BorderMode border = BorderMode::Clamp, ColorRGBA border_color = {0, 0, 0, 255});
+void applyKernelScalar(
+    UncompressedImageRGBA& img, const std::vector<std::vector<int>>& kernel, int divisor = 1,
+    BorderMode border = BorderMode::Clamp, ColorRGBA border_color = {0, 0, 0, 255});
+void applyKernelFft(
+    UncompressedImageRGBA& img, const std::vector<std::vector<int>>& kernel, int divisor = 1,
+    BorderMode border = BorderMode::Clamp, ColorRGBA border_color = {0, 0, 0, 255});
+void applySeparableKernel(
+    UncompressedImageRGBA& img, const std::vector<int>& horizontal,
+    const std::vector<int>& vertical, int divisor = 1);
+void applySeparableKernel(
+    ImageView<ColorRGBA> view, const std::vector<int>& horizontal,
+    const std::vector<int>& vertical, int divisor = 1);
+
+void sharpen(UncompressedImageRGBA& img);
+void sharpen(ImageView<ColorRGBA> view);
+void gaussianBlurApprox(UncompressedImageRGBA& img, bool hard_blur = false);
+void gaussianBlurApprox(ImageView<ColorRGBA> view, bool hard_blur = false);
+void edgeDetect(UncompressedImageRGBA& img);
+void edgeDetect(ImageView<ColorRGBA> view);
+void boxBlur(UncompressedImageRGBA& img, uint32_t radius);
+void boxBlur(ImageView<ColorRGBA> view, uint32_t radius);
+void gaussianBlur(UncompressedImageRGBA& img, double sigma, int passes = 3);
+void gaussianBlur(ImageView<ColorRGBA> view, double sigma, int passes = 3);
+
+void negative(UncompressedImageRGBA& img);
+void negative(ImageView<ColorRGBA> view);
+void toGrayscale(UncompressedImageRGBA& img);
+void toGrayscale(ImageView<ColorRGBA> view);
+
+// Gradient operators of edgeMap: the derivative [-1 0 1] across the edge and the smoothing
+// [1 2 1] (Sobel) or [3 10 3] (Scharr, closer to rotation invariant) along it
+enum class GradientOperator { Sobel, Scharr };
+
+struct EdgeMapOptions {
+    GradientOperator gradient = GradientOperator::Sobel;
+    // keep only the pixels whose magnitude is a maximum across the edge, the others are 0
+    bool non_max_suppression = false;
+};
+
+// Single channel edge map of an image, from the gradient of its luma (the gray of toGrayscale)
+// instead of a kernel applied to every color channel like edgeDetect. The rows are converted to
+// luma once, and Gx and Gy come out of the same pass over them: the smoothing of one is the
+// smoothing across the rows the other one takes its difference from.
+//
+// A pixel of the map is sqrt(Gx^2 + Gy^2) divided by the sum of the smoothing weights (4 or 16)
+// and rounded, so a step from black to white is 255, steeper corners saturate. Non-maximum
+// suppression compares a pixel with its two neighbours along the gradient rounded to a multiple
+// of 45 degrees, which leaves edges one pixel thin. The borders are clamped.
+//
+// direction, if given, gets the direction of the gradient of every pixel in 256 steps per turn:
+// 0 points to increasing x (dark on the left), 64 to increasing y (dark above).
+ImageBuffer<uint8_t> edgeMap(
+    const UncompressedImage& img, const EdgeMapOptions& options = {},
+    ImageBuffer<uint8_t>* direction = nullptr);
+ImageBuffer<uint8_t> edgeMap(
+    const UncompressedImageRGBA& img, const EdgeMapOptions& options = {},
+    ImageBuffer<uint8_t>* direction = nullptr);
+ImageBuffer<uint8_t> edgeMap(
+    ConstImageView<ColorRGB> view, const EdgeMapOptions& options = {},
+    ImageBuffer<uint8_t>* direction = nullptr);
+ImageBuffer<uint8_t> edgeMap(
+    ConstImageView<ColorRGBA> view, const EdgeMapOptions& options = {},
+    ImageBuffer<uint8_t>* direction = nullptr);
+
+// Filters applied one after another in a single pass over the image, with the same result as
+// calling them one by one:
+//     FilterChain().addGaussianBlurApprox().addSharpen().apply(img);
+//
+// The rows stream through the stages. Every stage keeps only the rows its kernel reads in a ring
+// buffer of a few rows, so the image is read and written once per chain instead of once per
+// filter. Stages that compose exactly are folded when they are added: identity kernels are
+// dropped, two negatives in a row cancel out, and a grayscale conversion after another one is a
+// no-op. Two kernels are never merged into one, because every stage clamps and truncates its
+// result (and the border pixels), so the merged kernel would give a different image.
+class FilterChain {
+  public:
+    struct Stage {
+        enum class Type { Kernel, Negative, Grayscale };
+
+        Type type = Type::Kernel;
+        std::vector<std::vector<int>> kernel;  // Type::Kernel only
+        int divisor = 1;
+    };
+
+    FilterChain& addKernel(const std::vector<std::vector<int>>& kernel, int divisor = 1);
+    FilterChain& addSharpen();
+    FilterChain& addGaussianBlurApprox(bool hard_blur = false);
+    FilterChain& addEdgeDetect();
+    FilterChain& addNegative();
+    FilterChain& addToGrayscale();
+
+    // the stages left after folding
+    const std::vector<Stage>& stages() const { return stages_; }
+    bool empty() const { return stages_.empty(); }
+
+    void apply(UncompressedImage& img) const;
+    void apply(UncompressedImageRGBA& img) const;
+    void apply(ImageView<ColorRGB> view) const;
+    void apply(ImageView<ColorRGBA> view) const;
+
+  private:
+    bool hasGrayscale() const;
+
+    std::vector<Stage> stages_;
+};
+
 // template methods below
 
+template <typename Pixel>
+void mirror(ImageView<Pixel> view, bool horizontal = false) {
+    // horizontal mirroring reverses every row, vertical one reverses the order of the rows
+    if (horizontal) {
+        for (size_t y = 0; y < view.height(); ++y) {
+            std::span<Pixel> row = view[y];
+            std::reverse(row.begin(), row.end());
+        }
+        return;
+    }
+    for (size_t top = 0, bottom = view.height(); top + 1 < bottom; ++top, --bottom) {
+        std::span<Pixel> top_row = view[top];
+        std::swap_ranges(top_row.begin(), top_row.end(), view[bottom - 1].begin());
+    }
+}
+
 template <typename Image>
 void mirror(Image& img, bool horizontal = false) {
-}
\ No newline at end of file
+    mirror(img.image_data.view(), horizontal);
+}
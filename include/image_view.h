@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+
+// Non-owning view of a 2D block of pixels: a pointer to the first pixel of row 0, the size,
+// and the distance between two consecutive rows in bytes. Views of regions of interest,
+// crops and tiles point into the memory of the image they are taken from, nothing is copied.
+//
+// ImageView<const Pixel> (ConstImageView<Pixel>) is the read-only flavour, a mutable view
+// converts to it implicitly.
+template <typename Pixel>
+class ImageView {
+    using Byte = std::conditional_t<std::is_const_v<Pixel>, const std::byte, std::byte>;
+
+  public:
+    ImageView() = default;
+
+    ImageView(Pixel* data, uint32_t width, uint32_t height, ptrdiff_t stride_bytes) :
+        data_(data), width_(width), height_(height), stride_(stride_bytes) {}
+
+    operator ImageView<const Pixel>() const { return {data_, width_, height_, stride_}; }
+
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+    // distance between two consecutive rows, in bytes
+    ptrdiff_t stride() const { return stride_; }
+    bool empty() const { return width_ == 0 || height_ == 0; }
+
+    Pixel* data() const { return data_; }
+
+    std::span<Pixel> row(size_t y) const {
+        Byte* row_start = reinterpret_cast<Byte*>(data_) + static_cast<ptrdiff_t>(y) * stride_;
+        return {reinterpret_cast<Pixel*>(row_start), width_};
+    }
+    std::span<Pixel> operator[](size_t y) const { return row(y); }
+
+    // view of the width x height block with the top left corner at (x, y)
+    ImageView subview(uint32_t x, uint32_t y, uint32_t width, uint32_t height) const {
+        return {row(y).data() + x, width, height, stride_};
+    }
+
+  private:
+    Pixel* data_ = nullptr;
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+    ptrdiff_t stride_ = 0;
+};
+
+template <typename Pixel>
+using ConstImageView = ImageView<const Pixel>;
+
+// What the filters read outside of a view, for a row a b c d:
+//     Clamp     a a | a b c d | d d   the closest pixel (the default)
+//     Reflect   b a | a b c d | d c   the view mirrored at its edges, the edge pixel repeated
+//     Wrap      c d | a b c d | a b   the view repeated, like a tiled texture
+//     Constant  k k | a b c d | k k   a given color
+enum class BorderMode { Clamp, Reflect, Wrap, Constant };
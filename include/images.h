@@ -1,16 +1,27 @@
 #pragma once
 
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <cstdint>
 
 #include "colors.h"
+#include "image_buffer.h"
 
 struct UncompressedImage {
     uint32_t width = 0;
     uint32_t height = 0;
     bool is_grayscale = false;
-    std::vector<std::vector<ColorRGB>> image_data;
+    ImageBuffer<ColorRGB> image_data;
+};
+
+// Same image with 4 byte pixels. Its rows are aligned for vector loads, so this is the storage
+// to pick for heavy processing. The transforms keep the alpha channel as it is.
+struct UncompressedImageRGBA {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    bool is_grayscale = false;
+    ImageBuffer<ColorRGBA> image_data;
 };
 
 struct CompressedImage {
@@ -18,7 +29,7 @@ struct CompressedImage {
     uint32_t height = 0;
     std::map<uint8_t, ColorRGB> id_to_color;             // pallette
     std::unordered_map<ColorRGB, uint8_t, ColorHash> color_to_id;  // inverse pallette
-    std::vector<std::vector<uint8_t>> image_data;
+    ImageBuffer<uint8_t> image_data;                     // pallette ids, one byte per pixel
 };
 
 bool matchUncompressedImages(const UncompressedImage& img1, const UncompressedImage& img2, bool verbose = true);
\ No newline at end of file
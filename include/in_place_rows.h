@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+
+#include "image_view.h"
+#include "scratch_arena.h"
+#include "thread_pool.h"
+
+// A border mode together with the color of BorderMode::Constant
+template <typename Pixel>
+struct ViewBorder {
+    BorderMode mode = BorderMode::Clamp;
+    Pixel color{};
+};
+
+// The index in [0, size) that the index i outside of it reads, for every mode but Constant
+inline long long borderIndex(long long i, long long size, BorderMode mode) {
+    if (mode == BorderMode::Reflect) {
+        const long long period = 2 * size;
+        i = (i % period + period) % period;
+        return i < size ? i : period - 1 - i;
+    }
+    if (mode == BorderMode::Wrap) {
+        return (i % size + size) % size;
+    }
+    return std::clamp(i, 0LL, size - 1);
+}
+
+// Fills the pad_left pixels before the width pixels of row and the pad_right pixels after them,
+// so that a kernel reads row[x + dx] for every x in [0, width) without looking at the borders
+template <typename Pixel>
+void padRow(
+    Pixel* row, long long width, long long pad_left, long long pad_right,
+    const ViewBorder<Pixel>& border) {
+    for (long long x = -pad_left; x < 0; ++x) {
+        row[x] = border.mode == BorderMode::Constant ? border.color
+                                                     : row[borderIndex(x, width, border.mode)];
+    }
+    for (long long x = width; x < width + pad_right; ++x) {
+        row[x] = border.mode == BorderMode::Constant ? border.color
+                                                     : row[borderIndex(x, width, border.mode)];
+    }
+}
+
+// The original rows around the bands of a view that are filtered in place at the same time.
+//
+// A band reads halo_top rows above it and halo_bottom rows below it, and those are overwritten by
+// its neighbours, so they are saved before any band starts: (halo_top + halo_bottom) rows per
+// band instead of a copy of the whole view. The rows of the band itself are read from the view,
+// a band has to read each of them before it writes it. The halo_top rows above the view and the
+// halo_bottom rows below it are the rows the border mode gives, saved the same way.
+template <typename Pixel>
+class BandHalos {
+  public:
+    BandHalos(
+        ScratchScope& scratch, ImageView<Pixel> view, size_t bands, long long halo_top,
+        long long halo_bottom, const ViewBorder<Pixel>& border = {}) :
+        view_(view),
+        bands_(bands),
+        halo_top_(halo_top),
+        halo_rows_(halo_top + halo_bottom) {
+        const long long height = view.height();
+        outer_rows_ = scratch.acquireImage<Pixel>(view.width(), height > 0 ? halo_rows_ : 0);
+        for (long long i = 0; i < outer_rows_.height(); ++i) {
+            const long long y = i < halo_top ? i - halo_top : height + i - halo_top;
+            if (border.mode == BorderMode::Constant) {
+                std::ranges::fill(outer_rows_[i], border.color);
+            } else {
+                const long long src_y = borderIndex(y, height, border.mode);
+                std::ranges::copy(view[src_y], outer_rows_[i].begin());
+            }
+        }
+        halos_ = scratch.acquireImage<Pixel>(view.width(), bands > 1 ? bands * halo_rows_ : 0);
+        if (bands <= 1 || halo_rows_ == 0) {
+            return;
+        }
+        transformThreadPool().parallelFor(bands, [&](size_t band) {
+            const long long y_begin = bandBegin(band);
+            const long long y_end = bandBegin(band + 1);
+            for (long long y = std::max(y_begin - halo_top, 0LL); y < y_begin; ++y) {
+                std::ranges::copy(view[y], haloRow(band, y).begin());
+            }
+            for (long long y = y_end; y < std::min(y_end + halo_bottom, height); ++y) {
+                std::ranges::copy(view[y], haloRow(band, y).begin());
+            }
+        });
+    }
+
+    size_t bands() const { return bands_; }
+    long long bandBegin(size_t band) const {
+        return ::bandBegin(view_.height(), bands_, band);
+    }
+
+    // row y of the original view, y inside the band or its halo (which may reach past the view)
+    std::span<const Pixel> sourceRow(size_t band, long long y) const {
+        if (y < 0) {
+            return outer_rows_[y + halo_top_];
+        }
+        if (y >= view_.height()) {
+            return outer_rows_[halo_top_ + y - view_.height()];
+        }
+        if (bands_ > 1 && (y < bandBegin(band) || y >= bandBegin(band + 1))) {
+            return haloRow(band, y);
+        }
+        return view_[y];
+    }
+
+  private:
+    // rows [halo_rows * band, halo_rows * (band + 1)) hold the halo above and below the band
+    std::span<Pixel> haloRow(size_t band, long long y) const {
+        const long long y_begin = bandBegin(band);
+        const long long index = y < y_begin ? y - (y_begin - halo_top_)
+                                            : halo_top_ + y - bandBegin(band + 1);
+        return halos_[halo_rows_ * band + index];
+    }
+
+    ImageView<Pixel> view_;
+    ImageView<Pixel> halos_;
+    ImageView<Pixel> outer_rows_;
+    size_t bands_;
+    long long halo_top_;
+    long long halo_rows_;
+};
+
+// Filters the rows of a view in place: row_func(rows, dst_row) computes a row from the
+// kernel_height original rows around it (rows[kernel_height / 2] is the row itself) and writes it
+// to dst_row. The rows are padded for a kernel_width wide kernel: rows[ky][x] is valid for x in
+// [-(kernel_width / 2), width + kernel_width - 1 - kernel_width / 2), and the rows and pixels
+// outside of the view are the ones of the border mode, so row_func never checks the borders.
+// The rows a band still needs are kept in a ring of kernel_height rows, so the extra memory is
+// O(kernel_height * width) and stays in the cache, instead of a copy of the view. The rows are
+// filtered in bands on the transform thread pool, with the same result for any number of threads.
+template <typename Pixel, typename RowFunc>
+void filterRowsInPlace(
+    ImageView<Pixel> view, long long kernel_height, long long kernel_width,
+    const ViewBorder<Pixel>& border, RowFunc&& row_func) {
+    const long long width = view.width();
+    const long long height = view.height();
+    if (width == 0 || height == 0 || kernel_height <= 0 || kernel_width <= 0) {
+        return;
+    }
+    const long long halo_top = kernel_height / 2;
+    const long long halo_bottom = kernel_height - 1 - halo_top;
+    const long long pad_left = kernel_width / 2;
+    const long long pad_right = kernel_width - 1 - pad_left;
+
+    ScratchScope scratch;
+    // the halos of a band cost as much as filtering its rows again, they are kept well below that
+    const size_t bands = rowBandCount(width, height, std::max(4 * (kernel_height - 1), 1LL));
+    const BandHalos<Pixel> halos(scratch, view, bands, halo_top, halo_bottom, border);
+    auto filter_band = [&](size_t band) {
+        const long long y_begin = halos.bandBegin(band);
+        const long long y_end = halos.bandBegin(band + 1);
+        // the ring and the row pointers live in the scratch of the thread running the band,
+        // ring row (y + halo_top) % kernel_height holds the source row y
+        ScratchScope band_scratch;
+        ImageView<Pixel> ring =
+            band_scratch.acquireImage<Pixel>(pad_left + width + pad_right, kernel_height);
+        std::span<const Pixel*> rows = band_scratch.acquire<const Pixel*>(kernel_height);
+
+        long long next_src_row = y_begin - halo_top;
+        for (long long y = y_begin; y < y_end; ++y) {
+            // row y is saved in the ring before it is overwritten
+            for (; next_src_row <= y + halo_bottom; ++next_src_row) {
+                Pixel* ring_row = ring[(next_src_row + halo_top) % kernel_height].data() + pad_left;
+                std::ranges::copy(halos.sourceRow(band, next_src_row), ring_row);
+                padRow(ring_row, width, pad_left, pad_right, border);
+            }
+            for (long long ky = 0; ky < kernel_height; ++ky) {
+                rows[ky] = ring[(y + ky) % kernel_height].data() + pad_left;
+            }
+            row_func(static_cast<const Pixel* const*>(rows.data()), view[y]);
+        }
+    };
+    if (bands == 1) {
+        filter_band(0);
+        return;
+    }
+    transformThreadPool().parallelFor(bands, filter_band);
+}
@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -40,13 +41,26 @@ struct BMPColorHeader {
 	uint32_t unused[16]{0};                // Unused data for sRGB color space
 };
 
+// Entry of the color table of an 8 bits per pixel (indexed) BMP
+struct BMPColorTableEntry {
+	uint8_t blue{0};
+	uint8_t green{0};
+	uint8_t red{0};
+	uint8_t reserved{0};
+};
+
 class BMP {
 public:
 	BMP(int width, int height, bool has_alpha = false);
+	// 8 bits per pixel image, every pixel is an index into color_table (at most 256 entries)
+	BMP(int width, int height, const std::vector<BMPColorTableEntry> &color_table);
 	BMP(const char *fname);
 	void read(const char *fname);
 	void write(const char *fname);
 
+	// Pixels of an indexed image are indices, not colors: set_pixel and the get_pixel with alpha
+	// throw for them, the get_pixel without alpha looks the color up (and throws for an index
+	// past the color table)
 	void set_pixel(int x, int y, uint8_t r, uint8_t g, uint8_t b);
 	void set_pixel(int x, int y, uint8_t r, uint8_t g, uint8_t b, uint8_t a);
 
@@ -55,15 +69,82 @@ public:
 
 	int get_width() const;
 	int get_height() const;
+	uint32_t get_channels() const;
+	// top-down files (negative height in the header) are read and written in their row order,
+	// row_data(0) is the bottom row either way
+	bool is_top_down() const;
+	// empty unless the image is indexed
+	const std::vector<BMPColorTableEntry> &get_color_table() const;
+
+	// Pixel data of row y (B, G, R[, A] bytes, or color table indices for indexed images,
+	// no padding), for bulk access to whole rows
+	uint8_t* row_data(int y);
+	const uint8_t* row_data(int y) const;
 
 private:
 	uint32_t row_stride{0};
 	BMPHeader file_header;
 	BMPInfoHeader bmp_info_header;
 	BMPColorHeader bmp_color_header;
+	std::vector<BMPColorTableEntry> color_table;
 	std::vector<uint8_t> data;
 
 	void write_headers(std::ofstream &of);
 	void write_headers_and_data(std::ofstream &of);
 	uint32_t make_stride_aligned(uint32_t align_stride);
+	void throw_if_indexed() const;
 };
+
+// Read-only view of BMP pixel rows that lives in someone else's memory.
+// Rows are B, G, R[, A] bytes, or for indexed images (channels is 1) indices into color_table,
+// which may be past its colors_used entries in a broken file; stride is the distance from a row
+// to the next one in bytes, padding included, negative for rows stored top-down.
+struct BMPPixelView {
+	const uint8_t *data{nullptr};        // first byte of row 0
+	int width{0};
+	int height{0};
+	uint32_t channels{0};
+	ptrdiff_t stride{0};
+	const BMPColorTableEntry *color_table{nullptr};  // indexed images only
+	uint32_t colors_used{0};
+
+	const uint8_t *row(int y) const { return data + y * stride; }
+};
+
+// BMP file mapped into memory. Headers are parsed in place and the pixel rows are
+// accessed straight from the mapping (padded stride included), nothing is copied.
+class MappedBMP {
+public:
+	explicit MappedBMP(const char *fname);
+	~MappedBMP();
+
+	MappedBMP(const MappedBMP &) = delete;
+	MappedBMP &operator=(const MappedBMP &) = delete;
+	MappedBMP(MappedBMP &&other) noexcept;
+	MappedBMP &operator=(MappedBMP &&other) noexcept;
+
+	int get_width() const;
+	int get_height() const;
+	uint32_t get_channels() const;
+	// distance from a row to the row above it, negative for top-down files
+	ptrdiff_t get_row_stride() const;
+	bool is_top_down() const;
+	// color table of an indexed (8 bits per pixel) image, nullptr and 0 for other images
+	const BMPColorTableEntry *get_color_table() const;
+	uint32_t get_colors_used() const;
+
+	const uint8_t *row_data(int y) const;
+	BMPPixelView pixels() const;
+
+	// throws for an index past the color table of an indexed image
+	void get_pixel(int x, int y, uint8_t &r, uint8_t &g, uint8_t &b) const;
+
+private:
+	const uint8_t *mapping{nullptr};
+	size_t mapping_size{0};
+	const BMPHeader *file_header{nullptr};
+	const BMPInfoHeader *bmp_info_header{nullptr};
+	BMPPixelView view;
+
+	void unmap();
+};
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "colors.h"
+
+// Row conversions between BMP pixel data (B, G, R or B, G, R, A bytes, channels = 3 or 4)
+// and ColorRGB pixels. The best implementation supported by the CPU (AVX2, SSSE3 or scalar)
+// is picked on the first call.
+
+void bgrToRgbRow(const uint8_t* src, ColorRGB* dst, size_t count, uint32_t channels);
+void rgbToBgrRow(const ColorRGB* src, uint8_t* dst, size_t count, uint32_t channels);
+
+// Plain per-pixel versions, used as the fallback and as a reference
+void bgrToRgbRowScalar(const uint8_t* src, ColorRGB* dst, size_t count, uint32_t channels);
+void rgbToBgrRowScalar(const ColorRGB* src, uint8_t* dst, size_t count, uint32_t channels);
+
+// Conversions to and from 4 byte pixels: alpha of rgbToRgbaRow is the given one, alpha of
+// bgrToRgbaRow comes from the file (255 for channels = 3), rgbaToBgraRow keeps it.
+void rgbToRgbaRow(const ColorRGB* src, ColorRGBA* dst, size_t count, uint8_t alpha = 255);
+void rgbaToRgbRow(const ColorRGBA* src, ColorRGB* dst, size_t count);
+void bgrToRgbaRow(const uint8_t* src, ColorRGBA* dst, size_t count, uint32_t channels);
+void rgbaToBgraRow(const ColorRGBA* src, uint8_t* dst, size_t count);
+
+void rgbToRgbaRowScalar(const ColorRGB* src, ColorRGBA* dst, size_t count, uint8_t alpha = 255);
+void rgbaToRgbRowScalar(const ColorRGBA* src, ColorRGB* dst, size_t count);
+void bgrToRgbaRowScalar(const uint8_t* src, ColorRGBA* dst, size_t count, uint32_t channels);
+void rgbaToBgraRowScalar(const ColorRGBA* src, uint8_t* dst, size_t count);
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "image_view.h"
+
+// Counters of a scratch arena, a steady state batch leaves heap_allocations unchanged
+struct ScratchArenaStats {
+    size_t heap_allocations = 0;  // blocks requested from the system
+    size_t acquisitions = 0;      // buffers handed out
+    size_t reserved_bytes = 0;    // bytes currently owned by the arena
+    size_t huge_page_bytes = 0;   // part of reserved_bytes advised to be backed by huge pages
+    size_t peak_used_bytes = 0;   // most bytes handed out at once
+};
+
+// Growable bump allocator for the temporaries of the transforms.
+//
+// Buffers are acquired inside a ScratchScope and all of them are given back together when
+// the scope ends. Once the arena has grown to the largest working set of a batch, the next
+// images of the same (or a smaller) size are processed without touching the heap.
+// Every thread has its own arena (threadScratchArena()), so there is no locking.
+class ScratchArena {
+  public:
+    // every buffer starts on a cache line
+    static constexpr size_t kAlignment = 64;
+
+    ScratchArena() = default;
+    ~ScratchArena();
+
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    // Blocks of 2 MiB and more allocated from now on are advised to be backed by
+    // transparent huge pages (fewer page faults and TLB misses on large images)
+    void setUseHugePages(bool use_huge_pages) { use_huge_pages_ = use_huge_pages; }
+    bool useHugePages() const { return use_huge_pages_; }
+
+    // Frees all the blocks, only allowed when no scope is open
+    void release();
+
+    const ScratchArenaStats& stats() const { return stats_; }
+
+  private:
+    friend class ScratchScope;
+
+    struct Block {
+        std::byte* data = nullptr;
+        size_t size = 0;
+        bool huge_pages = false;
+    };
+
+    // position of the first free byte, blocks after the current one are entirely free
+    struct Mark {
+        size_t block = 0;
+        size_t offset = 0;
+        size_t used = 0;
+    };
+
+    void* allocate(size_t bytes);
+    void enterScope() { ++open_scopes_; }
+    void leaveScope(const Mark& mark);
+
+    Block allocateBlock(size_t min_size);
+    void freeBlock(const Block& block);
+
+    std::vector<Block> blocks_;
+    Mark top_;
+    size_t open_scopes_ = 0;
+    bool use_huge_pages_ = false;
+    ScratchArenaStats stats_;
+};
+
+// Arena of the calling thread
+ScratchArena& threadScratchArena();
+
+// Buffers acquired through a scope are valid until the scope is destroyed.
+// Scopes nest: an inner scope gives back only the buffers acquired through it.
+class ScratchScope {
+  public:
+    explicit ScratchScope(ScratchArena& arena = threadScratchArena()) :
+        arena_(arena), mark_(arena.top_) {
+        arena_.enterScope();
+    }
+    ~ScratchScope() { arena_.leaveScope(mark_); }
+
+    ScratchScope(const ScratchScope&) = delete;
+    ScratchScope& operator=(const ScratchScope&) = delete;
+
+    // Uninitialized buffer of count objects (of a trivial type)
+    template <typename T>
+    std::span<T> acquire(size_t count) {
+        static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+        static_assert(alignof(T) <= ScratchArena::kAlignment);
+        return {static_cast<T*>(arena_.allocate(count * sizeof(T))), count};
+    }
+
+    // Uninitialized width x height image with rows stored one after another
+    template <typename Pixel>
+    ImageView<Pixel> acquireImage(uint32_t width, uint32_t height) {
+        std::span<Pixel> pixels = acquire<Pixel>(size_t(width) * height);
+        return {pixels.data(), width, height, static_cast<ptrdiff_t>(width * sizeof(Pixel))};
+    }
+
+  private:
+    ScratchArena& arena_;
+    ScratchArena::Mark mark_;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "images.h"
+
+// Transforms that read a BMP file and write the result into another one band by band,
+// so at most band_rows rows (plus the kernel halo) are in memory whatever the image height is.
+
+constexpr uint32_t kDefaultBandRows = 64;
+
+// transform has to be row-local: every output row may depend only on the same input row
+void transformBMPStream(
+    const std::string& input_filename, const std::string& output_filename,
+    const std::function<void(UncompressedImage&)>& transform,
+    uint32_t band_rows = kDefaultBandRows);
+
+void negativeBMPStream(
+    const std::string& input_filename, const std::string& output_filename,
+    uint32_t band_rows = kDefaultBandRows);
+void toGrayscaleBMPStream(
+    const std::string& input_filename, const std::string& output_filename,
+    uint32_t band_rows = kDefaultBandRows);
+
+// every band is read together with the rows of the kernel halo around it
+void applyKernelBMPStream(
+    const std::string& input_filename, const std::string& output_filename,
+    const std::vector<std::vector<int>>& kernel, int divisor = 1,
+    uint32_t band_rows = kDefaultBandRows);
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads running loops of independent tasks.
+//
+// A loop is handed over as a function pointer and a pointer to the callable, so starting one
+// does not allocate. The calling thread takes part in the loop, a pool of one thread has no
+// workers and runs everything inline.
+class ThreadPool {
+  public:
+    // threads == 0 uses std::thread::hardware_concurrency()
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t threadCount() const { return workers_.size() + 1; }
+
+    // Runs task(0), ..., task(count - 1) and returns when all of them are done.
+    // The first exception thrown by a task is rethrown here once the others are finished.
+    // A loop started from a task of the same pool runs serially on the calling thread.
+    template <typename Task>
+    void parallelFor(size_t count, Task&& task) {
+        using TaskType = std::remove_reference_t<Task>;
+        run(count, &task, [](void* context, size_t index) {
+            (*static_cast<TaskType*>(context))(index);
+        });
+    }
+
+  private:
+    using CallFunc = void (*)(void*, size_t);
+
+    void run(size_t count, void* context, CallFunc call);
+    void workerLoop();
+    // takes the tasks of the current loop until there are none left
+    void runTasks();
+
+    std::vector<std::thread> workers_;
+
+    // one loop at a time, loops started from other threads wait for it
+    std::mutex run_mutex_;
+
+    std::mutex mutex_;
+    std::condition_variable work_ready_;
+    std::condition_variable work_done_;
+    size_t generation_ = 0;
+    bool stopping_ = false;
+
+    // the current loop, guarded by mutex_
+    void* context_ = nullptr;
+    CallFunc call_ = nullptr;
+    size_t count_ = 0;
+    size_t next_index_ = 0;
+    size_t unfinished_ = 0;
+    size_t active_workers_ = 0;
+    std::exception_ptr error_;
+};
+
+// Pool used by the transforms, with std::thread::hardware_concurrency() threads by default
+ThreadPool& transformThreadPool();
+
+// Number of threads the transforms use from now on, 1 makes them single-threaded and 0 means
+// std::thread::hardware_concurrency(). Must not be called while a transform is running.
+void setTransformThreadCount(size_t threads);
+
+// Bands of fewer pixels are not worth a task of their own
+constexpr size_t kMinBandPixels = size_t(1) << 16;
+
+// Number of bands the rows of a width x height image are split into: up to 4 per thread of the
+// transform pool for the load balance, each of at least kMinBandPixels and min_band_rows rows.
+// 1 for small images.
+size_t rowBandCount(size_t width, size_t height, size_t min_band_rows = 1);
+
+// First row of the band index when the rows [0, height) are split into band_count bands
+inline size_t bandBegin(size_t height, size_t band_count, size_t index) {
+    return height * index / band_count;
+}
+
+// Runs band(begin, end) for band_count consecutive bands of the rows [0, height) on the
+// transform pool. The split only depends on the arguments, so the result of a transform whose
+// bands are independent is the same with any number of threads.
+template <typename BandFunc>
+void parallelForRows(size_t height, size_t band_count, BandFunc&& band) {
+    if (band_count <= 1) {
+        band(size_t(0), height);
+        return;
+    }
+    transformThreadPool().parallelFor(band_count, [&](size_t index) {
+        band(bandBegin(height, band_count, index), bandBegin(height, band_count, index + 1));
+    });
+}
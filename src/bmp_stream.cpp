@@ -0,0 +1,100 @@
+#include "bmp_stream.h"
+#include "pixel_convert.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace {
+
+// rows in BMP files are padded to 4 bytes
+uint32_t paddedRowSize(uint32_t width, uint32_t channels) { return (width * channels + 3) & ~3u; }
+
+}  // namespace
+
+BMPStreamReader::BMPStreamReader(const std::string& filename) :
+    file_(filename, std::ios_base::binary) {
+    if (!file_) {
+        throw std::runtime_error("Unable to open the input image file.");
+    }
+
+    BMPHeader file_header;
+    BMPInfoHeader bmp_info_header;
+    file_.read(reinterpret_cast<char*>(&file_header), sizeof(file_header));
+    file_.read(reinterpret_cast<char*>(&bmp_info_header), sizeof(bmp_info_header));
+    if (!file_ || file_header.file_type != 0x4D42) {
+        throw std::runtime_error("Error! Unrecognized file format.");
+    }
+    if (bmp_info_header.bit_count != 24 && bmp_info_header.bit_count != 32) {
+        throw std::runtime_error("The program can treat only 24 or 32 bits per pixel BMP files");
+    }
+    if (bmp_info_header.width <= 0 || bmp_info_header.height == INT32_MIN) {
+        throw std::runtime_error("The image width and height must be positive numbers.");
+    }
+
+    width_ = bmp_info_header.width;
+    height_ = std::abs(bmp_info_header.height);
+    channels_ = bmp_info_header.bit_count / 8;
+    top_down_ = bmp_info_header.height < 0;
+    pixels_offset_ = file_header.offset_data;
+    row_buffer_.resize(paddedRowSize(width_, channels_));
+    file_.seekg(pixels_offset_, std::ios_base::beg);
+}
+
+uint32_t BMPStreamReader::readRows(
+    ImageBuffer<ColorRGB>& band, uint32_t first_row, uint32_t count) {
+    count = std::min({count, rowsLeft(), band.height() - first_row});
+    for (uint32_t i = 0; i < count; ++i) {
+        if (top_down_) {
+            // the bottom row is the last one in a top-down file, the rows are read backwards
+            std::streamoff file_row = height_ - 1 - (next_row_ + i);
+            file_.seekg(pixels_offset_ + file_row * row_buffer_.size(), std::ios_base::beg);
+        }
+        file_.read(reinterpret_cast<char*>(row_buffer_.data()), row_buffer_.size());
+        if (!file_) {
+            throw std::runtime_error("Error! The BMP file is truncated.");
+        }
+        bgrToRgbRow(row_buffer_.data(), band[first_row + i].data(), width_, channels_);
+    }
+    next_row_ += count;
+    return count;
+}
+
+BMPStreamWriter::BMPStreamWriter(const std::string& filename, uint32_t width, uint32_t height) :
+    file_(filename, std::ios_base::binary), width_(width), height_(height) {
+    if (width == 0 || height == 0) {
+        throw std::runtime_error("The image width and height must be positive numbers.");
+    }
+    if (!file_) {
+        throw std::runtime_error("Unable to open the output image file.");
+    }
+
+    row_buffer_.resize(paddedRowSize(width_, 3));
+
+    BMPHeader file_header;
+    BMPInfoHeader bmp_info_header;
+    bmp_info_header.size = sizeof(BMPInfoHeader);
+    bmp_info_header.width = width;
+    bmp_info_header.height = height;
+    bmp_info_header.bit_count = 24;
+    file_header.offset_data = sizeof(BMPHeader) + sizeof(BMPInfoHeader);
+    file_header.file_size = file_header.offset_data + row_buffer_.size() * height;
+
+    file_.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+    file_.write(reinterpret_cast<const char*>(&bmp_info_header), sizeof(bmp_info_header));
+}
+
+void BMPStreamWriter::writeRows(
+    const ImageBuffer<ColorRGB>& band, uint32_t first_row, uint32_t count) {
+    if (count > rowsLeft()) {
+        throw std::runtime_error("More rows are written than the image has.");
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        rgbToBgrRow(band[first_row + i].data(), row_buffer_.data(), width_, 3);
+        file_.write(reinterpret_cast<const char*>(row_buffer_.data()), row_buffer_.size());
+    }
+    if (!file_) {
+        throw std::runtime_error("Unable to write the output image file.");
+    }
+    next_row_ += count;
+}
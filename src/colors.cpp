@@ -7,6 +7,8 @@ uint8_t colorToGrayscale(const ColorRGB& color) {
     return (color.r + color.g + color.b) / 3;
 }
 
+uint8_t colorToGrayscale(const ColorRGBA& color) { return (color.r + color.g + color.b) / 3; }
+
 ColorRGB readFromFileStream(std::fstream& stream) {
     /*
      * The color is stored as three bytes in the order R, G, B.
@@ -1,6 +1,12 @@
 #include "compressor_funcs.h"
+#include "bmp_stream.h"
 #include "error_handlers.h"
 #include "libbmp.h"
+#include "pixel_convert.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
 
 /*
 * Implement all the functions declared in the header file here.
@@ -9,6 +15,38 @@
 * These function will read, write, convert and compress images across different formats.
 */
 
+namespace {
+
+// Converts the pixel rows of a BMP to RGB: B, G, R[, A] rows go through bgrToRgbRow, the indices
+// of an indexed image through a copy of its color table padded to 256 entries, so an index past
+// the table gives black instead of reading after it
+class BMPRowDecoder {
+  public:
+    explicit BMPRowDecoder(const BMPPixelView& pixels) : pixels_(pixels) {
+        for (uint32_t i = 0; i < pixels.colors_used; ++i) {
+            const BMPColorTableEntry& entry = pixels.color_table[i];
+            lookup_[i] = {entry.red, entry.green, entry.blue};
+        }
+    }
+
+    void decodeRow(int y, ColorRGB* dst) const {
+        const uint8_t* src = pixels_.row(y);
+        if (pixels_.color_table == nullptr) {
+            bgrToRgbRow(src, dst, pixels_.width, pixels_.channels);
+            return;
+        }
+        for (int x = 0; x < pixels_.width; ++x) {
+            dst[x] = lookup_[src[x]];
+        }
+    }
+
+  private:
+    BMPPixelView pixels_;
+    ColorRGB lookup_[256] = {};
+};
+
+}  // namespace
+
 void saveAsBMP(const UncompressedImage& img, const std::string& filename) {
     /*
      * Create a BMP object with the same dimensions as the image.
@@ -18,10 +56,7 @@ void saveAsBMP(const UncompressedImage& img, const std::string& filename) {
 
     BMP bmp(img.width, img.height);
     for (int y = 0; y < img.height; y++) {
-        for (int x = 0; x < img.width; x++) {
-            ColorRGB color = img.image_data[y][x];
-            bmp.set_pixel(x, y, color.r, color.g, color.b);
-        }
+        rgbToBgrRow(img.image_data[y].data(), bmp.row_data(y), img.width, bmp.get_channels());
     }
     bmp.write(filename.c_str());
 }
@@ -33,17 +68,121 @@ UncompressedImage loadFromBMP(const std::string& filename) {
      * Set the pixel values of the UncompressedImage object to the pixel values of the BMP object.
      * Return the UncompressedImage object.
      */
-    BMP bmp(filename.c_str());
+    // the file is mapped, so its pixels are copied once, straight into the image
+    MappedBMP bmp(filename.c_str());
     UncompressedImage img;
     img.width = bmp.get_width();
     img.height = bmp.get_height();
-    img.image_data.resize(img.height, std::vector<ColorRGB>(img.width));
+    img.image_data.resize(img.width, img.height);
+    // the pixels of an indexed image are expanded through its color table
+    const BMPRowDecoder decoder(bmp.pixels());
     for (int y = 0; y < img.height; y++) {
-        for (int x = 0; x < img.width; x++) {
-            uint8_t r, g, b;
-            bmp.get_pixel(x, y, r, g, b);
-            img.image_data[y][x] = {r, g, b};
+        decoder.decodeRow(y, img.image_data[y].data());
+    }
+    return img;
+}
+
+void saveAsBMP(const UncompressedImageRGBA& img, const std::string& filename) {
+    BMP bmp(img.width, img.height, true);
+    for (uint32_t y = 0; y < img.height; ++y) {
+        rgbaToBgraRow(img.image_data[y].data(), bmp.row_data(y), img.width);
+    }
+    bmp.write(filename.c_str());
+}
+
+UncompressedImageRGBA loadFromBMPAsRGBA(const std::string& filename) {
+    MappedBMP bmp(filename.c_str());
+    UncompressedImageRGBA img;
+    img.width = bmp.get_width();
+    img.height = bmp.get_height();
+    img.image_data.resize(img.width, img.height);
+    if (bmp.get_color_table() != nullptr) {
+        ColorRGBA lookup[256] = {};
+        for (uint32_t i = 0; i < bmp.get_colors_used(); ++i) {
+            const BMPColorTableEntry& entry = bmp.get_color_table()[i];
+            lookup[i] = {entry.red, entry.green, entry.blue, 255};
         }
+        for (uint32_t y = 0; y < img.height; ++y) {
+            const uint8_t* src_row = bmp.row_data(y);
+            std::span<ColorRGBA> dst_row = img.image_data[y];
+            for (uint32_t x = 0; x < img.width; ++x) {
+                dst_row[x] = lookup[src_row[x]];
+            }
+        }
+        return img;
+    }
+    for (uint32_t y = 0; y < img.height; ++y) {
+        bgrToRgbaRow(bmp.row_data(y), img.image_data[y].data(), img.width, bmp.get_channels());
+    }
+    return img;
+}
+
+UncompressedImageRGBA toRGBA(const UncompressedImage& img, uint8_t alpha) {
+    UncompressedImageRGBA rgba_img;
+    rgba_img.width = img.width;
+    rgba_img.height = img.height;
+    rgba_img.is_grayscale = img.is_grayscale;
+    rgba_img.image_data.resize(img.width, img.height);
+    for (uint32_t y = 0; y < img.height; ++y) {
+        rgbToRgbaRow(img.image_data[y].data(), rgba_img.image_data[y].data(), img.width, alpha);
+    }
+    return rgba_img;
+}
+
+UncompressedImage toRGB(const UncompressedImageRGBA& img) {
+    UncompressedImage rgb_img;
+    rgb_img.width = img.width;
+    rgb_img.height = img.height;
+    rgb_img.is_grayscale = img.is_grayscale;
+    rgb_img.image_data.resize(img.width, img.height);
+    for (uint32_t y = 0; y < img.height; ++y) {
+        rgbaToRgbRow(img.image_data[y].data(), rgb_img.image_data[y].data(), img.width);
+    }
+    return rgb_img;
+}
+
+void saveAsIndexedBMP(const CompressedImage& img, const std::string& filename) {
+    // pallette ids are used as color table indices, so the rows are written as they are;
+    // ids missing from the pallette get black color table entries
+    std::vector<BMPColorTableEntry> color_table(
+        img.id_to_color.empty() ? 1 : img.id_to_color.rbegin()->first + 1);
+    for (const auto& [id, color] : img.id_to_color) {
+        color_table[id] = {color.b, color.g, color.r, 0};
+    }
+
+    BMP bmp(img.width, img.height, color_table);
+    for (uint32_t y = 0; y < img.height; ++y) {
+        std::ranges::copy(img.image_data[y], bmp.row_data(y));
+    }
+    bmp.write(filename.c_str());
+}
+
+CompressedImage loadFromIndexedBMP(const std::string& filename) {
+    // every color table entry becomes a pallette id, the rows are copied as they are
+    MappedBMP bmp(filename.c_str());
+    if (bmp.get_color_table() == nullptr) {
+        throw std::runtime_error("The BMP file " + filename + " is not an indexed image");
+    }
+
+    CompressedImage img;
+    img.width = bmp.get_width();
+    img.height = bmp.get_height();
+    for (uint32_t i = 0; i < bmp.get_colors_used(); ++i) {
+        const BMPColorTableEntry& entry = bmp.get_color_table()[i];
+        ColorRGB color = {entry.red, entry.green, entry.blue};
+        img.id_to_color[i] = color;
+        img.color_to_id.emplace(color, i);
+    }
+
+    img.image_data.resize(img.width, img.height);
+    uint8_t max_index = 0;
+    for (uint32_t y = 0; y < img.height; ++y) {
+        std::span<uint8_t> row = img.image_data[y];
+        std::copy_n(bmp.row_data(y), img.width, row.begin());
+        max_index = std::max(max_index, std::ranges::max(row));
+    }
+    if (max_index >= bmp.get_colors_used()) {
+        throw std::runtime_error("The BMP file " + filename + " has pixels out of its color table");
     }
     return img;
 }
@@ -69,14 +208,14 @@ UncompressedImage readUncompressedFile(const std::string& filename) {
         return {};
     }
 
-    img.image_data.resize(img.height, std::vector<ColorRGB>(img.width));
+    // the whole row is read at once, pixels are tightly packed both in the file and in memory
+    img.image_data.resize(img.width, img.height);
     for (int y = 0; y < img.height; ++y) {
-        for (int x = 0; x < img.width; ++x) {
-            file.read(reinterpret_cast<char*>(&img.image_data[y][x]), sizeof(ColorRGB));
-            if (file.fail()) {
-                file.close();
-                return {};
-            }
+        std::span<ColorRGB> row = img.image_data[y];
+        file.read(reinterpret_cast<char*>(row.data()), row.size_bytes());
+        if (file.fail()) {
+            file.close();
+            return {};
         }
     }
 
@@ -100,12 +239,10 @@ void writeUncompressedFile(const std::string& filename, const UncompressedImage&
     }
 
     for (int y = 0; y < image.height; ++y) {
-        for (int x = 0; x < image.width; ++x) {
-            const ColorRGB& color = image.image_data[y][x];
-            file.write(reinterpret_cast<const char*>(&color), sizeof(ColorRGB));
-            if (file.fail()) {
-                file.close();
-            }
+        std::span<const ColorRGB> row = image.image_data[y];
+        file.write(reinterpret_cast<const char*>(row.data()), row.size_bytes());
+        if (file.fail()) {
+            file.close();
         }
     }
     file.close();
@@ -116,9 +253,88 @@ uint8_t findClosestColorId(const ColorRGB& color, const std::map<uint8_t, ColorR
      * Find the closest color in the color table (pallette) to the given color.
      * Return the ID of the closest color.
      */
-    return 0;
+    uint8_t closest_id = 0;
+    int64_t closest_distance = INT64_MAX;
+    for (const auto& [id, table_color] : colorTable) {
+        int64_t distance = colorDistanceSq(color, table_color);
+        if (distance < closest_distance) {
+            closest_distance = distance;
+            closest_id = id;
+        }
+    }
+    return closest_id;
 }
 
+namespace {
+
+/*
+ * Assigns pallette ids to the pixels of a CompressedImage, row by row.
+ * A color which is not in the pallette yet is approximated with the closest pallette color
+ * if approximation is allowed, otherwise it is added to the pallette (if there is a free id).
+ * Approximated colors are remembered, so the pallette is scanned once per distinct color.
+ */
+class PalletteEncoder {
+public:
+    PalletteEncoder(
+        CompressedImage& img, const std::map<uint8_t, ColorRGB>& color_table, bool approximate,
+        bool allow_color_add) :
+        img_(img), approximate_(approximate), allow_color_add_(allow_color_add) {
+        img_.id_to_color = color_table;
+        img_.color_to_id.clear();
+        for (const auto& [id, color] : color_table) {
+            img_.color_to_id.emplace(color, id);
+        }
+    }
+
+    // returns false if some color of the row cannot be encoded
+    bool encodeRow(std::span<const ColorRGB> src_row, std::span<uint8_t> dst_row) {
+        for (size_t x = 0; x < src_row.size(); ++x) {
+            const ColorRGB& color = src_row[x];
+            if (auto it = img_.color_to_id.find(color); it != img_.color_to_id.end()) {
+                dst_row[x] = it->second;
+                continue;
+            }
+            if (auto it = approximated_.find(color); it != approximated_.end()) {
+                dst_row[x] = it->second;
+                continue;
+            }
+
+            while (next_free_id_ < 256 && img_.id_to_color.contains(next_free_id_)) {
+                ++next_free_id_;
+            }
+            bool can_add = allow_color_add_ && next_free_id_ < 256;
+            if ((approximate_ || !can_add) && !img_.id_to_color.empty()) {
+                if (!approximate_) {
+                    handleLogMessage(
+                        "The pallette is full, the color is approximated", Severity::WARNING);
+                }
+                uint8_t id = findClosestColorId(color, img_.id_to_color);
+                approximated_.emplace(color, id);
+                dst_row[x] = id;
+            } else if (can_add) {
+                uint8_t id = static_cast<uint8_t>(next_free_id_);
+                img_.id_to_color.emplace(id, color);
+                img_.color_to_id.emplace(color, id);
+                dst_row[x] = id;
+            } else {
+                handleLogMessage(
+                    "The image cannot be compressed with an empty pallette", Severity::ERROR);
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    CompressedImage& img_;
+    bool approximate_;
+    bool allow_color_add_;
+    std::unordered_map<ColorRGB, uint8_t, ColorHash> approximated_;
+    uint32_t next_free_id_ = 0;
+};
+
+}  // namespace
+
 CompressedImage toCompressed(
     const UncompressedImage& img, const std::map<uint8_t, ColorRGB>& color_table, bool approximate,
     bool allow_color_add) {
@@ -128,7 +344,68 @@ CompressedImage toCompressed(
      * Set the pixel values of the CompressedImage object to the pixel values of the image.
      * Return the CompressedImage object.
      */
-    return {};
+    CompressedImage comp_img;
+    comp_img.width = img.width;
+    comp_img.height = img.height;
+    comp_img.image_data.resize(img.width, img.height);
+
+    PalletteEncoder encoder(comp_img, color_table, approximate, allow_color_add);
+    for (uint32_t y = 0; y < img.height; ++y) {
+        if (!encoder.encodeRow(img.image_data[y], comp_img.image_data[y])) {
+            return {};
+        }
+    }
+    return comp_img;
+}
+
+CompressedImage toCompressed(
+    const BMPPixelView& pixels, const std::map<uint8_t, ColorRGB>& color_table, bool approximate,
+    bool allow_color_add) {
+    // the BMP rows are converted one at a time into a single row buffer
+    CompressedImage comp_img;
+    comp_img.width = pixels.width;
+    comp_img.height = pixels.height;
+    comp_img.image_data.resize(pixels.width, pixels.height);
+
+    PalletteEncoder encoder(comp_img, color_table, approximate, allow_color_add);
+    const BMPRowDecoder decoder(pixels);
+    std::vector<ColorRGB> row(pixels.width);
+    for (int y = 0; y < pixels.height; ++y) {
+        decoder.decodeRow(y, row.data());
+        if (!encoder.encodeRow(row, comp_img.image_data[y])) {
+            return {};
+        }
+    }
+    return comp_img;
+}
+
+bool matchUncompressedImages(
+    const UncompressedImage& img, const BMPPixelView& pixels, bool verbose) {
+    if (img.width != pixels.width || img.height != pixels.height) {
+        if (verbose) {
+            printf(
+                "Size mismatch expected (%u, %u) got (%d, %d)\n", img.width, img.height,
+                pixels.width, pixels.height);
+        }
+        return false;
+    }
+    const BMPRowDecoder decoder(pixels);
+    std::vector<ColorRGB> row(pixels.width);
+    for (int y = 0; y < pixels.height; ++y) {
+        decoder.decodeRow(y, row.data());
+        std::span<const ColorRGB> img_row = img.image_data[y];
+        auto [img_it, row_it] = std::mismatch(img_row.begin(), img_row.end(), row.begin());
+        if (img_it != img_row.end()) {
+            if (verbose) {
+                printf(
+                    "Mismatch at coordinates (%d, %zu) expected (%d, %d, %d) got (%d, %d, %d)\n",
+                    y, static_cast<size_t>(img_it - img_row.begin()), img_it->r, img_it->g,
+                    img_it->b, row_it->r, row_it->g, row_it->b);
+            }
+            return false;
+        }
+    }
+    return true;
 }
 
 UncompressedImage toUncompressed(const CompressedImage& img) {
@@ -138,7 +415,24 @@ UncompressedImage toUncompressed(const CompressedImage& img) {
      * Return the UncompressedImage object.
      */
 
-    return {};
+    // the pallette is flattened into a lookup table, so the conversion is a plain gather per row
+    ColorRGB lookup[256] = {};
+    for (const auto& [id, color] : img.id_to_color) {
+        lookup[id] = color;
+    }
+
+    UncompressedImage uncomp_img;
+    uncomp_img.width = img.width;
+    uncomp_img.height = img.height;
+    uncomp_img.image_data.resize(img.width, img.height);
+    for (uint32_t y = 0; y < img.height; ++y) {
+        std::span<const uint8_t> src_row = img.image_data[y];
+        std::span<ColorRGB> dst_row = uncomp_img.image_data[y];
+        for (uint32_t x = 0; x < img.width; ++x) {
+            dst_row[x] = lookup[src_row[x]];
+        }
+    }
+    return uncomp_img;
 }
 
 ColorRGB getColor(const CompressedImage& img, int x, int y) {
@@ -149,7 +443,7 @@ ColorRGB getColor(const CompressedImage& img, int x, int y) {
     // Note that [] operator cannot be used here as img (as well as its members) is const,
     // and [] operator is not a const member function of std::map
 
-    return {};
+    return img.id_to_color.at(img.image_data[y][x]);
 }
 
 CompressedImage readCompressedFile(const std::string& filename) {
@@ -158,12 +452,127 @@ CompressedImage readCompressedFile(const std::string& filename) {
      * Gracefully handle errors if the file format is invalid.
      * Return the CompressedImage object.
      */
-    return {};
+
+    /*
+     * The compressed file format is:
+     *   width, height (uint32_t each)
+     *   number of pallette entries (uint16_t)
+     *   pallette entries, each one is an id (uint8_t) followed by its color (R, G, B)
+     *   pallette ids of the pixels, row by row, one byte per pixel
+     */
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        handleLogMessage("Cannot open file " + filename, Severity::ERROR);
+        return {};
+    }
+
+    CompressedImage img;
+    uint16_t pallette_size = 0;
+    file.read(reinterpret_cast<char*>(&img.width), sizeof(img.width));
+    file.read(reinterpret_cast<char*>(&img.height), sizeof(img.height));
+    file.read(reinterpret_cast<char*>(&pallette_size), sizeof(pallette_size));
+    if (file.fail() || pallette_size > 256) {
+        handleLogMessage("Invalid compressed file header in " + filename, Severity::ERROR);
+        return {};
+    }
+
+    for (uint16_t i = 0; i < pallette_size; ++i) {
+        uint8_t id = 0;
+        ColorRGB color;
+        file.read(reinterpret_cast<char*>(&id), sizeof(id));
+        file.read(reinterpret_cast<char*>(&color), sizeof(color));
+        if (file.fail()) {
+            handleLogMessage("Invalid compressed file pallette in " + filename, Severity::ERROR);
+            return {};
+        }
+        img.id_to_color[id] = color;
+        img.color_to_id[color] = id;
+    }
+
+    img.image_data.resize(img.width, img.height);
+    for (uint32_t y = 0; y < img.height; ++y) {
+        std::span<uint8_t> row = img.image_data[y];
+        file.read(reinterpret_cast<char*>(row.data()), row.size_bytes());
+        if (file.fail()) {
+            handleLogMessage("Compressed file " + filename + " is truncated", Severity::ERROR);
+            return {};
+        }
+    }
+    return img;
 }
 
+namespace {
+
+void writeCompressedHeader(std::ofstream& file, const CompressedImage& image) {
+    uint16_t pallette_size = image.id_to_color.size();
+    file.write(reinterpret_cast<const char*>(&image.width), sizeof(image.width));
+    file.write(reinterpret_cast<const char*>(&image.height), sizeof(image.height));
+    file.write(reinterpret_cast<const char*>(&pallette_size), sizeof(pallette_size));
+    for (const auto& [id, color] : image.id_to_color) {
+        file.write(reinterpret_cast<const char*>(&id), sizeof(id));
+        file.write(reinterpret_cast<const char*>(&color), sizeof(color));
+    }
+}
+
+}  // namespace
+
 void writeCompressedFile(const std::string& filename, const CompressedImage& image) {
     /*
      * Write the file according to the compressed file format.
      * Gracefully handle errors if occured.
      */
-}
\ No newline at end of file
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        handleLogMessage("Cannot open file " + filename, Severity::ERROR);
+        return;
+    }
+
+    writeCompressedHeader(file, image);
+    for (uint32_t y = 0; y < image.height; ++y) {
+        std::span<const uint8_t> row = image.image_data[y];
+        file.write(reinterpret_cast<const char*>(row.data()), row.size_bytes());
+    }
+    if (file.fail()) {
+        handleLogMessage("Cannot write compressed file " + filename, Severity::ERROR);
+    }
+}
+
+void compressBMPStream(
+    const std::string& bmp_filename, const std::string& filename,
+    const std::map<uint8_t, ColorRGB>& color_table, uint32_t band_rows) {
+    /*
+     * The pallette is fixed, so the header of the compressed file is known before any pixel is
+     * read, and the BMP file is converted band by band: every color is approximated with the
+     * closest pallette color.
+     */
+    if (color_table.empty()) {
+        handleLogMessage("The image cannot be compressed with an empty pallette", Severity::ERROR);
+        return;
+    }
+
+    BMPStreamReader reader(bmp_filename);
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        handleLogMessage("Cannot open file " + filename, Severity::ERROR);
+        return;
+    }
+
+    CompressedImage header;
+    header.width = reader.width();
+    header.height = reader.height();
+    PalletteEncoder encoder(header, color_table, true, false);
+    writeCompressedHeader(file, header);
+
+    band_rows = std::min(std::max(band_rows, 1u), reader.height());
+    ImageBuffer<ColorRGB> band(reader.width(), band_rows);
+    std::vector<uint8_t> ids(reader.width());
+    while (uint32_t rows = reader.readRows(band, 0, band.height())) {
+        for (uint32_t y = 0; y < rows; ++y) {
+            encoder.encodeRow(band[y], ids);
+            file.write(reinterpret_cast<const char*>(ids.data()), ids.size());
+        }
+    }
+    if (file.fail()) {
+        handleLogMessage("Cannot write compressed file " + filename, Severity::ERROR);
+    }
+}
@@ -0,0 +1,37 @@
+#include "cpu_features.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_FEATURES_X86 1
+#endif
+
+namespace {
+
+struct CpuFeatures {
+    bool ssse3 = false;
+    bool sse41 = false;
+    bool avx2 = false;
+};
+
+CpuFeatures detectCpuFeatures() {
+    CpuFeatures features;
+#ifdef CPU_FEATURES_X86
+    __builtin_cpu_init();
+    features.ssse3 = __builtin_cpu_supports("ssse3");
+    features.sse41 = __builtin_cpu_supports("sse4.1");
+    features.avx2 = __builtin_cpu_supports("avx2");
+#endif
+    return features;
+}
+
+const CpuFeatures& cpuFeatures() {
+    static const CpuFeatures features = detectCpuFeatures();
+    return features;
+}
+
+}  // namespace
+
+bool cpuHasSsse3() { return cpuFeatures().ssse3; }
+
+bool cpuHasSse41() { return cpuFeatures().sse41; }
+
+bool cpuHasAvx2() { return cpuFeatures().avx2; }
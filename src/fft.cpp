@@ -0,0 +1,109 @@
+#include "fft.h"
+
+#include <bit>
+#include <cmath>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace {
+
+// even, odd = even + w * odd, even - w * odd, with the product written out by hand: the
+// multiplication of std::complex checks for infinities and NaNs and is much slower
+inline void butterfly(
+    std::complex<double>& even, std::complex<double>& odd, double w_re, double w_im) {
+    const double odd_re = odd.real() * w_re - odd.imag() * w_im;
+    const double odd_im = odd.real() * w_im + odd.imag() * w_re;
+    odd = {even.real() - odd_re, even.imag() - odd_im};
+    even = {even.real() + odd_re, even.imag() + odd_im};
+}
+
+}  // namespace
+
+FftPlan::FftPlan(size_t size) : size_(size) {
+    if (!std::has_single_bit(size)) {
+        throw std::invalid_argument("FFT size " + std::to_string(size) + " is not a power of 2");
+    }
+    // the twiddles of the stage of half size h are at [h - 1, 2 * h - 1)
+    twiddles_.resize(std::max<size_t>(size, 1) - 1);
+    for (size_t half = 1; half < size; half *= 2) {
+        for (size_t k = 0; k < half; ++k) {
+            const double angle = -std::numbers::pi * static_cast<double>(k) / half;
+            twiddles_[half - 1 + k] = {std::cos(angle), std::sin(angle)};
+        }
+    }
+    const int bits = std::countr_zero(size);
+    bit_reversed_.resize(size);
+    for (size_t i = 0; i < size; ++i) {
+        bit_reversed_[i] = bits == 0 ? 0 : (bit_reversed_[i >> 1] >> 1) | ((i & 1) << (bits - 1));
+    }
+}
+
+void FftPlan::transform(std::complex<double>* data, bool inverse) const {
+    for (size_t i = 0; i < size_; ++i) {
+        if (i < bit_reversed_[i]) {
+            std::swap(data[i], data[bit_reversed_[i]]);
+        }
+    }
+    // iterative Cooley-Tukey, the inverse uses the conjugate twiddles
+    const double sign = inverse ? -1.0 : 1.0;
+    for (size_t half = 1; half < size_; half *= 2) {
+        const std::complex<double>* twiddles = &twiddles_[half - 1];
+        for (size_t start = 0; start < size_; start += 2 * half) {
+            for (size_t k = 0; k < half; ++k) {
+                butterfly(
+                    data[start + k], data[start + k + half], twiddles[k].real(),
+                    sign * twiddles[k].imag());
+            }
+        }
+    }
+}
+
+void FftPlan::transformColumns(std::complex<double>* data, bool inverse) const {
+    /*
+     * The same butterflies with whole rows in place of the values: every column is transformed
+     * at once, and the inner loop runs along the rows, contiguous in memory.
+     */
+    for (size_t y = 0; y < size_; ++y) {
+        if (y < bit_reversed_[y]) {
+            std::complex<double>* row = data + y * size_;
+            std::swap_ranges(row, row + size_, data + bit_reversed_[y] * size_);
+        }
+    }
+    const double sign = inverse ? -1.0 : 1.0;
+    for (size_t half = 1; half < size_; half *= 2) {
+        const std::complex<double>* twiddles = &twiddles_[half - 1];
+        for (size_t start = 0; start < size_; start += 2 * half) {
+            for (size_t k = 0; k < half; ++k) {
+                const double w_re = twiddles[k].real();
+                const double w_im = sign * twiddles[k].imag();
+                std::complex<double>* even = data + (start + k) * size_;
+                std::complex<double>* odd = data + (start + k + half) * size_;
+                for (size_t x = 0; x < size_; ++x) {
+                    butterfly(even[x], odd[x], w_re, w_im);
+                }
+            }
+        }
+    }
+}
+
+void FftPlan::transpose(std::complex<double>* data) const {
+    for (size_t y = 0; y < size_; ++y) {
+        for (size_t x = y + 1; x < size_; ++x) {
+            std::swap(data[y * size_ + x], data[x * size_ + y]);
+        }
+    }
+}
+
+void FftPlan::forward2D(std::complex<double>* data) const {
+    transformColumns(data, false);
+    transpose(data);
+    transformColumns(data, false);
+}
+
+void FftPlan::inverse2D(std::complex<double>* data) const {
+    transformColumns(data, true);
+    transpose(data);
+    transformColumns(data, true);
+}
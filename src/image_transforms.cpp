@@ -1,48 +1,2667 @@
 #include "image_transforms.h"
+#include "cpu_features.h"
 #include "error_handlers.h"
+#include "fft.h"
+#include "fixed_kernel.h"
+#include "in_place_rows.h"
+#include "scratch_arena.h"
+#include "thread_pool.h"
 
-void fillGapPixels(UncompressedImage& img, std::vector<std::vector<bool>>& is_gap_pixel) {
-    // fill the gaps with nearest neighbour interpolation
-    // in particular, for each pixel that is a gap pixel, replace it with the average of its neighbours
-    // that are not gap pixels
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IMAGE_TRANSFORMS_X86 1
+#endif
+
+/*
+ * The transforms of ColorRGB and ColorRGBA images share their code (the templates below),
+ * only the color channels are processed and alpha is kept as it is.
+ * The hot loops of 4 byte pixels have vector versions: a whole pixel fits a 32 bit lane,
+ * and the rows of an ImageBuffer<ColorRGBA> start on 32 byte boundaries.
+ */
+
+namespace {
+
+template <typename Pixel>
+void copyPixels(ConstImageView<Pixel> src, ImageView<Pixel> dst) {
+    for (uint32_t y = 0; y < src.height(); ++y) {
+        std::ranges::copy(src[y], dst[y].begin());
+    }
+}
+
+/*
+ * Pixels of the canvas a source pixel was mapped to, one bit each. Every row starts on a 64 bit
+ * word, so bands of rows written by different threads never share a word.
+ */
+class CoverageMask {
+  public:
+    CoverageMask(std::span<uint64_t> words, long long width) :
+        words_(words.data()), row_words_((width + 63) / 64),
+        last_word_bits_(width % 64 == 0 ? ~uint64_t(0) : (uint64_t(1) << width % 64) - 1) {}
+
+    static size_t wordCount(long long width, long long height) {
+        return static_cast<size_t>((width + 63) / 64 * height);
+    }
+
+    long long rowWords() const { return row_words_; }
+    // the bits of the last word of a row that stand for pixels
+    uint64_t lastWordBits() const { return last_word_bits_; }
+    uint64_t* row(long long y) const { return words_ + y * row_words_; }
+
+    bool covered(long long x, long long y) const { return row(y)[x >> 6] >> (x & 63) & 1; }
+    void cover(long long x, long long y) const { row(y)[x >> 6] |= uint64_t(1) << (x & 63); }
+    // covers the pixels [x_begin, x_end) of the row y and clears the others
+    void setRow(long long y, long long x_begin, long long x_end) const {
+        uint64_t* words = row(y);
+        for (long long i = 0; i < row_words_; ++i) {
+            const long long low = std::clamp(x_begin - i * 64, 0LL, 64LL);
+            const long long high = std::clamp(x_end - i * 64, 0LL, 64LL);
+            const uint64_t below_high = high == 64 ? ~uint64_t(0) : (uint64_t(1) << high) - 1;
+            const uint64_t below_low = low == 64 ? ~uint64_t(0) : (uint64_t(1) << low) - 1;
+            words[i] = below_high & ~below_low;
+        }
+    }
+
+  private:
+    uint64_t* words_;
+    long long row_words_;
+    uint64_t last_word_bits_;
+};
+
+/*
+ * Every gap pixel of the rows [y_begin, y_end) (a pixel of the canvas no source pixel was mapped
+ * to) gets the average of its covered neighbours, truncated. Covered pixels are never written,
+ * so the image is read in place, and the gaps are looked for 64 pixels at a time: the ones with
+ * a covered pixel in the 3 x 3 block around them are the bits of the word of the row that are not
+ * set, but are set in the words of the three rows shifted by one pixel either way.
+ * The other gaps keep the fill color. The rows around the range have to be final.
+ */
+template <typename Pixel>
+RotationStats fillGapRows(
+    ImageView<Pixel> img, const CoverageMask& coverage, long long y_begin, long long y_end) {
+    const long long width = img.width();
+    const long long height = img.height();
+    const long long row_words = coverage.rowWords();
+    RotationStats stats;
+    for (long long y = y_begin; y < y_end; ++y) {
+        const long long y_above = std::max(y - 1, 0LL);
+        const long long y_below = std::min(y + 1, height - 1);
+        const uint64_t* above = coverage.row(y_above);
+        const uint64_t* middle = coverage.row(y);
+        const uint64_t* below = coverage.row(y_below);
+        std::span<Pixel> dst_row = img[y];
+        uint64_t previous = 0;
+        uint64_t current = row_words > 0 ? above[0] | middle[0] | below[0] : 0;
+        for (long long i = 0; i < row_words; ++i) {
+            const uint64_t next =
+                i + 1 < row_words ? above[i + 1] | middle[i + 1] | below[i + 1] : 0;
+            const uint64_t near = current | current << 1 | previous >> 63 | current >> 1
+                                  | next << 63;
+            const uint64_t pixel_bits = i + 1 < row_words ? ~uint64_t(0) : coverage.lastWordBits();
+            const uint64_t gaps = ~middle[i] & pixel_bits;
+            uint64_t filled = gaps & near;
+            stats.gap_pixels += std::popcount(gaps);
+            stats.filled_gap_pixels += std::popcount(filled);
+            for (; filled != 0; filled &= filled - 1) {
+                const long long x = i * 64 + std::countr_zero(filled);
+                int sum_r = 0, sum_g = 0, sum_b = 0, sum_a = 0, count = 0;
+                for (long long ny = y_above; ny <= y_below; ++ny) {
+                    std::span<const Pixel> src_row = img[ny];
+                    for (long long nx = std::max(x - 1, 0LL); nx <= std::min(x + 1, width - 1);
+                         ++nx) {
+                        if (!coverage.covered(nx, ny)) {
+                            continue;
+                        }
+                        sum_r += src_row[nx].r;
+                        sum_g += src_row[nx].g;
+                        sum_b += src_row[nx].b;
+                        if constexpr (std::is_same_v<Pixel, ColorRGBA>) {
+                            sum_a += src_row[nx].a;
+                        }
+                        ++count;
+                    }
+                }
+                dst_row[x].r = sum_r / count;
+                dst_row[x].g = sum_g / count;
+                dst_row[x].b = sum_b / count;
+                if constexpr (std::is_same_v<Pixel, ColorRGBA>) {
+                    dst_row[x].a = sum_a / count;
+                }
+            }
+            previous = current;
+            current = next;
+        }
+    }
+    return stats;
+}
+
+void addStats(RotationStats& total, const RotationStats& part) {
+    total.gap_pixels += part.gap_pixels;
+    total.filled_gap_pixels += part.filled_gap_pixels;
+}
+
+/*
+ * Rotations by multiples of 90 degrees move the pixels without resampling them. The mapping of
+ * rotateView is then exact: cos and sin are 0 and +-1 up to 1e-16, far from the rounding of
+ * lround, so the pixel (x, y) of a quarter turn is taken from the source column
+ * column_offset + column_step * y, at the row row_offset + row_step * x. Every row of the result
+ * reads a column of the source, which is a transpose with one of the two directions reversed.
+ */
+struct QuarterTurnMap {
+    long long row_offset = 0;
+    long long row_step = 1;
+    long long column_offset = 0;
+    long long column_step = 1;
+
+    long long sourceRow(long long x) const { return row_offset + row_step * x; }
+    long long sourceColumn(long long y) const { return column_offset + column_step * y; }
+};
+
+// Blocks of kRotateTile x kRotateTile pixels are transposed one at a time, the rows of the
+// source they read stay in the cache from one row of the block to the next
+constexpr long long kRotateTile = 128;
+
+// The values of t in [0, count) for which offset + step * t (step is 1 or -1) is in [0, size)
+std::pair<long long, long long> mappedRange(
+    long long offset, long long step, long long size, long long count) {
+    const long long begin = step > 0 ? -offset : offset - size + 1;
+    const long long end = step > 0 ? size - offset : offset + 1;
+    return {std::clamp(begin, 0LL, count), std::clamp(end, 0LL, count)};
+}
+
+template <typename Pixel>
+void quarterTurnBlock(
+    ConstImageView<Pixel> source, ImageView<Pixel> rotated, const QuarterTurnMap& map,
+    long long x_begin, long long x_end, long long y_begin, long long y_end) {
+    // the pixels of a column are a stride apart
+    const ptrdiff_t step = source.stride() * map.row_step;
+    for (long long y = y_begin; y < y_end; ++y) {
+        Pixel* dst_row = rotated[y].data();
+        const std::byte* src = reinterpret_cast<const std::byte*>(
+            &source[map.sourceRow(x_begin)][map.sourceColumn(y)]);
+        for (long long x = x_begin; x < x_end; ++x, src += step) {
+            dst_row[x] = *reinterpret_cast<const Pixel*>(src);
+        }
+    }
+}
+
+#ifdef IMAGE_TRANSFORMS_X86
+
+// Transposes the 8 x 8 matrix of 32 bit values whose rows are rows[0], ..., rows[7]
+__attribute__((target("avx2"))) inline void transpose8x8Epi32(__m256i* rows) {
+    __m256i pairs[8];
+    for (int i = 0; i < 8; i += 2) {
+        pairs[i] = _mm256_unpacklo_epi32(rows[i], rows[i + 1]);
+        pairs[i + 1] = _mm256_unpackhi_epi32(rows[i], rows[i + 1]);
+    }
+    __m256i quads[8];
+    for (int i = 0; i < 8; i += 4) {
+        quads[i] = _mm256_unpacklo_epi64(pairs[i], pairs[i + 2]);
+        quads[i + 1] = _mm256_unpackhi_epi64(pairs[i], pairs[i + 2]);
+        quads[i + 2] = _mm256_unpacklo_epi64(pairs[i + 1], pairs[i + 3]);
+        quads[i + 3] = _mm256_unpackhi_epi64(pairs[i + 1], pairs[i + 3]);
+    }
+    for (int i = 0; i < 4; ++i) {
+        rows[i] = _mm256_permute2x128_si256(quads[i], quads[i + 4], 0x20);
+        rows[i + 4] = _mm256_permute2x128_si256(quads[i], quads[i + 4], 0x31);
+    }
+}
+
+/*
+ * Blocks of 8 x 8 pixels: 8 source rows of 8 pixels are loaded, transposed in registers and
+ * stored as 8 rows of the result. When the columns are read backwards, the transposed rows
+ * are stored in the reverse order. The pixels left over are done one by one.
+ */
+__attribute__((target("avx2"))) void quarterTurnBlockRgbaAvx2(
+    ConstImageView<ColorRGBA> source, ImageView<ColorRGBA> rotated, const QuarterTurnMap& map,
+    long long x_begin, long long x_end, long long y_begin, long long y_end) {
+    const long long x_vector_end = x_begin + (x_end - x_begin) / 8 * 8;
+    const long long y_vector_end = y_begin + (y_end - y_begin) / 8 * 8;
+    for (long long y = y_begin; y < y_vector_end; y += 8) {
+        const long long first_column = std::min(map.sourceColumn(y), map.sourceColumn(y + 7));
+        for (long long x = x_begin; x < x_vector_end; x += 8) {
+            __m256i rows[8];
+            for (int i = 0; i < 8; ++i) {
+                const ColorRGBA* src = &source[map.sourceRow(x + i)][first_column];
+                rows[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+            }
+            transpose8x8Epi32(rows);
+            for (int j = 0; j < 8; ++j) {
+                const __m256i row = rows[map.column_step > 0 ? j : 7 - j];
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(&rotated[y + j][x]), row);
+            }
+        }
+        quarterTurnBlock(source, rotated, map, x_vector_end, x_end, y, y + 8);
+    }
+    quarterTurnBlock(source, rotated, map, x_begin, x_end, y_vector_end, y_end);
+}
+
+
+/*
+ * The same blocks of 3 byte pixels, widened to 4 bytes with a shuffle after the load and packed
+ * back before the store. The loads and stores are of exactly the 24 bytes of 8 pixels.
+ */
+__attribute__((target("avx2"))) void quarterTurnBlockRgbAvx2(
+    ConstImageView<ColorRGB> source, ImageView<ColorRGB> rotated, const QuarterTurnMap& map,
+    long long x_begin, long long x_end, long long y_begin, long long y_end) {
+    const __m256i widen = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8,
+        -1, 9, 10, 11, -1);
+    const __m256i pack = _mm256_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12,
+        13, 14, -1, -1, -1, -1);
+    const long long x_vector_end = x_begin + (x_end - x_begin) / 8 * 8;
+    const long long y_vector_end = y_begin + (y_end - y_begin) / 8 * 8;
+    for (long long y = y_begin; y < y_vector_end; y += 8) {
+        const long long first_column = std::min(map.sourceColumn(y), map.sourceColumn(y + 7));
+        for (long long x = x_begin; x < x_vector_end; x += 8) {
+            __m256i rows[8];
+            for (int i = 0; i < 8; ++i) {
+                const ColorRGB* src = &source[map.sourceRow(x + i)][first_column];
+                const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+                const __m128i high = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src) + 1);
+                // pixels 0 - 3 in the low half, 4 - 7 in the high one
+                const __m256i pixels = _mm256_set_m128i(_mm_alignr_epi8(high, low, 12), low);
+                rows[i] = _mm256_shuffle_epi8(pixels, widen);
+            }
+            transpose8x8Epi32(rows);
+            for (int j = 0; j < 8; ++j) {
+                const __m256i wide = rows[map.column_step > 0 ? j : 7 - j];
+                const __m256i row = _mm256_shuffle_epi8(wide, pack);
+                const __m128i low = _mm256_castsi256_si128(row);
+                const __m128i high = _mm256_extracti128_si256(row, 1);
+                __m128i* dst = reinterpret_cast<__m128i*>(&rotated[y + j][x]);
+                _mm_storeu_si128(dst, _mm_or_si128(low, _mm_slli_si128(high, 12)));
+                _mm_storel_epi64(dst + 1, _mm_srli_si128(high, 4));
+            }
+        }
+        quarterTurnBlock(source, rotated, map, x_vector_end, x_end, y, y + 8);
+    }
+    quarterTurnBlock(source, rotated, map, x_begin, x_end, y_vector_end, y_end);
+}
+
+#endif
+
+// The pixels of [x_begin, x_end) x [y_begin, y_end) of the map, tile by tile, the rows of tiles
+// are split between the threads
+template <typename Pixel>
+void quarterTurnPixels(
+    ConstImageView<Pixel> source, ImageView<Pixel> rotated, const QuarterTurnMap& map,
+    long long x_begin, long long x_end, long long y_begin, long long y_end) {
+    if (x_begin >= x_end || y_begin >= y_end) {
+        return;
+    }
+    const size_t tile_rows = (y_end - y_begin + kRotateTile - 1) / kRotateTile;
+    const size_t band_count = rowBandCount((x_end - x_begin) * kRotateTile, tile_rows);
+    parallelForRows(tile_rows, band_count, [&](size_t first_tile_row, size_t last_tile_row) {
+        const long long band_y_begin = y_begin + first_tile_row * kRotateTile;
+        const long long band_y_end =
+            std::min<long long>(y_begin + last_tile_row * kRotateTile, y_end);
+        for (long long y = band_y_begin; y < band_y_end; y += kRotateTile) {
+            const long long tile_y_end = std::min(y + kRotateTile, y_end);
+            for (long long x = x_begin; x < x_end; x += kRotateTile) {
+                const long long tile_x_end = std::min(x + kRotateTile, x_end);
+#ifdef IMAGE_TRANSFORMS_X86
+                static const bool use_avx2 = cpuHasAvx2();
+                if (use_avx2) {
+                    if constexpr (std::is_same_v<Pixel, ColorRGBA>) {
+                        quarterTurnBlockRgbaAvx2(
+                            source, rotated, map, x, tile_x_end, y, tile_y_end);
+                    } else {
+                        quarterTurnBlockRgbAvx2(
+                            source, rotated, map, x, tile_x_end, y, tile_y_end);
+                    }
+                    continue;
+                }
+#endif
+                quarterTurnBlock<Pixel>(source, rotated, map, x, tile_x_end, y, tile_y_end);
+            }
+        }
+    });
+}
+
+template <typename Pixel>
+void rotateRightAngleView(
+    ImageView<Pixel> rotated, int quarter_turns, Pixel fill_color, bool smart_gap_interpolation,
+    RotationStats* stats = nullptr) {
+    const long long width = rotated.width();
+    const long long height = rotated.height();
+    const long long center_x = width / 2;
+    const long long center_y = height / 2;
+    if (quarter_turns == 0 || rotated.empty()) {
+        return;
+    }
+
+    ScratchScope scratch;
+    ImageView<Pixel> source = scratch.acquireImage<Pixel>(rotated.width(), rotated.height());
+    copyPixels<Pixel>(rotated, source);
+
+    // the part of the canvas covered by the source, x in [x_begin, x_end) and y in [y_begin, y_end)
+    std::pair<long long, long long> x_range;
+    std::pair<long long, long long> y_range;
+    QuarterTurnMap map;
+    if (quarter_turns == 2) {
+        // the rows are reversed and read backwards
+        x_range = mappedRange(2 * center_x, -1, width, width);
+        y_range = mappedRange(2 * center_y, -1, height, height);
+    } else {
+        if (quarter_turns == 1) {
+            map = {center_y - center_x, 1, center_x + center_y, -1};
+        } else {
+            map = {center_x + center_y, -1, center_x - center_y, 1};
+        }
+        x_range = mappedRange(map.row_offset, map.row_step, height, width);
+        y_range = mappedRange(map.column_offset, map.column_step, width, height);
+    }
+    const auto [x_begin, x_end] = x_range;
+    const auto [y_begin, y_end] = y_range;
+
+    for (long long y = 0; y < height; ++y) {
+        std::span<Pixel> dst_row = rotated[y];
+        if (y < y_begin || y >= y_end) {
+            std::ranges::fill(dst_row, fill_color);
+            continue;
+        }
+        std::fill(dst_row.begin(), dst_row.begin() + x_begin, fill_color);
+        std::fill(dst_row.begin() + x_end, dst_row.end(), fill_color);
+        if (quarter_turns == 2) {
+            std::span<const Pixel> src_row = source[2 * center_y - y];
+            for (long long x = x_begin; x < x_end; ++x) {
+                dst_row[x] = src_row[2 * center_x - x];
+            }
+        }
+    }
+    if (quarter_turns != 2) {
+        quarterTurnPixels<Pixel>(source, rotated, map, x_begin, x_end, y_begin, y_end);
+    }
+
+    if (smart_gap_interpolation && (x_end - x_begin) * (y_end - y_begin) < width * height) {
+        // the source is mapped one to one onto the covered part, the gaps are the pixels around it
+        const CoverageMask coverage(
+            scratch.acquire<uint64_t>(CoverageMask::wordCount(width, height)), width);
+        for (long long y = 0; y < height; ++y) {
+            const bool inside = y >= y_begin && y < y_end;
+            coverage.setRow(y, inside ? x_begin : 0, inside ? x_end : 0);
+        }
+        const RotationStats gap_stats = fillGapRows(rotated, coverage, 0, height);
+        if (stats) {
+            *stats = gap_stats;
+        }
+    }
+}
+
+/*
+ * Rotation by three shears (Paeth): the rotation by r is X(a) Y(b) X(a) with a = -tan(r / 2) and
+ * b = sin(r), where X(a) shifts the row at the offset q from the center by a * q pixels and Y(b)
+ * the column at the offset p by b * p pixels. The multiple of 90 degrees nearest to the angle is
+ * turned first with the transpose of the right angles, so that |r| <= 45 degrees and no shear
+ * moves a pixel by more than half the size of the image.
+ *
+ * A shear shifts every row by a fraction of a pixel, all the pixels of a row are blended with
+ * the same two weights, and the column shear is a row shear of the transposed image. The layers
+ * between the passes reach past the canvas: they are cut to the pixels that both come from the
+ * image and are read by the next pass, everything outside of them is the fill color.
+ */
+
+// Box of offsets from the center of rotation, x in [x_begin, x_end) and y in [y_begin, y_end)
+struct OffsetBox {
+    long long x_begin = 0;
+    long long x_end = 0;
+    long long y_begin = 0;
+    long long y_end = 0;
+
+    long long width() const { return std::max(x_end - x_begin, 0LL); }
+    long long height() const { return std::max(y_end - y_begin, 0LL); }
+    bool empty() const { return width() == 0 || height() == 0; }
+
+    OffsetBox transposed() const { return {y_begin, y_end, x_begin, x_end}; }
+    OffsetBox intersection(const OffsetBox& other) const {
+        return {
+            std::max(x_begin, other.x_begin), std::min(x_end, other.x_end),
+            std::max(y_begin, other.y_begin), std::min(y_end, other.y_end)};
+    }
+};
+
+// Image of the pixels of box, the pixel (u, v) is the one at the offset (x_begin + u, y_begin + v)
+template <typename Pixel>
+struct ShearLayer {
+    ImageView<Pixel> pixels;
+    OffsetBox box;
+};
+
+template <typename Pixel>
+ShearLayer<Pixel> shearLayer(Pixel* data, const OffsetBox& box) {
+    const uint32_t width = box.width();
+    const uint32_t height = box.height();
+    return {{data, width, height, width * static_cast<ptrdiff_t>(sizeof(Pixel))}, box};
+}
+
+/*
+ * The row shear out(p, q) = in(p + shear * q, q) reads the input pixels p + whole and
+ * p + whole + 1 of the row, whole is floor(shear * q) or one more when the weight rounds up
+ */
+std::pair<long long, long long> shearShifts(const OffsetBox& box, double shear) {
+    const double first = shear * box.y_begin;
+    const double last = shear * (box.y_end - 1);
+    return {std::floor(std::min(first, last)), std::floor(std::max(first, last))};
+}
+
+// The input pixels the output pixels of box read
+OffsetBox shearSource(const OffsetBox& box, double shear) {
+    const auto [min_shift, max_shift] = shearShifts(box, shear);
+    return {box.x_begin + min_shift, box.x_end + max_shift + 2, box.y_begin, box.y_end};
+}
+
+// The output pixels that read any of the input pixels of box, the others are the fill color
+OffsetBox shearImage(const OffsetBox& box, double shear) {
+    const auto [min_shift, max_shift] = shearShifts(box, shear);
+    return {box.x_begin - max_shift - 2, box.x_end - min_shift + 1, box.y_begin, box.y_end};
+}
+
+// dst[i] = (src[i] * (256 - weight) + src[i + step] * weight) / 256 rounded, every byte is one
+// channel, so the same loop blends the pixels of any size
+inline void blendBytes(const uint8_t* src, size_t step, int weight, uint8_t* dst, size_t count) {
+    const int keep = 256 - weight;
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = static_cast<uint16_t>(src[i] * keep + src[i + step] * weight + 128) >> 8;
+    }
+}
+
+#ifdef IMAGE_TRANSFORMS_X86
+/*
+ * 16 bytes at a time in 16 bit lanes: the weighted sum with the rounding is at most
+ * 255 * 256 + 128, so it fits a lane without the sign and the logical shift gives the byte
+ */
+__attribute__((target("avx2"))) void blendBytesAvx2(
+    const uint8_t* src, size_t step, int weight, uint8_t* dst, size_t count) {
+    const __m256i keep = _mm256_set1_epi16(static_cast<int16_t>(256 - weight));
+    const __m256i take = _mm256_set1_epi16(static_cast<int16_t>(weight));
+    const __m256i half = _mm256_set1_epi16(128);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256i current =
+            _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+        const __m256i next = _mm256_cvtepu8_epi16(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + step)));
+        __m256i sum = _mm256_add_epi16(
+            _mm256_mullo_epi16(current, keep), _mm256_mullo_epi16(next, take));
+        sum = _mm256_srli_epi16(_mm256_add_epi16(sum, half), 8);
+        const __m128i bytes =
+            _mm_packus_epi16(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), bytes);
+    }
+    blendBytes(src + i, step, weight, dst + i, count - i);
+}
+#endif
+
+void blendRowBytes(const uint8_t* src, size_t step, int weight, uint8_t* dst, size_t count) {
+#ifdef IMAGE_TRANSFORMS_X86
+    static const bool use_avx2 = cpuHasAvx2();
+    if (use_avx2) {
+        blendBytesAvx2(src, step, weight, dst, count);
+        return;
+    }
+#endif
+    blendBytes(src, step, weight, dst, count);
+}
+
+template <typename Pixel>
+void shearRows(
+    const ShearLayer<Pixel>& in, const ShearLayer<Pixel>& out, double shear, Pixel fill_color) {
+    const long long in_width = in.pixels.width();
+    const long long out_width = out.pixels.width();
+    const size_t height = out.pixels.height();
+    parallelForRows(height, rowBandCount(out_width, height), [&](size_t y_begin, size_t y_end) {
+        ScratchScope scratch;
+        // the input pixels of a row from the first one it reads, the fill color around them
+        std::span<Pixel> padded = scratch.acquire<Pixel>(out_width + 1);
+        for (size_t v = y_begin; v < y_end; ++v) {
+            std::span<Pixel> dst_row = out.pixels[v];
+            const long long q = out.box.y_begin + static_cast<long long>(v);
+            const double shift = shear * q;
+            long long whole = std::floor(shift);
+            int weight = std::lround((shift - whole) * 256);
+            if (weight == 256) {
+                ++whole;
+                weight = 0;
+            }
+            const long long first = out.box.x_begin + whole - in.box.x_begin;
+            const long long copy_begin = std::clamp(first, 0LL, in_width);
+            const long long copy_end = std::clamp(first + out_width + 1, 0LL, in_width);
+            if (q < in.box.y_begin || q >= in.box.y_end || copy_begin >= copy_end) {
+                std::ranges::fill(dst_row, fill_color);
+                continue;
+            }
+            std::span<const Pixel> src_row = in.pixels[q - in.box.y_begin];
+            std::fill(padded.begin(), padded.begin() + (copy_begin - first), fill_color);
+            std::copy(
+                src_row.begin() + copy_begin, src_row.begin() + copy_end,
+                padded.begin() + (copy_begin - first));
+            std::fill(padded.begin() + (copy_end - first), padded.end(), fill_color);
+            blendRowBytes(
+                reinterpret_cast<const uint8_t*>(padded.data()), sizeof(Pixel), weight,
+                reinterpret_cast<uint8_t*>(dst_row.data()), out_width * sizeof(Pixel));
+        }
+    });
+}
+
+template <typename Pixel>
+void transposeLayer(const ShearLayer<Pixel>& in, const ShearLayer<Pixel>& out) {
+    quarterTurnPixels<Pixel>(
+        in.pixels, out.pixels, QuarterTurnMap{}, 0, out.pixels.width(), 0, out.pixels.height());
+}
+
+template <typename Pixel>
+void rotateShearView(ImageView<Pixel> rotated, double angle, Pixel fill_color) {
+    const long long width = rotated.width();
+    const long long height = rotated.height();
+    const long long center_x = width / 2;
+    const long long center_y = height / 2;
+    const long long nearest_turns = std::llround(angle / 90);
+    const int quarter_turns = static_cast<int>((nearest_turns % 4 + 4) % 4);
+    const double residual = (angle - 90.0 * nearest_turns) * M_PI / 180.0;
+    if (residual == 0 || rotated.empty()) {
+        rotateRightAngleView(rotated, quarter_turns, fill_color, false);
+        return;
+    }
+    const double shear_x = -std::tan(residual / 2);
+    const double shear_y = std::sin(residual);
+
+    /*
+     * The image turned by the quarter turns. The boxes of the layers of the three passes are
+     * known before any of them runs, so two buffers are enough: one for the first layer and
+     * the transpose of the second one, and one for the turned image and the other two.
+     */
+    const OffsetBox canvas = {-center_x, width - center_x, -center_y, height - center_y};
+    OffsetBox turned_box = canvas;
+    if (quarter_turns == 1) {
+        turned_box = {-center_y, height - center_y, center_x - width + 1, center_x + 1};
+    } else if (quarter_turns == 2) {
+        turned_box = {center_x - width + 1, center_x + 1, center_y - height + 1, center_y + 1};
+    } else if (quarter_turns == 3) {
+        turned_box = {center_y - height + 1, center_y + 1, -center_x, width - center_x};
+    }
+    const OffsetBox first_image = shearImage(turned_box, shear_x);
+    const OffsetBox second_image = shearImage(first_image.transposed(), shear_y).transposed();
+    const OffsetBox second_box = shearSource(canvas, shear_x).intersection(second_image);
+    const OffsetBox first_box =
+        shearSource(second_box.transposed(), shear_y).transposed().intersection(first_image);
+    if (first_box.empty() || second_box.empty()) {
+        for (uint32_t y = 0; y < rotated.height(); ++y) {
+            std::ranges::fill(rotated[y], fill_color);
+        }
+        return;
+    }
+
+    ScratchScope scratch;
+    const long long layer_pixels = std::max(
+        first_box.width() * first_box.height(), second_box.width() * second_box.height());
+    Pixel* first_buffer = scratch.acquire<Pixel>(layer_pixels).data();
+    Pixel* second_buffer = scratch.acquire<Pixel>(std::max(layer_pixels, width * height)).data();
+
+    ShearLayer<Pixel> turned = {rotated, turned_box};
+    if (quarter_turns != 0) {
+        turned = shearLayer(second_buffer, turned_box);
+        if (quarter_turns == 2) {
+            for (long long y = 0; y < height; ++y) {
+                std::span<const Pixel> src_row = rotated[height - 1 - y];
+                std::reverse_copy(src_row.begin(), src_row.end(), turned.pixels[y].begin());
+            }
+        } else {
+            const QuarterTurnMap map = quarter_turns == 1 ? QuarterTurnMap{0, 1, width - 1, -1}
+                                                          : QuarterTurnMap{height - 1, -1, 0, 1};
+            quarterTurnPixels<Pixel>(rotated, turned.pixels, map, 0, height, 0, width);
+        }
+    }
+
+    const ShearLayer<Pixel> first = shearLayer(first_buffer, first_box);
+    shearRows(turned, first, shear_x, fill_color);
+    const ShearLayer<Pixel> first_transposed = shearLayer(second_buffer, first_box.transposed());
+    transposeLayer(first, first_transposed);
+    const ShearLayer<Pixel> second_transposed = shearLayer(first_buffer, second_box.transposed());
+    shearRows(first_transposed, second_transposed, shear_y, fill_color);
+    const ShearLayer<Pixel> second = shearLayer(second_buffer, second_box);
+    transposeLayer(second_transposed, second);
+    shearRows(second, {rotated, canvas}, shear_x, fill_color);
+}
+
+/*
+ * The mapping of the rotation: the pixel (x, y) goes to
+ *     (center_x + lround(xx * dx + xy * dy), center_y + lround(yx * dx + yy * dy))
+ * with dx = x - center_x and dy = y - center_y, in doubles, the way the golden images were made.
+ */
+struct RotationMap {
+    double xx = 1;
+    double xy = 0;
+    double yx = 0;
+    double yy = 1;
+    long long center_x = 0;
+    long long center_y = 0;
+    long long width = 0;
+    long long height = 0;
+    // the rows of the canvas the pixels are kept in, all of them unless the work is split by rows
+    long long row_begin = 0;
+    long long row_end = 0;
+
+    bool mapsInside(long long x, long long y) const {
+        const long long dx = x - center_x;
+        const long long dy = y - center_y;
+        const long long mapped_x = center_x + std::lround(xx * dx + xy * dy);
+        const long long mapped_y = center_y + std::lround(yx * dx + yy * dy);
+        return mapped_x >= 0 && mapped_x < width && mapped_y >= row_begin && mapped_y < row_end;
+    }
+};
+
+// Fractional bits of the coordinates stepped along a row
+constexpr int kRotationFractionBits = 40;
+
+/*
+ * The values of x for which center + lround(step * (x - center_x) + offset) is in [lower, upper):
+ * the real solution of the inequalities, 2 pixels wider, so that it contains all of them
+ */
+std::pair<long long, long long> rotationSpanEstimate(
+    double step, double offset, long long center_x, long long center, long long lower,
+    long long upper, long long width) {
+    if (std::abs(step) < 1e-9) {
+        return {0, width};
+    }
+    const double first = (lower - center - 0.5 - offset) / step;
+    const double last = (upper - center - 0.5 - offset) / step;
+    const double begin = std::floor(std::min(first, last)) + center_x - 2;
+    const double end = std::ceil(std::max(first, last)) + center_x + 3;
+    return {
+        static_cast<long long>(std::clamp(begin, 0.0, double(width))),
+        static_cast<long long>(std::clamp(end, 0.0, double(width)))};
+}
+
+/*
+ * The pixels [begin, end) of the row y that the map keeps inside of the canvas (an interval, both
+ * coordinates are monotonic along the row), and mapped_x[x], mapped_y[x] for them.
+ *
+ * The span is solved for and its ends are checked with the exact mapping, the coordinates are
+ * stepped in fixed point: two adds per pixel instead of two multiplies, two conversions and two
+ * calls to lround. The stepped value is within margin of the one of the doubles (the doubles are
+ * off by less than 2^-28 for coordinates below 2^22, and every step adds at most half a unit),
+ * so it rounds the same unless it is within margin of a half; then the row is mapped again with
+ * the doubles, which is rare enough (about once every 2^26 pixels) not to matter.
+ */
+std::pair<long long, long long> mapRotatedRow(
+    const RotationMap& map, long long y, int32_t* mapped_x, int32_t* mapped_y) {
+    const long long dy = y - map.center_y;
+    const auto [x_begin, x_end] = rotationSpanEstimate(
+        map.xx, map.xy * dy, map.center_x, map.center_x, 0, map.width, map.width);
+    const auto [y_begin, y_end] = rotationSpanEstimate(
+        map.yx, map.yy * dy, map.center_x, map.center_y, map.row_begin, map.row_end, map.width);
+    long long begin = std::max(x_begin, y_begin);
+    long long end = std::min(x_end, y_end);
+    while (begin < end && !map.mapsInside(begin, y)) {
+        ++begin;
+    }
+    while (end > begin && !map.mapsInside(end - 1, y)) {
+        --end;
+    }
+    if (begin == end) {
+        return {0, 0};
+    }
+
+    constexpr int bits = kRotationFractionBits;
+    const double scale = std::ldexp(1.0, bits);
+    const long long dx = begin - map.center_x;
+    const bool steppable = std::max(map.width, map.height) < (1LL << 22);
+    if (steppable) {
+        // half a pixel added, so that the shift rounds
+        const long long half = 1LL << (bits - 1);
+        long long u = std::llround((map.xx * dx + map.xy * dy) * scale)
+                      + (map.center_x << bits) + half;
+        long long v = std::llround((map.yx * dx + map.yy * dy) * scale)
+                      + (map.center_y << bits) + half;
+        const long long step_u = std::llround(map.xx * scale);
+        const long long step_v = std::llround(map.yx * scale);
+        const long long margin = (1LL << (bits - 27)) + (end - begin) + 2;
+        long long ambiguous = 0;
+        for (long long x = begin; x < end; ++x) {
+            mapped_x[x] = static_cast<int32_t>(u >> bits);
+            mapped_y[x] = static_cast<int32_t>(v >> bits);
+            ambiguous |= ((u + margin) >> bits) ^ ((u - margin) >> bits);
+            ambiguous |= ((v + margin) >> bits) ^ ((v - margin) >> bits);
+            u += step_u;
+            v += step_v;
+        }
+        if (ambiguous == 0) {
+            return {begin, end};
+        }
+    }
+    for (long long x = begin; x < end; ++x) {
+        const long long offset = x - map.center_x;
+        mapped_x[x] = static_cast<int32_t>(
+            map.center_x + std::lround(map.xx * offset + map.xy * dy));
+        mapped_y[x] = static_cast<int32_t>(
+            map.center_y + std::lround(map.yx * offset + map.yy * dy));
+    }
+    return {begin, end};
+}
+
+#ifdef IMAGE_TRANSFORMS_X86
+
+/*
+ * The nearest neighbour fetch of 8 pixels at a time: the offsets of the source pixels are
+ * computed in 32 bit lanes and the pixels are gathered. The 3 byte pixels are gathered as
+ * 4 bytes (the source has a byte to spare after its last pixel) and packed before the store.
+ * Returns the first pixel left to the caller.
+ */
+__attribute__((target("avx2"))) long long gatherRowRgbaAvx2(
+    const ColorRGBA* source, long long source_width, const int32_t* mapped_x,
+    const int32_t* mapped_y, long long begin, long long end, ColorRGBA* dst_row) {
+    const __m256i row_pixels = _mm256_set1_epi32(static_cast<int>(source_width));
+    const int* pixels = reinterpret_cast<const int*>(source);
+    long long x = begin;
+    for (; x + 8 <= end; x += 8) {
+        const __m256i column = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mapped_x + x));
+        const __m256i row = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mapped_y + x));
+        const __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(row, row_pixels), column);
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i*>(dst_row + x), _mm256_i32gather_epi32(pixels, index, 4));
+    }
+    return x;
+}
+
+__attribute__((target("avx2"))) long long gatherRowRgbAvx2(
+    const ColorRGB* source, long long source_width, const int32_t* mapped_x,
+    const int32_t* mapped_y, long long begin, long long end, ColorRGB* dst_row) {
+    const __m256i row_bytes = _mm256_set1_epi32(static_cast<int>(source_width * 3));
+    const __m256i pack = _mm256_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12,
+        13, 14, -1, -1, -1, -1);
+    const int* bytes = reinterpret_cast<const int*>(source);
+    long long x = begin;
+    for (; x + 8 <= end; x += 8) {
+        const __m256i column = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mapped_x + x));
+        const __m256i row = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mapped_y + x));
+        const __m256i offset = _mm256_add_epi32(
+            _mm256_mullo_epi32(row, row_bytes),
+            _mm256_add_epi32(column, _mm256_add_epi32(column, column)));
+        const __m256i pixels =
+            _mm256_shuffle_epi8(_mm256_i32gather_epi32(bytes, offset, 1), pack);
+        const __m128i low = _mm256_castsi256_si128(pixels);
+        const __m128i high = _mm256_extracti128_si256(pixels, 1);
+        __m128i* dst = reinterpret_cast<__m128i*>(dst_row + x);
+        _mm_storeu_si128(dst, _mm_or_si128(low, _mm_slli_si128(high, 12)));
+        _mm_storel_epi64(dst + 1, _mm_srli_si128(high, 4));
+    }
+    return x;
+}
+
+#endif
+
+// dst_row[x] = source[mapped_y[x]][mapped_x[x]] for x in [begin, end), source is contiguous
+// and has a pixel to spare after its last one
+template <typename Pixel>
+void gatherRow(
+    ConstImageView<Pixel> source, const int32_t* mapped_x, const int32_t* mapped_y,
+    long long begin, long long end, Pixel* dst_row) {
+    long long x = begin;
+#ifdef IMAGE_TRANSFORMS_X86
+    static const bool use_avx2 = cpuHasAvx2();
+    // the offsets of the pixels fit the 32 bit lanes
+    const bool fits_lanes =
+        (size_t(source.width()) * source.height() + 1) * sizeof(Pixel) < (size_t(1) << 31);
+    if (use_avx2 && fits_lanes) {
+        if constexpr (std::is_same_v<Pixel, ColorRGBA>) {
+            x = gatherRowRgbaAvx2(
+                source.data(), source.width(), mapped_x, mapped_y, begin, end, dst_row);
+        } else {
+            x = gatherRowRgbAvx2(
+                source.data(), source.width(), mapped_x, mapped_y, begin, end, dst_row);
+        }
+    }
+#endif
+    for (; x < end; ++x) {
+        dst_row[x] = source[mapped_y[x]][mapped_x[x]];
+    }
+}
+
+template <typename Pixel>
+void rotateView(
+    ImageView<Pixel> rotated, int angle, Pixel fill_color, bool smart_gap_interpolation,
+    RotationStats* stats) {
+    if (stats) {
+        *stats = {};
+    }
+    if (angle % 90 == 0) {
+        const int quarter_turns = (angle / 90 % 4 + 4) % 4;
+        rotateRightAngleView(rotated, quarter_turns, fill_color, smart_gap_interpolation, stats);
+        return;
+    }
+    // rotation is done around the (integer) center of the image, the canvas size is preserved,
+    // so the result is written over the image and the source is kept in a scratch copy
+    const long long width = rotated.width();
+    const long long height = rotated.height();
+    const double theta = angle * M_PI / 180.0;
+    const double cos_theta = std::cos(theta);
+    const double sin_theta = std::sin(theta);
+    RotationMap map = {cos_theta, -sin_theta, sin_theta, cos_theta, width / 2, height / 2};
+    map.width = width;
+    map.height = height;
+    map.row_end = height;
+
+    ScratchScope scratch;
+    std::span<Pixel> source_pixels = scratch.acquire<Pixel>(width * height + 1);
+    const ImageView<Pixel> source = {
+        source_pixels.data(), rotated.width(), rotated.height(),
+        width * static_cast<ptrdiff_t>(sizeof(Pixel))};
+    copyPixels<Pixel>(rotated, source);
+    source_pixels.back() = fill_color;
+    const size_t band_count = rowBandCount(width, height);
+
+    if (!smart_gap_interpolation) {
+        // every destination pixel takes the source pixel it is mapped from (inverse mapping),
+        // the rows are independent
+        parallelForRows(height, band_count, [&](size_t y_begin, size_t y_end) {
+            ScratchScope band_scratch;
+            std::span<int32_t> mapped_x = band_scratch.acquire<int32_t>(width);
+            std::span<int32_t> mapped_y = band_scratch.acquire<int32_t>(width);
+            for (size_t y = y_begin; y < y_end; ++y) {
+                std::span<Pixel> dst_row = rotated[y];
+                const auto [begin, end] = mapRotatedRow(map, y, mapped_x.data(), mapped_y.data());
+                std::fill(dst_row.begin(), dst_row.begin() + begin, fill_color);
+                gatherRow<Pixel>(
+                    source, mapped_x.data(), mapped_y.data(), begin, end, dst_row.data());
+                std::fill(dst_row.begin() + end, dst_row.end(), fill_color);
+            }
+        });
+        return;
+    }
+
+    /*
+     * Every source pixel is put where it is mapped to (forward mapping), destination pixels
+     * no source pixel was mapped to are gaps and get interpolated from their neighbours.
+     * Two source pixels may land on the same destination pixel and the last one wins, so every
+     * band goes through all the source rows in order and keeps the pixels that land in its
+     * rows of the destination, the result does not depend on the split.
+     *
+     * The rows of a band are final once it has gone through the source, so it fills its gaps
+     * right away, while the rows are still in the cache. Only the first and the last row of a
+     * band have neighbours in other bands, those are filled when all the bands are done.
+     */
+    map.xy = sin_theta;
+    map.yx = -sin_theta;
+    const CoverageMask coverage(
+        scratch.acquire<uint64_t>(CoverageMask::wordCount(width, height)), width);
+    std::atomic<size_t> gap_pixels = 0;
+    std::atomic<size_t> filled_gap_pixels = 0;
+    parallelForRows(height, band_count, [&](size_t y_begin, size_t y_end) {
+        ScratchScope band_scratch;
+        std::span<int32_t> mapped_x = band_scratch.acquire<int32_t>(width);
+        std::span<int32_t> mapped_y = band_scratch.acquire<int32_t>(width);
+        RotationMap band_map = map;
+        band_map.row_begin = y_begin;
+        band_map.row_end = y_end;
+        for (size_t y = y_begin; y < y_end; ++y) {
+            std::ranges::fill(rotated[y], fill_color);
+            coverage.setRow(y, 0, 0);
+        }
+        // local copies, the stores of the bits could alias the captured variables
+        const ImageView<Pixel> dst = rotated;
+        uint64_t* const covered_bits = coverage.row(0);
+        const long long covered_stride = coverage.rowWords();
+        for (long long y = 0; y < height; ++y) {
+            const Pixel* src_row = source[y].data();
+            const auto [begin, end] = mapRotatedRow(band_map, y, mapped_x.data(), mapped_y.data());
+            for (long long x = begin; x < end; ++x) {
+                dst[mapped_y[x]][mapped_x[x]] = src_row[x];
+                covered_bits[mapped_y[x] * covered_stride + (mapped_x[x] >> 6)] |=
+                    uint64_t(1) << (mapped_x[x] & 63);
+            }
+        }
+        const size_t fill_begin = y_begin == 0 ? 0 : y_begin + 1;
+        const size_t fill_end = y_end == static_cast<size_t>(height) ? y_end : y_end - 1;
+        if (fill_begin < fill_end) {
+            const RotationStats filled = fillGapRows(rotated, coverage, fill_begin, fill_end);
+            gap_pixels += filled.gap_pixels;
+            filled_gap_pixels += filled.filled_gap_pixels;
+        }
+    });
+    RotationStats gap_stats = {gap_pixels, filled_gap_pixels};
+    for (size_t band = 1; band < band_count; ++band) {
+        // the last row of the band above and the first row of this one
+        const long long y = bandBegin(height, band_count, band);
+        const long long above_begin = bandBegin(height, band_count, band - 1);
+        const long long rows_begin = y - 1 > above_begin || band == 1 ? y - 1 : y;
+        addStats(gap_stats, fillGapRows(rotated, coverage, rows_begin, y + 1));
+    }
+    if (stats) {
+        *stats = gap_stats;
+    }
+}
+
+#ifdef IMAGE_TRANSFORMS_X86
+
+/*
+ * One output pixel per 128 bit vector, its channels in 32 bit lanes: every tap is a pixel
+ * load, a widening and a multiply-add, with no shuffling of the channels.
+ * The sum is clamped to [0, 256 * divisor) first, then the float division truncates exactly:
+ * the sum is exact in a float as long as divisor < 2^16, and a quotient below 256
+ * is never rounded across an integer. This matches clamp(sum / divisor, 0, 255).
+ */
+__attribute__((target("sse4.1"))) void kernelRowRgbaSse41(
+    const ColorRGBA* const* src_rows, const int* weights, long long kernel_height,
+    long long kernel_width, int divisor, std::span<ColorRGBA> dst_row) {
+    const __m128 divisor_ps = _mm_set1_ps(static_cast<float>(divisor));
+    const __m128i max_sum = _mm_set1_epi32(256 * divisor - 1);
+    const long long width = dst_row.size();
+    for (long long x = 0; x < width; ++x) {
+        const int* weight = weights;
+        __m128i sum = _mm_setzero_si128();
+        for (long long ky = 0; ky < kernel_height; ++ky) {
+            const ColorRGBA* taps = src_rows[ky] + x - kernel_width / 2;
+            for (long long kx = 0; kx < kernel_width; ++kx, ++weight) {
+                int bits;
+                std::memcpy(&bits, &taps[kx], sizeof(bits));
+                __m128i pixel = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bits));
+                sum = _mm_add_epi32(sum, _mm_mullo_epi32(pixel, _mm_set1_epi32(*weight)));
+            }
+        }
+        sum = _mm_min_epi32(_mm_max_epi32(sum, _mm_setzero_si128()), max_sum);
+        __m128i quotient = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(sum), divisor_ps));
+        quotient = _mm_packus_epi16(_mm_packus_epi32(quotient, quotient), quotient);
+
+        uint32_t bits = _mm_cvtsi128_si32(quotient);
+        dst_row[x].r = bits;
+        dst_row[x].g = bits >> 8;
+        dst_row[x].b = bits >> 16;
+    }
+}
+
+// Division of the 16 bit sums of the byte kernels by a divisor in [1, 2^15):
+// sum / divisor == mulhi(sum, multiplier) >> shift for every sum in [0, 2^15)
+// (Granlund, Montgomery: multiplier = ceil(2^(15 + l) / divisor) with l = ceil(log2(divisor))).
+// Kernels of nonnegative weights divided by a power of 2 may use the whole unsigned 16 bit
+// range, mulhi(sum, 2^(16 - l)) is sum >> l for every sum below 2^16.
+struct SumDivider {
+    uint16_t max_sum = 0;     // larger sums give 255 after the division anyway
+    uint16_t multiplier = 0;  // 0 for the divisor 1, there is nothing to divide then
+    int shift = 0;
+    bool is_unsigned = false;
+};
+
+SumDivider makeSumDivider(int divisor, bool is_unsigned) {
+    SumDivider divider;
+    const int max_sum = is_unsigned ? 65535 : 32767;
+    divider.max_sum = static_cast<uint16_t>(std::min(256 * divisor - 1, max_sum));
+    divider.is_unsigned = is_unsigned;
+    if (divisor == 1) {
+        return divider;
+    }
+    const int l = std::bit_width(static_cast<unsigned>(divisor - 1));
+    if ((divisor & (divisor - 1)) == 0) {
+        divider.multiplier = 1 << (16 - l);
+    } else {
+        divider.multiplier = ((uint32_t(1) << (15 + l)) + divisor - 1) / divisor;
+        divider.shift = l - 1;
+    }
+    return divider;
+}
+
+// A kernel with small weights applied to the bytes of the rows: every channel of every pixel
+// is a 16 bit lane, and a tap is the same lane of a row shifted by a whole number of pixels.
+struct ByteKernel {
+    const uint8_t* const* src_rows;  // kernel_height padded rows (see filterRowsInPlace)
+    const int16_t* weights;
+    long long kernel_height;
+    long long kernel_width;
+    long long pixel_bytes;
+    SumDivider divider;
+};
+
+// The divider of the sums of the kernel, if none of them can leave the signed 16 bit range
+// (or the unsigned one, for nonnegative weights and a power of 2 divisor)
+std::optional<SumDivider> byteKernelDivider(
+    const std::vector<std::vector<int>>& kernel, int divisor) {
+    if (divisor < 1 || divisor > 32767) {
+        return std::nullopt;
+    }
+    long long weight_sum = 0;
+    bool is_nonnegative = true;
+    for (const std::vector<int>& row : kernel) {
+        for (int weight : row) {
+            weight_sum += std::abs(static_cast<long long>(weight));
+            is_nonnegative = is_nonnegative && weight >= 0;
+        }
+    }
+    if (255 * weight_sum <= 32767) {
+        return makeSumDivider(divisor, false);
+    }
+    if (is_nonnegative && (divisor & (divisor - 1)) == 0 && 255 * weight_sum <= 65535) {
+        return makeSumDivider(divisor, true);
+    }
+    return std::nullopt;
+}
+
+/*
+ * The bytes [begin, end) of the row are computed 8 at a time, returns where it stopped.
+ * The sums are clamped to [0, max_sum] before the division, negative sums truncate to 0
+ * and larger ones to 255 anyway, so this is clamp(sum / divisor, 0, 255) of the scalar code.
+ */
+__attribute__((target("sse4.1"))) size_t kernelRowBytesSse41(
+    const ByteKernel& kernel, size_t begin, size_t end, uint8_t* dst) {
+    const long long first_tap = -(kernel.kernel_width / 2) * kernel.pixel_bytes;
+    const __m128i max_sum = _mm_set1_epi16(static_cast<short>(kernel.divider.max_sum));
+    const __m128i multiplier = _mm_set1_epi16(static_cast<short>(kernel.divider.multiplier));
+    const __m128i shift = _mm_cvtsi32_si128(kernel.divider.shift);
+    // the alpha of 4 byte pixels is kept, begin is a multiple of the pixel size
+    const __m128i alpha_mask =
+        _mm_set1_epi32(kernel.pixel_bytes == 4 ? static_cast<int>(0xFF000000u) : 0);
+    const uint8_t* center_row = kernel.src_rows[kernel.kernel_height / 2];
+
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m128i sum = _mm_setzero_si128();
+        const int16_t* weight = kernel.weights;
+        for (long long ky = 0; ky < kernel.kernel_height; ++ky) {
+            const uint8_t* taps = kernel.src_rows[ky] + i + first_tap;
+            for (long long kx = 0; kx < kernel.kernel_width; ++kx, ++weight) {
+                const auto* tap = reinterpret_cast<const __m128i*>(taps + kx * kernel.pixel_bytes);
+                __m128i values = _mm_cvtepu8_epi16(_mm_loadl_epi64(tap));
+                sum = _mm_add_epi16(sum, _mm_mullo_epi16(values, _mm_set1_epi16(*weight)));
+            }
+        }
+        if (kernel.divider.is_unsigned) {
+            sum = _mm_min_epu16(sum, max_sum);
+        } else {
+            sum = _mm_min_epi16(_mm_max_epi16(sum, _mm_setzero_si128()), max_sum);
+        }
+        if (kernel.divider.multiplier != 0) {
+            sum = _mm_srl_epi16(_mm_mulhi_epu16(sum, multiplier), shift);
+        }
+        __m128i center = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(center_row + i));
+        __m128i result = _mm_blendv_epi8(_mm_packus_epi16(sum, sum), center, alpha_mask);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), result);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) size_t kernelRowBytesAvx2(
+    const ByteKernel& kernel, size_t begin, size_t end, uint8_t* dst) {
+    const long long first_tap = -(kernel.kernel_width / 2) * kernel.pixel_bytes;
+    const __m256i max_sum = _mm256_set1_epi16(static_cast<short>(kernel.divider.max_sum));
+    const __m256i multiplier = _mm256_set1_epi16(static_cast<short>(kernel.divider.multiplier));
+    const __m128i shift = _mm_cvtsi32_si128(kernel.divider.shift);
+    const __m128i alpha_mask =
+        _mm_set1_epi32(kernel.pixel_bytes == 4 ? static_cast<int>(0xFF000000u) : 0);
+    const uint8_t* center_row = kernel.src_rows[kernel.kernel_height / 2];
+
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16) {
+        __m256i sum = _mm256_setzero_si256();
+        const int16_t* weight = kernel.weights;
+        for (long long ky = 0; ky < kernel.kernel_height; ++ky) {
+            const uint8_t* taps = kernel.src_rows[ky] + i + first_tap;
+            for (long long kx = 0; kx < kernel.kernel_width; ++kx, ++weight) {
+                const auto* tap = reinterpret_cast<const __m128i*>(taps + kx * kernel.pixel_bytes);
+                __m256i values = _mm256_cvtepu8_epi16(_mm_loadu_si128(tap));
+                sum = _mm256_add_epi16(
+                    sum, _mm256_mullo_epi16(values, _mm256_set1_epi16(*weight)));
+            }
+        }
+        if (kernel.divider.is_unsigned) {
+            sum = _mm256_min_epu16(sum, max_sum);
+        } else {
+            sum = _mm256_min_epi16(_mm256_max_epi16(sum, _mm256_setzero_si256()), max_sum);
+        }
+        if (kernel.divider.multiplier != 0) {
+            sum = _mm256_srl_epi16(_mm256_mulhi_epu16(sum, multiplier), shift);
+        }
+        // packus works within the 128 bit lanes, the permutation joins the two halves
+        __m256i packed = _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(sum, sum), _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i center = _mm_loadu_si128(reinterpret_cast<const __m128i*>(center_row + i));
+        __m128i result = _mm_blendv_epi8(_mm256_castsi256_si128(packed), center, alpha_mask);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), result);
+    }
+    return kernelRowBytesSse41(kernel, i, end, dst);
+}
+
+using KernelRowBytesFunc = size_t (*)(const ByteKernel&, size_t, size_t, uint8_t*);
+
+// the byte kernels are meant for 3x3 and 5x5 kernels, more taps are faster in other ways
+constexpr long long kMaxByteKernelTaps = 25;
+
+KernelRowBytesFunc selectKernelRowBytes() {
+    if (cpuHasAvx2()) {
+        return kernelRowBytesAvx2;
+    }
+    if (cpuHasSse41()) {
+        return kernelRowBytesSse41;
+    }
+    return nullptr;
+}
+
+// Pixels up to the first 32 byte boundary and after the last one are processed by the scalar
+// code, the rest with aligned loads and stores (rows of an ImageBuffer start aligned already)
+template <typename ScalarFunc>
+size_t alignedPrologue(ColorRGBA* row, size_t count, ScalarFunc&& scalar) {
+    size_t i = 0;
+    for (; i < count && reinterpret_cast<uintptr_t>(row + i) % 32 != 0; ++i) {
+        scalar(row[i]);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) void negativeRowRgbaAvx2(ColorRGBA* row, size_t count) {
+    auto scalar = [](ColorRGBA& pixel) {
+        pixel.r = 255 - pixel.r;
+        pixel.g = 255 - pixel.g;
+        pixel.b = 255 - pixel.b;
+    };
+    const __m256i color_mask = _mm256_set1_epi32(0x00FFFFFF);
+    size_t i = alignedPrologue(row, count, scalar);
+    for (; i + 8 <= count; i += 8) {
+        __m256i* pixels = reinterpret_cast<__m256i*>(row + i);
+        _mm256_store_si256(pixels, _mm256_xor_si256(_mm256_load_si256(pixels), color_mask));
+    }
+    for (; i < count; ++i) {
+        scalar(row[i]);
+    }
+}
+
+__attribute__((target("avx2"))) void grayscaleRowRgbaAvx2(ColorRGBA* row, size_t count) {
+    auto scalar = [](ColorRGBA& pixel) {
+        uint8_t gray = colorToGrayscale(pixel);
+        pixel = {gray, gray, gray, pixel.a};
+    };
+    const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+    const __m256i alpha_mask = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+    // (r + g + b) / 3 == (r + g + b) * 43691 >> 17 for every sum up to 765
+    const __m256i div3_multiplier = _mm256_set1_epi32(43691);
+    size_t i = alignedPrologue(row, count, scalar);
+    for (; i + 8 <= count; i += 8) {
+        __m256i* pixels = reinterpret_cast<__m256i*>(row + i);
+        __m256i color = _mm256_load_si256(pixels);
+        __m256i sum = _mm256_add_epi32(
+            _mm256_add_epi32(
+                _mm256_and_si256(color, byte_mask),
+                _mm256_and_si256(_mm256_srli_epi32(color, 8), byte_mask)),
+            _mm256_and_si256(_mm256_srli_epi32(color, 16), byte_mask));
+        __m256i gray = _mm256_srli_epi32(_mm256_mullo_epi32(sum, div3_multiplier), 17);
+        gray = _mm256_or_si256(gray, _mm256_slli_epi32(gray, 8));
+        gray = _mm256_or_si256(gray, _mm256_slli_epi32(gray, 8));
+        _mm256_store_si256(
+            pixels, _mm256_or_si256(_mm256_and_si256(gray, _mm256_set1_epi32(0x00FFFFFF)),
+                                    _mm256_and_si256(color, alpha_mask)));
+    }
+    for (; i < count; ++i) {
+        scalar(row[i]);
+    }
+}
+
+#endif
+
+// Splits an integer kernel into kernel[ky][kx] == vertical[ky] * horizontal[kx] if it has
+// rank 1. horizontal is taken from the first non-zero row divided by the gcd of its entries,
+// then every row has to be an integer multiple of it.
+bool separateKernel(
+    const std::vector<std::vector<int>>& kernel, std::span<int> horizontal,
+    std::span<int> vertical) {
+    auto base_row = std::ranges::find_if(kernel, [](const std::vector<int>& row) {
+        return std::ranges::any_of(row, [](int weight) { return weight != 0; });
+    });
+    if (base_row == kernel.end() || base_row->size() != horizontal.size()) {
+        return false;
+    }
+    int row_gcd = 0;
+    for (int weight : *base_row) {
+        row_gcd = std::gcd(row_gcd, weight);
+    }
+    std::ranges::transform(*base_row, horizontal.begin(), [&](int w) { return w / row_gcd; });
+    const size_t pivot = std::ranges::find_if(horizontal, [](int w) { return w != 0; })
+                         - horizontal.begin();
+
+    for (size_t ky = 0; ky < kernel.size(); ++ky) {
+        const std::vector<int>& row = kernel[ky];
+        if (row.size() != horizontal.size() || row[pivot] % horizontal[pivot] != 0) {
+            return false;
+        }
+        vertical[ky] = row[pivot] / horizontal[pivot];
+        for (size_t kx = 0; kx < row.size(); ++kx) {
+            if (row[kx] != vertical[ky] * horizontal[kx]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Two pass convolution with a rank 1 kernel: 2 * k multiply-adds per pixel instead of k^2.
+ * The horizontal pass keeps exact integer sums, so the result is the same as the one of the
+ * full kernel. The rows of the band are computed in place: row y is written only after the
+ * horizontal sums of every row the vertical pass needs for it are computed, and those rows
+ * (at most kernel height of them, consecutive) live in a ring buffer of sums.
+ */
+template <typename Pixel>
+void applySeparableKernelRows(
+    const BandHalos<Pixel>& source, size_t band, ImageView<Pixel> dst,
+    std::span<const int> horizontal, std::span<const int> vertical, int divisor,
+    const ViewBorder<Pixel>& border) {
+    const long long y_begin = source.bandBegin(band);
+    const long long y_end = source.bandBegin(band + 1);
+    const long long width = dst.width();
+    const long long kernel_width = horizontal.size();
+    const long long kernel_height = vertical.size();
+    const long long pad_left = kernel_width / 2;
+
+    // a padded source row, R, G, B sums of a row, kernel_height rows in the ring, and the
+    // vertical sums of a row
+    ScratchScope scratch;
+    std::span<Pixel> padded = scratch.acquire<Pixel>(width + kernel_width - 1);
+    const long long row_values = 3 * width;
+    std::span<int> ring = scratch.acquire<int>(kernel_height * row_values);
+    std::span<int> sums = scratch.acquire<int>(row_values);
+
+    // ring row (y + halo_top) % kernel_height holds the sums of the source row y
+    const long long halo_top = kernel_height / 2;
+    const long long halo_bottom = kernel_height - 1 - halo_top;
+    long long next_src_row = y_begin - halo_top;
+    for (long long y = y_begin; y < y_end; ++y) {
+        for (; next_src_row <= y + halo_bottom; ++next_src_row) {
+            std::ranges::copy(source.sourceRow(band, next_src_row), padded.begin() + pad_left);
+            padRow(&padded[pad_left], width, pad_left, kernel_width - 1 - pad_left, border);
+            int* out = &ring[((next_src_row + halo_top) % kernel_height) * row_values];
+            for (long long x = 0; x < width; ++x, out += 3) {
+                const Pixel* taps = &padded[x];
+                int sum_r = 0, sum_g = 0, sum_b = 0;
+                for (long long kx = 0; kx < kernel_width; ++kx) {
+                    const Pixel& pixel = taps[kx];
+                    sum_r += horizontal[kx] * pixel.r;
+                    sum_g += horizontal[kx] * pixel.g;
+                    sum_b += horizontal[kx] * pixel.b;
+                }
+                out[0] = sum_r;
+                out[1] = sum_g;
+                out[2] = sum_b;
+            }
+        }
+
+        std::ranges::fill(sums, 0);
+        for (long long ky = 0; ky < kernel_height; ++ky) {
+            const int* row_sums = &ring[((y + ky) % kernel_height) * row_values];
+            const int weight = vertical[ky];
+            for (long long i = 0; i < row_values; ++i) {
+                sums[i] += weight * row_sums[i];
+            }
+        }
+
+        std::span<Pixel> dst_row = dst[y];
+        for (long long x = 0; x < width; ++x) {
+            dst_row[x].r = std::clamp(sums[3 * x] / divisor, 0, 255);
+            dst_row[x].g = std::clamp(sums[3 * x + 1] / divisor, 0, 255);
+            dst_row[x].b = std::clamp(sums[3 * x + 2] / divisor, 0, 255);
+        }
+    }
+}
+
+template <typename Pixel>
+void applySeparableKernelView(
+    ImageView<Pixel> view, std::span<const int> horizontal, std::span<const int> vertical,
+    int divisor, const ViewBorder<Pixel>& border = {}) {
+    const long long width = view.width();
+    const long long height = view.height();
+    const long long kernel_width = horizontal.size();
+    const long long kernel_height = vertical.size();
+    if (width == 0 || height == 0 || kernel_width == 0 || kernel_height == 0) {
+        return;
+    }
+
+    ScratchScope scratch;
+    const long long halo_top = kernel_height / 2;
+    const size_t bands = rowBandCount(width, height, std::max(4 * (kernel_height - 1), 1LL));
+    const BandHalos<Pixel> source(
+        scratch, view, bands, halo_top, kernel_height - 1 - halo_top, border);
+    transformThreadPool().parallelFor(bands, [&](size_t band) {
+        applySeparableKernelRows<Pixel>(source, band, view, horizontal, vertical, divisor, border);
+    });
+}
+
+// The plain 2D loop over the pixels [x_begin, x_end) of a row, the reference for the vector code.
+// The rows are padded, so the taps of a pixel are consecutive pixels of every row.
+template <typename Pixel>
+void kernelRowScalar(
+    const Pixel* const* src_rows, const std::vector<std::vector<int>>& kernel, int divisor,
+    std::span<Pixel> dst_row, long long x_begin, long long x_end) {
+    const long long kernel_height = kernel.size();
+    const long long kernel_width = kernel.front().size();
+    for (long long x = x_begin; x < x_end; ++x) {
+        int sum_r = 0, sum_g = 0, sum_b = 0;
+        for (long long ky = 0; ky < kernel_height; ++ky) {
+            const std::vector<int>& kernel_row = kernel[ky];
+            const Pixel* taps = src_rows[ky] + x - kernel_width / 2;
+            for (long long kx = 0; kx < kernel_width; ++kx) {
+                const Pixel& pixel = taps[kx];
+                sum_r += kernel_row[kx] * pixel.r;
+                sum_g += kernel_row[kx] * pixel.g;
+                sum_b += kernel_row[kx] * pixel.b;
+            }
+        }
+        dst_row[x].r = std::clamp(sum_r / divisor, 0, 255);
+        dst_row[x].g = std::clamp(sum_g / divisor, 0, 255);
+        dst_row[x].b = std::clamp(sum_b / divisor, 0, 255);
+    }
+}
+
+// A kernel made ready to be applied row by row, with the weights of the vector code. The buffers
+// live in the scratch scope it is built with, and the threads computing different rows share it.
+// reference == true sticks to the plain 2D loop.
+template <typename Pixel>
+class KernelRowFilter {
+  public:
+    KernelRowFilter() = default;
+
+    KernelRowFilter(
+        ScratchScope& scratch, const std::vector<std::vector<int>>& kernel, int divisor,
+        bool reference = false) :
+        kernel_(&kernel),
+        divisor_(divisor),
+        kernel_height_(kernel.size()),
+        kernel_width_(kernel.front().size()) {
+#ifdef IMAGE_TRANSFORMS_X86
+        // 3x3 and 5x5 kernels of small weights are applied to 8 or 16 channel values at once
+        static const KernelRowBytesFunc kernel_row_bytes = selectKernelRowBytes();
+        std::optional<SumDivider> divider;
+        if (!reference && kernel_row_bytes != nullptr
+            && kernel_width_ * kernel_height_ <= kMaxByteKernelTaps) {
+            divider = byteKernelDivider(kernel, divisor);
+        }
+        if (divider) {
+            std::span<int16_t> weights = scratch.acquire<int16_t>(kernel_height_ * kernel_width_);
+            for (long long ky = 0; ky < kernel_height_; ++ky) {
+                std::ranges::copy(kernel[ky], weights.begin() + ky * kernel_width_);
+            }
+            kernel_row_bytes_ = kernel_row_bytes;
+            byte_kernel_ = {
+                nullptr, weights.data(), kernel_height_, kernel_width_, sizeof(Pixel), *divider};
+        }
+        if constexpr (std::is_same_v<Pixel, ColorRGBA>) {
+            use_vector_rows_ = !reference && cpuHasSse41() && divisor > 0 && divisor < (1 << 16);
+            weights_ = scratch.acquire<int>(kernel_height_ * kernel_width_);
+            for (long long ky = 0; ky < kernel_height_; ++ky) {
+                std::ranges::copy(kernel[ky], weights_.begin() + ky * kernel_width_);
+            }
+        }
+#endif
+    }
+
+    long long kernelHeight() const { return kernel_height_; }
+    long long kernelWidth() const { return kernel_width_; }
+    bool usesByteRows() const { return kernel_row_bytes_ != nullptr; }
+
+    // dst_row = the kernel applied to src_rows, its kernel height source rows padded like the
+    // rows of filterRowsInPlace (src_rows[kernel height / 2] is the row of dst_row itself)
+    void filterRow(const Pixel* const* src_rows, std::span<Pixel> dst_row) const {
+        const long long width = dst_row.size();
+#ifdef IMAGE_TRANSFORMS_X86
+        if (kernel_row_bytes_ != nullptr) {
+            std::array<const uint8_t*, kMaxByteKernelTaps> byte_rows;
+            for (long long ky = 0; ky < kernel_height_; ++ky) {
+                byte_rows[ky] = reinterpret_cast<const uint8_t*>(src_rows[ky]);
+            }
+            ByteKernel row_kernel = byte_kernel_;
+            row_kernel.src_rows = byte_rows.data();
+            const size_t done_bytes = kernel_row_bytes_(
+                row_kernel, 0, width * sizeof(Pixel), reinterpret_cast<uint8_t*>(dst_row.data()));
+            // the pixels after the last full vector
+            kernelRowScalar<Pixel>(
+                src_rows, *kernel_, divisor_, dst_row, done_bytes / sizeof(Pixel), width);
+            return;
+        }
+        if constexpr (std::is_same_v<Pixel, ColorRGBA>) {
+            if (use_vector_rows_) {
+                kernelRowRgbaSse41(
+                    src_rows, weights_.data(), kernel_height_, kernel_width_, divisor_, dst_row);
+                return;
+            }
+        }
+#endif
+        kernelRowScalar<Pixel>(src_rows, *kernel_, divisor_, dst_row, 0, width);
+    }
+
+  private:
+    const std::vector<std::vector<int>>* kernel_ = nullptr;
+    int divisor_ = 1;
+    long long kernel_height_ = 0;
+    long long kernel_width_ = 0;
+#ifdef IMAGE_TRANSFORMS_X86
+    KernelRowBytesFunc kernel_row_bytes_ = nullptr;
+    ByteKernel byte_kernel_{};
+    bool use_vector_rows_ = false;
+    std::span<int> weights_;
+#else
+    static constexpr void* kernel_row_bytes_ = nullptr;
+#endif
+};
+
+// Kernels of at least this many taps that are not of rank 1 are applied through the FFT. Measured
+// by `make bench BENCH=fft_kernels` on 2048x1536: the direct loop still wins at 9x9, the FFT at
+// 11x11 (and by 7x at 31x31)
+constexpr long long kFftMinKernelTaps = 100;
+// largest FFT tile, kernels up to half of it in both directions can be applied through the FFT
+constexpr long long kMaxFftTileSize = 1024;
+
+// The FFT gives back the exact integer sums (rounded to the nearest integer) as long as they fit
+// an int like in the direct loop: the rounding error of the doubles stays orders of magnitude
+// below 0.5 for such sums and tiles of up to kMaxFftTileSize^2
+bool fitsFftKernel(const std::vector<std::vector<int>>& kernel) {
+    if (kernel.empty() || kernel.front().empty() || 2 * kernel.size() > kMaxFftTileSize
+        || 2 * kernel.front().size() > kMaxFftTileSize) {
+        return false;
+    }
+    long long weight_sum = 0;
+    for (const std::vector<int>& row : kernel) {
+        for (int weight : row) {
+            weight_sum += std::abs(static_cast<long long>(weight));
+        }
+    }
+    return 255 * weight_sum <= std::numeric_limits<int>::max();
+}
+
+// Power of 2 tile size with the least work per computed pixel: a tile of size^2 pixels costs
+// about size^2 * log2(size) and gives (size - kernel_size + 1)^2 of them
+long long fftTileSize(long long kernel_size) {
+    long long best_size = kMaxFftTileSize;
+    double best_cost = std::numeric_limits<double>::infinity();
+    for (long long size = 16; size <= kMaxFftTileSize; size *= 2) {
+        const double valid = static_cast<double>(size - kernel_size + 1);
+        if (valid < 1) {
+            continue;
+        }
+        const double cost = size * size * std::log2(size) / (valid * valid);
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_size = size;
+        }
+    }
+    return best_size;
+}
+
+/*
+ * Overlap-save convolution: the view is cut into strips of tile rows, the strips into square
+ * tiles, and every tile is correlated with the kernel as a product of spectra. The R and G sums
+ * of a tile are the real and imaginary parts of one transform (the kernel is real), B takes a
+ * second one. The first tile - kernel + 1 rows and columns of a tile are the ones its circular
+ * correlation computes without wrapping around, so the tiles overlap by kernel - 1 pixels.
+ *
+ * Every band works in place like filterRowsInPlace: a strip holds copies of its source rows
+ * (padded with the pixels of the border mode), and the last kernel height - 1 of them, already
+ * overwritten in the view, are carried over to the next strip.
+ */
+template <typename Pixel>
+void applyKernelFftView(
+    ImageView<Pixel> view, const std::vector<std::vector<int>>& kernel, int divisor,
+    const ViewBorder<Pixel>& border = {}) {
+    using Complex = std::complex<double>;
+    const long long width = view.width();
+    const long long height = view.height();
+    const long long kernel_height = kernel.size();
+    const long long kernel_width = kernel.front().size();
+    if (width == 0 || height == 0) {
+        return;
+    }
+    const long long tile = fftTileSize(std::max(kernel_height, kernel_width));
+    const long long valid_rows = tile - kernel_height + 1;
+    const long long valid_columns = tile - kernel_width + 1;
+    const long long halo_top = kernel_height / 2;
+    const long long halo_bottom = kernel_height - 1 - halo_top;
+    const long long halo_left = kernel_width / 2;
+    const long long halo_right = kernel_width - 1 - halo_left;
+
+    ScratchScope scratch;
+    const FftPlan plan(tile);
+    // conj(DFT(kernel)) / tile^2: multiplying by it correlates and scales the inverse transform
+    std::span<Complex> spectrum = scratch.acquire<Complex>(tile * tile);
+    std::ranges::fill(spectrum, Complex());
+    for (long long ky = 0; ky < kernel_height; ++ky) {
+        for (long long kx = 0; kx < kernel_width; ++kx) {
+            spectrum[ky * tile + kx] = kernel[ky][kx];
+        }
+    }
+    plan.forward2D(spectrum.data());
+    const double scale = 1.0 / static_cast<double>(tile * tile);
+    for (Complex& value : spectrum) {
+        value = {value.real() * scale, -value.imag() * scale};
+    }
+    auto multiply = [&](std::span<Complex> data) {
+        for (long long i = 0; i < tile * tile; ++i) {
+            const Complex a = data[i], b = spectrum[i];
+            data[i] = {
+                a.real() * b.real() - a.imag() * b.imag(),
+                a.real() * b.imag() + a.imag() * b.real()};
+        }
+    };
+
+    const size_t bands =
+        rowBandCount(width, height, std::max(4 * (kernel_height - 1), valid_rows));
+    const BandHalos<Pixel> halos(scratch, view, bands, halo_top, halo_bottom, border);
+    transformThreadPool().parallelFor(bands, [&](size_t band) {
+        const long long y_begin = halos.bandBegin(band);
+        const long long y_end = halos.bandBegin(band + 1);
+        ScratchScope band_scratch;
+        const long long strip_width = width + kernel_width - 1;
+        ImageView<Pixel> strip = band_scratch.acquireImage<Pixel>(strip_width, tile);
+        std::span<Complex> red_green = band_scratch.acquire<Complex>(tile * tile);
+        std::span<Complex> blue = band_scratch.acquire<Complex>(tile * tile);
+
+        // rows past the last one the band reads only feed pixels of the next band
+        const long long last_src_row = y_end - 1 + halo_bottom;
+        auto load_row = [&](long long strip_row, long long y) {
+            Pixel* dst_row = strip[strip_row].data() + halo_left;
+            std::ranges::copy(halos.sourceRow(band, std::min(y, last_src_row)), dst_row);
+            padRow(dst_row, width, halo_left, halo_right, border);
+        };
+
+        for (long long y0 = y_begin; y0 < y_end; y0 += valid_rows) {
+            // row i of the strip is the source row y0 - halo_top + i
+            long long first_loaded = 0;
+            if (y0 != y_begin) {
+                for (long long i = 0; i + 1 < kernel_height; ++i) {
+                    std::ranges::copy(strip[valid_rows + i], strip[i].begin());
+                }
+                first_loaded = kernel_height - 1;
+            }
+            for (long long i = first_loaded; i < tile; ++i) {
+                load_row(i, y0 - halo_top + i);
+            }
+
+            const long long rows = std::min(valid_rows, y_end - y0);
+            for (long long x0 = 0; x0 < width; x0 += valid_columns) {
+                const long long loaded_columns = std::min(tile, strip_width - x0);
+                for (long long i = 0; i < tile; ++i) {
+                    std::span<const Pixel> strip_row = strip[i].subspan(x0, loaded_columns);
+                    Complex* rg_row = &red_green[i * tile];
+                    Complex* b_row = &blue[i * tile];
+                    for (long long j = 0; j < loaded_columns; ++j) {
+                        rg_row[j] = {double(strip_row[j].r), double(strip_row[j].g)};
+                        b_row[j] = {double(strip_row[j].b), 0.0};
+                    }
+                    std::fill(rg_row + loaded_columns, rg_row + tile, Complex());
+                    std::fill(b_row + loaded_columns, b_row + tile, Complex());
+                }
+                plan.forward2D(red_green.data());
+                plan.forward2D(blue.data());
+                multiply(red_green);
+                multiply(blue);
+                plan.inverse2D(red_green.data());
+                plan.inverse2D(blue.data());
+
+                const long long columns = std::min(valid_columns, width - x0);
+                for (long long i = 0; i < rows; ++i) {
+                    std::span<Pixel> dst_row = view[y0 + i].subspan(x0, columns);
+                    const Complex* rg_row = &red_green[i * tile];
+                    const Complex* b_row = &blue[i * tile];
+                    for (long long j = 0; j < columns; ++j) {
+                        const long long sum_r = std::llround(rg_row[j].real());
+                        const long long sum_g = std::llround(rg_row[j].imag());
+                        const long long sum_b = std::llround(b_row[j].real());
+                        dst_row[j].r = std::clamp<long long>(sum_r / divisor, 0, 255);
+                        dst_row[j].g = std::clamp<long long>(sum_g / divisor, 0, 255);
+                        dst_row[j].b = std::clamp<long long>(sum_b / divisor, 0, 255);
+                    }
+                }
+            }
+        }
+    });
+}
+
+/*
+ * reference == true sticks to the plain 2D loop, without the vector code, the separable passes
+ * and the FFT. The view is filtered in place, with a ring of the original rows the kernel still
+ * reads.
+ */
+template <typename Pixel>
+void applyKernelView(
+    ImageView<Pixel> view, const std::vector<std::vector<int>>& kernel, int divisor,
+    const ViewBorder<Pixel>& border = {}, bool reference = false) {
+    const long long width = view.width();
+    const long long height = view.height();
+    const long long kernel_height = kernel.size();
+    const long long kernel_width = kernel_height > 0 ? kernel.front().size() : 0;
+    if (width == 0 || height == 0 || kernel_width == 0) {
+        return;
+    }
+
+    ScratchScope scratch;
+    const KernelRowFilter<Pixel> filter(scratch, kernel, divisor, reference);
+    // rank 1 kernels (like the gaussian approximations) are applied as two 1D passes
+    if (!reference && !filter.usesByteRows()
+        && kernel_width * kernel_height > kernel_width + kernel_height) {
+        std::span<int> horizontal = scratch.acquire<int>(kernel_width);
+        std::span<int> vertical = scratch.acquire<int>(kernel_height);
+        if (separateKernel(kernel, horizontal, vertical)) {
+            applySeparableKernelView(view, horizontal, vertical, divisor, border);
+            return;
+        }
+    }
+    if (!reference && kernel_width * kernel_height >= kFftMinKernelTaps && fitsFftKernel(kernel)) {
+        applyKernelFftView(view, kernel, divisor, border);
+        return;
+    }
+
+    filterRowsInPlace(
+        view, kernel_height, kernel_width, border,
+        [&](const Pixel* const* rows, std::span<Pixel> dst_row) {
+            filter.filterRow(rows, dst_row);
+        });
+}
+
+// floor(sum / window) for every sum below 2^24 as a multiplication and a shift
+// (Granlund, Montgomery: multiplier = ceil(2^(24 + l) / window) with l = ceil(log2(window)))
+struct WindowDivider {
+    uint64_t multiplier = 1;
+    int shift = 0;
+
+    explicit WindowDivider(uint32_t window) {
+        const int l = std::bit_width(window - 1);
+        shift = 24 + l;
+        multiplier = ((uint64_t(1) << shift) + window - 1) / window;
+    }
+
+    uint8_t operator()(uint32_t sum) const { return (sum * multiplier) >> shift; }
+};
+
+/*
+ * Mean of the 2 * radius + 1 pixels around every pixel of a row, rounded to the nearest value.
+ * The window is a running sum: one pixel enters and one leaves it per step, whatever the radius.
+ * Out of bounds pixels are the closest pixel of the row, so the first window holds the first
+ * pixel radius + 1 times, and the last pixel as many times as the window reaches past the end.
+ */
+template <typename Pixel>
+void boxBlurRow(
+    std::span<const Pixel> src, std::span<Pixel> dst, long long radius,
+    const WindowDivider& divide) {
+    const long long width = src.size();
+    const uint32_t half_window = radius;
+    uint32_t sum_r = 0, sum_g = 0, sum_b = 0;
+    auto add = [&](const Pixel& pixel, uint32_t times) {
+        sum_r += times * pixel.r;
+        sum_g += times * pixel.g;
+        sum_b += times * pixel.b;
+    };
+    add(src[0], radius + 1);
+    for (long long x = 1; x <= std::min(radius, width - 1); ++x) {
+        add(src[x], 1);
+    }
+    add(src[width - 1], std::max(radius - (width - 1), 0LL));
+
+    for (long long x = 0; x < width; ++x) {
+        dst[x].r = divide(sum_r + half_window);
+        dst[x].g = divide(sum_g + half_window);
+        dst[x].b = divide(sum_b + half_window);
+        const Pixel& entering = src[std::min(x + radius + 1, width - 1)];
+        const Pixel& leaving = src[std::max(x - radius, 0LL)];
+        sum_r += entering.r - leaving.r;
+        sum_g += entering.g - leaving.g;
+        sum_b += entering.b - leaving.b;
+    }
+}
+
+/*
+ * The same along the columns for the rows [y_begin, y_end) of dst: the window holds the sums of
+ * the R, G and B values of every column over 2 * radius + 1 rows, a row enters and a row leaves
+ * it per output row. The loops run along the rows, so the memory is read in order.
+ */
+template <typename Pixel>
+void boxBlurColumns(
+    ConstImageView<Pixel> src, ImageView<Pixel> dst, long long radius, const WindowDivider& divide,
+    long long y_begin, long long y_end) {
+    const long long width = src.width();
+    const long long height = src.height();
+    const uint32_t half_window = radius;
+    ScratchScope scratch;
+    std::span<uint32_t> sums = scratch.acquire<uint32_t>(3 * width);
+    std::ranges::fill(sums, 0);
+    auto add_row = [&](long long y, uint32_t times) {
+        std::span<const Pixel> row = src[y];
+        for (long long x = 0; x < width; ++x) {
+            sums[3 * x] += times * row[x].r;
+            sums[3 * x + 1] += times * row[x].g;
+            sums[3 * x + 2] += times * row[x].b;
+        }
+    };
+    // the rows of the first window, the clamped ones with their multiplicity
+    const long long first = y_begin - radius;
+    const long long last = y_begin + radius;
+    add_row(0, std::max(-first, 0LL));
+    for (long long y = std::max(first, 0LL); y <= std::min(last, height - 1); ++y) {
+        add_row(y, 1);
+    }
+    add_row(height - 1, std::max(last - (height - 1), 0LL));
+
+    for (long long y = y_begin; y < y_end; ++y) {
+        std::span<Pixel> dst_row = dst[y];
+        for (long long x = 0; x < width; ++x) {
+            dst_row[x].r = divide(sums[3 * x] + half_window);
+            dst_row[x].g = divide(sums[3 * x + 1] + half_window);
+            dst_row[x].b = divide(sums[3 * x + 2] + half_window);
+        }
+        std::span<const Pixel> entering = src[std::min(y + radius + 1, height - 1)];
+        std::span<const Pixel> leaving = src[std::max(y - radius, 0LL)];
+        for (long long x = 0; x < width; ++x) {
+            sums[3 * x] += entering[x].r - leaving[x].r;
+            sums[3 * x + 1] += entering[x].g - leaving[x].g;
+            sums[3 * x + 2] += entering[x].b - leaving[x].b;
+        }
+    }
+}
+
+// Largest radius whose window sums stay below 2^24 (the range of WindowDivider)
+constexpr uint32_t kMaxBoxBlurRadius = 32767;
+
+template <typename Pixel>
+void boxBlurView(ImageView<Pixel> view, uint32_t radius) {
+    if (radius > kMaxBoxBlurRadius) {
+        throw std::invalid_argument(
+            "Box blur radius " + std::to_string(radius) + " is larger than "
+            + std::to_string(kMaxBoxBlurRadius));
+    }
+    const long long width = view.width();
+    const long long height = view.height();
+    if (width == 0 || height == 0 || radius == 0) {
+        return;
+    }
+    const WindowDivider divide(2 * radius + 1);
+
+    // the horizontal pass writes into a scratch image, the vertical one reads it back into the
+    // view; a band of the vertical pass starts with a whole window, so it is at least 4 radii tall
+    ScratchScope scratch;
+    ImageView<Pixel> rows_blurred = scratch.acquireImage<Pixel>(view.width(), view.height());
+    parallelForRows(height, rowBandCount(width, height), [&](size_t y_begin, size_t y_end) {
+        for (size_t y = y_begin; y < y_end; ++y) {
+            boxBlurRow<Pixel>(view[y], rows_blurred[y], radius, divide);
+        }
+    });
+    parallelForRows(
+        height, rowBandCount(width, height, 4 * size_t(radius)),
+        [&](long long y_begin, long long y_end) {
+            boxBlurColumns<Pixel>(rows_blurred, view, radius, divide, y_begin, y_end);
+        });
+}
+
+/*
+ * Radii of passes box blurs whose result approximates a gaussian blur of the given sigma
+ * (the variance of a box of width w is (w^2 - 1) / 12, and the variances of the passes add up).
+ * The widths are the two odd ones around the ideal width, the number of narrower boxes makes
+ * the total variance closest to sigma^2 (as in https://blog.ivank.net/fastest-gaussian-blur.html).
+ */
+std::vector<uint32_t> gaussianBoxRadii(double sigma, int passes) {
+    const double variance = 12 * sigma * sigma;
+    const double ideal_width = std::sqrt(variance / passes + 1);
+    int lower_width = static_cast<int>(std::floor(ideal_width));
+    if (lower_width % 2 == 0) {
+        --lower_width;
+    }
+    const int narrow_passes = std::clamp(
+        static_cast<int>(std::lround(
+            (variance - passes * (lower_width * lower_width + 4.0 * lower_width + 3))
+            / (-4.0 * lower_width - 4))),
+        0, passes);
+
+    std::vector<uint32_t> radii;
+    for (int pass = 0; pass < passes; ++pass) {
+        const int width = pass < narrow_passes ? lower_width : lower_width + 2;
+        radii.push_back((width - 1) / 2);
+    }
+    return radii;
+}
+
+template <typename Pixel>
+void gaussianBlurView(ImageView<Pixel> view, double sigma, int passes) {
+    if (!(sigma > 0) || passes < 1) {
+        return;
+    }
+    for (uint32_t radius : gaussianBoxRadii(sigma, passes)) {
+        boxBlurView(view, radius);
+    }
+}
+
+// refer to https://en.wikipedia.org/wiki/Kernel_(image_processing)#Details
+// for exact kernel
+// the kernels are compile time constants, the filters are unrolled for them (fixed_kernel.h)
+
+constexpr FixedKernel<3, 3> kSharpenKernel = {{{0, -1, 0}, {-1, 5, -1}, {0, -1, 0}}};
+constexpr FixedKernel<3, 3> kBlurKernel = {{{1, 2, 1}, {2, 4, 2}, {1, 2, 1}}};
+constexpr FixedKernel<5, 5> kHardBlurKernel = {{
+    {1, 4, 6, 4, 1},
+    {4, 16, 24, 16, 4},
+    {6, 24, 36, 24, 6},
+    {4, 16, 24, 16, 4},
+    {1, 4, 6, 4, 1},
+}};
+constexpr FixedKernel<3, 3> kEdgeDetectKernel = {{{-1, -1, -1}, {-1, 8, -1}, {-1, -1, -1}}};
+
+template <typename Pixel>
+void sharpenView(ImageView<Pixel> view) {
+    applyFixedKernel<kSharpenKernel, 1>(view);
+}
+
+template <typename Pixel>
+void gaussianBlurApproxView(ImageView<Pixel> view, bool hard_blur) {
+    if (hard_blur) {
+        applyFixedKernel<kHardBlurKernel, 256>(view);
+    } else {
+        applyFixedKernel<kBlurKernel, 16>(view);
+    }
+}
+
+template <typename Pixel>
+void edgeDetectView(ImageView<Pixel> view) {
+    applyFixedKernel<kEdgeDetectKernel, 1>(view);
+}
+
+// The rows of a fixed kernel, in the layout of applyKernel
+template <size_t H, size_t W>
+std::vector<std::vector<int>> kernelRows(const FixedKernel<H, W>& kernel) {
+    std::vector<std::vector<int>> rows;
+    for (const std::array<int, W>& row : kernel) {
+        rows.emplace_back(row.begin(), row.end());
+    }
+    return rows;
+}
+
+// All the weights are 0 but the center one, which is the divisor: every pixel stays as it is
+bool isIdentityKernel(const std::vector<std::vector<int>>& kernel, int divisor) {
+    const size_t center_y = kernel.size() / 2;
+    const size_t center_x = kernel.front().size() / 2;
+    for (size_t ky = 0; ky < kernel.size(); ++ky) {
+        for (size_t kx = 0; kx < kernel[ky].size(); ++kx) {
+            const bool is_center = ky == center_y && kx == center_x;
+            if (kernel[ky][kx] != (is_center ? divisor : 0)) {
+                return false;
+            }
+        }
+    }
+    return divisor != 0;
+}
+
+template <size_t H, size_t W>
+bool isSameKernel(const std::vector<std::vector<int>>& kernel, const FixedKernel<H, W>& fixed) {
+    return kernel.size() == H && std::ranges::equal(kernel, fixed, std::ranges::equal);
+}
+
+template <typename Pixel>
+using FixedKernelRowPtr = void (*)(const Pixel* const*, std::span<Pixel>);
+
+// The unrolled rows of the named filter with the same kernel, if there is one
+template <typename Pixel>
+FixedKernelRowPtr<Pixel> namedKernelRow(const std::vector<std::vector<int>>& kernel, int divisor) {
+    if (divisor == 1 && isSameKernel(kernel, kSharpenKernel)) {
+        return applyFixedKernelRow<kSharpenKernel, 1, Pixel>;
+    }
+    if (divisor == 1 && isSameKernel(kernel, kEdgeDetectKernel)) {
+        return applyFixedKernelRow<kEdgeDetectKernel, 1, Pixel>;
+    }
+    if (divisor == 16 && isSameKernel(kernel, kBlurKernel)) {
+        return applyFixedKernelRow<kBlurKernel, 16, Pixel>;
+    }
+    if (divisor == 256 && isSameKernel(kernel, kHardBlurKernel)) {
+        return applyFixedKernelRow<kHardBlurKernel, 256, Pixel>;
+    }
+    return nullptr;
+}
+
+// A stage of a chain ready to run, with the number of rows above and below a row it reads and
+// of pixels left and right of a pixel. A kernel stage runs either the rows of a named filter or a
+// KernelRowFilter.
+template <typename Pixel>
+struct ChainStage {
+    FilterChain::Stage::Type type;
+    FixedKernelRowPtr<Pixel> fixed_row;
+    KernelRowFilter<Pixel> filter;
+    long long halo_top;
+    long long halo_bottom;
+    long long halo_left;
+    long long halo_right;
+};
+
+/*
+ * The rows [y_begin, y_end) of a view through all the stages of a chain. Every stage keeps its
+ * input rows in a ring of kernel height rows (one for the pixel-wise stages). A row is computed
+ * as soon as the last input row it reads has arrived and goes straight into the ring of the next
+ * stage, which consumes it before the row after it is computed, so no row is overwritten while
+ * still needed. The rows a stage computes beyond [y_begin, y_end) are the halo the later stages
+ * read, computed again by the neighbouring band, and at the borders of the view the rows are
+ * clamped stage by stage, exactly like the filters called one by one do. The rings are padded
+ * with the closest pixels, like the rows of filterRowsInPlace.
+ *
+ * The source rows are copied into the first ring as they are pushed, and the row y of the view is
+ * written once every source row up to y + (total halo below) has been pushed, so the view may be
+ * the source of its own band.
+ */
+template <typename Pixel>
+class ChainPipeline {
+  public:
+    ChainPipeline(
+        ScratchScope& scratch, ImageView<Pixel> view, std::span<const ChainStage<Pixel>> stages,
+        long long y_begin, long long y_end) :
+        view_(view), stages_(stages) {
+        const size_t count = stages.size();
+        rings_ = scratch.acquire<ImageView<Pixel>>(count);
+        next_row_ = scratch.acquire<long long>(count);
+        row_end_ = scratch.acquire<long long>(count);
+        last_input_row_ = scratch.acquire<long long>(count);
+
+        long long max_kernel_height = 1;
+        for (size_t s = count; s-- > 0;) {
+            const ChainStage<Pixel>& stage = stages[s];
+            next_row_[s] = y_begin;
+            row_end_[s] = y_end;
+            // the rows the stage reads are the rows the previous one computes
+            y_begin = std::max(y_begin - stage.halo_top, 0LL);
+            y_end = std::min(y_end + stage.halo_bottom, static_cast<long long>(view.height()));
+            last_input_row_[s] = y_begin - 1;
+
+            const long long ring_height = stage.halo_top + 1 + stage.halo_bottom;
+            rings_[s] = scratch.acquireImage<Pixel>(
+                stage.halo_left + view.width() + stage.halo_right, ring_height);
+            max_kernel_height = std::max(max_kernel_height, ring_height);
+        }
+        source_begin_ = y_begin;
+        source_end_ = y_end;
+        src_rows_ = scratch.acquire<const Pixel*>(max_kernel_height);
+    }
+
+    // the source rows the band needs, to be pushed in order
+    long long sourceBegin() const { return source_begin_; }
+    long long sourceEnd() const { return source_end_; }
+
+    void push(std::span<const Pixel> src_row) {
+        const long long y = last_input_row_[0] + 1;
+        std::ranges::copy(src_row, ringRow(0, y).begin());
+        padRingRow(0, y);
+        last_input_row_[0] = y;
+        drain(0);
+    }
+
+  private:
+    std::span<Pixel> ringRow(size_t stage, long long y) const {
+        const ChainStage<Pixel>& ring_stage = stages_[stage];
+        return rings_[stage][y % rings_[stage].height()].subspan(
+            ring_stage.halo_left, view_.width());
+    }
+
+    void padRingRow(size_t stage, long long y) const {
+        padRow(
+            ringRow(stage, y).data(), view_.width(), stages_[stage].halo_left,
+            stages_[stage].halo_right, ViewBorder<Pixel>{});
+    }
+
+    // computes every row of the stage whose input is complete, and passes it on
+    void drain(size_t stage_index) {
+        const ChainStage<Pixel>& stage = stages_[stage_index];
+        const long long last_row = view_.height() - 1;
+        const bool is_last = stage_index + 1 == stages_.size();
+        while (next_row_[stage_index] < row_end_[stage_index]
+               && std::min(next_row_[stage_index] + stage.halo_bottom, last_row)
+                      <= last_input_row_[stage_index]) {
+            const long long y = next_row_[stage_index]++;
+            std::span<Pixel> dst_row = is_last ? view_[y] : ringRow(stage_index + 1, y);
+            computeRow(stage_index, y, dst_row);
+            if (!is_last) {
+                padRingRow(stage_index + 1, y);
+                last_input_row_[stage_index + 1] = y;
+                drain(stage_index + 1);
+            }
+        }
+    }
+
+    void computeRow(size_t stage_index, long long y, std::span<Pixel> dst_row) {
+        const ChainStage<Pixel>& stage = stages_[stage_index];
+        if (stage.type != FilterChain::Stage::Type::Kernel) {
+            std::ranges::copy(ringRow(stage_index, y), dst_row.begin());
+            ImageView<Pixel> row_view(
+                dst_row.data(), dst_row.size(), 1,
+                static_cast<ptrdiff_t>(dst_row.size() * sizeof(Pixel)));
+            if (stage.type == FilterChain::Stage::Type::Negative) {
+                negative(row_view);
+            } else {
+                toGrayscale(row_view);
+            }
+            return;
+        }
+
+        const long long kernel_height = stage.halo_top + 1 + stage.halo_bottom;
+        const long long last_row = view_.height() - 1;
+        for (long long ky = 0; ky < kernel_height; ++ky) {
+            const long long src_y = std::clamp(y + ky - stage.halo_top, 0LL, last_row);
+            src_rows_[ky] = ringRow(stage_index, src_y).data();
+        }
+        if constexpr (std::is_same_v<Pixel, ColorRGBA>) {
+            // the kernel keeps the alpha of the row
+            std::copy_n(src_rows_[stage.halo_top], dst_row.size(), dst_row.begin());
+        }
+        if (stage.fixed_row != nullptr) {
+            stage.fixed_row(src_rows_.data(), dst_row);
+        } else {
+            stage.filter.filterRow(src_rows_.data(), dst_row);
+        }
+    }
+
+    ImageView<Pixel> view_;
+    std::span<const ChainStage<Pixel>> stages_;
+    std::span<ImageView<Pixel>> rings_;     // input rows of every stage
+    std::span<long long> next_row_;         // next row every stage computes
+    std::span<long long> row_end_;          // and the end of the rows it computes
+    std::span<long long> last_input_row_;   // last row in the ring of every stage
+    std::span<const Pixel*> src_rows_;
+    long long source_begin_ = 0;
+    long long source_end_ = 0;
+};
+
+// The view streams through the chain in place, in bands that save the rows of their neighbours
+// they read first (the total halo of the stages, a few rows). Every pixel of the view is read and
+// written once.
+template <typename Pixel>
+void applyFilterChainView(ImageView<Pixel> view, const std::vector<FilterChain::Stage>& chain) {
+    const long long width = view.width();
+    const long long height = view.height();
+    if (width == 0 || height == 0 || chain.empty()) {
+        return;
+    }
+
+    ScratchScope scratch;
+    std::span<ChainStage<Pixel>> stages = scratch.acquire<ChainStage<Pixel>>(chain.size());
+    long long halo_top = 0;
+    long long halo_bottom = 0;
+    for (size_t s = 0; s < chain.size(); ++s) {
+        stages[s] = {chain[s].type, nullptr, {}, 0, 0, 0, 0};
+        if (chain[s].type == FilterChain::Stage::Type::Kernel) {
+            const std::vector<std::vector<int>>& kernel = chain[s].kernel;
+            const long long kernel_height = kernel.size();
+            const long long kernel_width = kernel.front().size();
+            stages[s].fixed_row = namedKernelRow<Pixel>(kernel, chain[s].divisor);
+            if (stages[s].fixed_row == nullptr) {
+                stages[s].filter = KernelRowFilter<Pixel>(scratch, kernel, chain[s].divisor);
+            }
+            stages[s].halo_top = kernel_height / 2;
+            stages[s].halo_bottom = kernel_height - 1 - kernel_height / 2;
+            stages[s].halo_left = kernel_width / 2;
+            stages[s].halo_right = kernel_width - 1 - kernel_width / 2;
+        }
+        halo_top += stages[s].halo_top;
+        halo_bottom += stages[s].halo_bottom;
+    }
+
+    const size_t bands = rowBandCount(width, height, std::max(4 * (halo_top + halo_bottom), 1LL));
+    const BandHalos<Pixel> halos(scratch, view, bands, halo_top, halo_bottom);
+    transformThreadPool().parallelFor(bands, [&](size_t band) {
+        ScratchScope band_scratch;
+        ChainPipeline<Pixel> pipeline(
+            band_scratch, view, stages, halos.bandBegin(band), halos.bandBegin(band + 1));
+        for (long long y = pipeline.sourceBegin(); y < pipeline.sourceEnd(); ++y) {
+            pipeline.push(halos.sourceRow(band, y));
+        }
+    });
+}
+
+// Smoothing [side center side] of a gradient operator, the derivative is [-1 0 1]
+struct GradientWeights {
+    int side;
+    int center;
+};
+
+GradientWeights gradientWeights(GradientOperator gradient) {
+    return gradient == GradientOperator::Scharr ? GradientWeights{3, 10} : GradientWeights{1, 2};
+}
+
+// The gray of colorToGrayscale of the pixels [begin, end) of a row
+template <typename Pixel>
+inline void lumaValues(const Pixel* src, long long begin, long long end, int16_t* luma) {
+    for (long long x = begin; x < end; ++x) {
+        luma[x] = static_cast<int16_t>((src[x].r + src[x].g + src[x].b) / 3);
+    }
+}
+
+#ifdef IMAGE_TRANSFORMS_X86
+
+// 8 pixels in the 32 bit lanes of a vector, the channels in the low 3 bytes
+__attribute__((target("avx2"))) inline __m256i loadPixels8(const ColorRGBA* src) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+}
+
+// 3 byte pixels are spread over the two 128 bit lanes first (pshufb cannot cross them),
+// 11 pixels must be readable
+__attribute__((target("avx2"))) inline __m256i loadPixels8(const ColorRGB* src) {
+    const __m256i spread = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+    const __m256i expand = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1,
+        9, 10, 11, -1);
+    const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+    return _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(pixels, spread), expand);
+}
+
+/*
+ * lumaValues of 16 pixels at a time; returns where it stopped. maddubs adds r + g and b + 0 of
+ * every pixel, madd the two halves, and the division by 3 is a multiply by 0xaaab keeping the
+ * bits from 17 on, exact for any 16 bit sum.
+ */
+template <typename Pixel>
+__attribute__((target("avx2"))) long long lumaValuesAvx2(
+    const Pixel* src, long long width, int16_t* luma) {
+    const __m256i weights = _mm256_set1_epi32(0x00010101);
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i third = _mm256_set1_epi16(static_cast<int16_t>(0xaaab));
+    // the last load of 3 byte pixels reads 3 pixels further
+    const long long slack = sizeof(Pixel) == 3 ? 3 : 0;
+    long long x = 0;
+    for (; x + 16 + slack <= width; x += 16) {
+        const __m256i low =
+            _mm256_madd_epi16(_mm256_maddubs_epi16(loadPixels8(src + x), weights), ones);
+        const __m256i high =
+            _mm256_madd_epi16(_mm256_maddubs_epi16(loadPixels8(src + x + 8), weights), ones);
+        // packs works within the 128 bit lanes, the permutation puts the 16 sums in order
+        const __m256i sums = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xd8);
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i*>(luma + x),
+            _mm256_srli_epi16(_mm256_mulhi_epu16(sums, third), 1));
+    }
+    return x;
+}
+
+/*
+ * round(sqrt(squared) / scale) saturated to 255, 8 pixels at a time; returns where it stopped.
+ * The float root is within one of the exact result, the squares compared as integers fix it:
+ * m is the result if ((2 m - 1) * scale)^2 <= 4 * squared < ((2 m + 1) * scale)^2.
+ */
+__attribute__((target("avx2"))) size_t magnitudeRowAvx2(
+    const int32_t* squared, size_t count, int scale, uint8_t* dst) {
+    const __m256 inv_scale = _mm256_set1_ps(1.0f / scale);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256i scale_v = _mm256_set1_epi32(scale);
+    const __m256i one = _mm256_set1_epi32(1);
+    size_t x = 0;
+    for (; x + 8 <= count; x += 8) {
+        const __m256i sq = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(squared + x));
+        const __m256 root = _mm256_sqrt_ps(_mm256_cvtepi32_ps(sq));
+        __m256i m = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(root, inv_scale), half));
+
+        const __m256i quad = _mm256_slli_epi32(sq, 2);
+        const __m256i two_m = _mm256_slli_epi32(m, 1);
+        const __m256i low = _mm256_mullo_epi32(_mm256_sub_epi32(two_m, one), scale_v);
+        const __m256i high = _mm256_mullo_epi32(_mm256_add_epi32(two_m, one), scale_v);
+        // the masks are -1 where true: m - 1 if low^2 > 4 * squared, m + 1 unless high^2 is
+        m = _mm256_add_epi32(m, _mm256_cmpgt_epi32(_mm256_mullo_epi32(low, low), quad));
+        m = _mm256_add_epi32(
+            _mm256_add_epi32(m, one), _mm256_cmpgt_epi32(_mm256_mullo_epi32(high, high), quad));
+        m = _mm256_max_epi32(m, _mm256_setzero_si256());
+
+        __m128i words =
+            _mm_packus_epi32(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(words, words));
+    }
+    return x;
+}
+
+#endif
+
+// The luma of a row, padded by one clamped pixel on both sides
+template <typename Pixel>
+void lumaRow(std::span<const Pixel> src, int16_t* luma) {
+    const long long width = src.size();
+    long long x = 0;
+#ifdef IMAGE_TRANSFORMS_X86
+    static const bool use_avx2 = cpuHasAvx2();
+    if (use_avx2) {
+        x = lumaValuesAvx2(src.data(), width, luma);
+    }
+#endif
+    lumaValues(src.data(), x, width, luma);
+    luma[-1] = luma[0];
+    luma[width] = luma[width - 1];
+}
+
+// round(sqrt(squared) / scale) saturated to 255. The division by a power of 2 is exact and
+// the double root is correctly rounded, so the rounding to an integer is exact as well.
+void magnitudeRow(const int32_t* squared, size_t count, int scale, uint8_t* dst) {
+    size_t x = 0;
+#ifdef IMAGE_TRANSFORMS_X86
+    static const bool use_avx2 = cpuHasAvx2();
+    if (use_avx2) {
+        x = magnitudeRowAvx2(squared, count, scale, dst);
+    }
+#endif
+    for (; x < count; ++x) {
+        const double value = std::sqrt(static_cast<double>(squared[x])) / scale + 0.5;
+        dst[x] = static_cast<uint8_t>(std::min(value, 255.0));
+    }
+}
+
+/*
+ * Gx and Gy of a row from the luma rows above, at and below it. Both operators are separable:
+ * Gx is the difference along the row of the rows smoothed across, Gy the smoothing along the row
+ * of the difference across the rows, so the two sums over the rows are shared and every pixel
+ * costs a handful of additions. The values fit 16 bits: |Gx|, |Gy| <= 16 * 255.
+ */
+void gradientRow(
+    const int16_t* up, const int16_t* mid, const int16_t* down, long long width,
+    GradientWeights weights, int16_t* smooth, int16_t* diff, int16_t* gx, int16_t* gy) {
+    for (long long x = -1; x <= width; ++x) {
+        smooth[x] =
+            static_cast<int16_t>(weights.side * (up[x] + down[x]) + weights.center * mid[x]);
+        diff[x] = static_cast<int16_t>(down[x] - up[x]);
+    }
+    for (long long x = 0; x < width; ++x) {
+        gx[x] = static_cast<int16_t>(smooth[x + 1] - smooth[x - 1]);
+        gy[x] = static_cast<int16_t>(
+            weights.side * (diff[x - 1] + diff[x + 1]) + weights.center * diff[x]);
+    }
+}
+
+/*
+ * Gradient directions of a row rounded to a multiple of 45 degrees, as the steps (dx, dy) to the
+ * neighbour across the edge. Every gy / gx of the gradients of 8 bit images is at least 10^-8
+ * away from tan(22.5) = sqrt(2) - 1, far more than the rounding of the doubles, so the sectors
+ * are exact; and tan(67.5) = tan(22.5) + 2. There are no branches, the directions of noisy
+ * gradients would be mispredicted half the time.
+ */
+inline void edgeStepValues(
+    const int16_t* gx, const int16_t* gy, long long begin, long long end, int8_t* step_x,
+    int8_t* step_y) {
+    constexpr double tan22 = 0.41421356237309503;
+    for (long long x = begin; x < end; ++x) {
+        const double ax = std::abs(gx[x]);
+        const double ay = std::abs(gy[x]);
+        const bool is_horizontal = ay < ax * tan22;
+        const bool is_vertical = ay > ax * (tan22 + 2);
+        const int8_t diagonal_dy = (gx[x] ^ gy[x]) < 0 ? -1 : 1;
+        step_x[x] = !is_vertical;
+        step_y[x] = is_horizontal ? 0 : (is_vertical ? 1 : diagonal_dy);
+    }
+}
+
+#ifdef IMAGE_TRANSFORMS_X86
+
+/*
+ * edgeStepValues of 8 gradients in 32 bit lanes, with the sectors compared exactly in integers:
+ * ay < ax * tan(22.5) is (ax + ay)^2 < 2 ax^2, and ay > ax * tan(67.5) is ay - ax > sqrt(2) ax.
+ * The squares fit the lanes, ax + ay <= 2 * 16 * 255.
+ */
+__attribute__((target("avx2"))) inline void edgeSteps8(
+    __m256i gx, __m256i gy, __m256i& step_x, __m256i& step_y) {
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i ax = _mm256_abs_epi32(gx);
+    const __m256i ay = _mm256_abs_epi32(gy);
+    const __m256i twice_ax2 = _mm256_slli_epi32(_mm256_mullo_epi32(ax, ax), 1);
+    const __m256i sum = _mm256_add_epi32(ax, ay);
+    const __m256i difference = _mm256_sub_epi32(ay, ax);
+    // the masks are -1 where true
+    const __m256i is_horizontal = _mm256_cmpgt_epi32(twice_ax2, _mm256_mullo_epi32(sum, sum));
+    const __m256i is_vertical = _mm256_and_si256(
+        _mm256_cmpgt_epi32(ay, ax),
+        _mm256_cmpgt_epi32(_mm256_mullo_epi32(difference, difference), twice_ax2));
+    // -1 if the signs differ, 1 otherwise
+    const __m256i diagonal_dy =
+        _mm256_or_si256(_mm256_srai_epi32(_mm256_xor_si256(gx, gy), 31), one);
+    step_x = _mm256_add_epi32(is_vertical, one);
+    step_y = _mm256_andnot_si256(is_horizontal, _mm256_blendv_epi8(diagonal_dy, one, is_vertical));
+}
+
+// 16 lanes of 32 bits to 16 bytes in order
+__attribute__((target("avx2"))) inline __m128i packSteps16(__m256i low, __m256i high) {
+    const __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xd8);
+    return _mm_packs_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+}
+
+__attribute__((target("avx2"))) inline __m256i loadWords8(const int16_t* src) {
+    return _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+}
+
+// edgeStepValues of 16 pixels at a time, returns where it stopped
+__attribute__((target("avx2"))) long long edgeStepValuesAvx2(
+    const int16_t* gx, const int16_t* gy, long long width, int8_t* step_x, int8_t* step_y) {
+    long long x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i low_x, low_y, high_x, high_y;
+        edgeSteps8(loadWords8(gx + x), loadWords8(gy + x), low_x, low_y);
+        edgeSteps8(loadWords8(gx + x + 8), loadWords8(gy + x + 8), high_x, high_y);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(step_x + x), packSteps16(low_x, high_x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(step_y + x), packSteps16(low_y, high_y));
+    }
+    return x;
+}
+
+#endif
+
+void edgeSteps(
+    const int16_t* gx, const int16_t* gy, long long width, int8_t* step_x, int8_t* step_y) {
+    long long x = 0;
+#ifdef IMAGE_TRANSFORMS_X86
+    static const bool use_avx2 = cpuHasAvx2();
+    if (use_avx2) {
+        x = edgeStepValuesAvx2(gx, gy, width, step_x, step_y);
+    }
+#endif
+    edgeStepValues(gx, gy, x, width, step_x, step_y);
+}
+
+/*
+ * The map is computed in bands of rows. A band streams its rows through a ring of 3 luma rows
+ * and, for the non-maximum suppression, a ring of 3 rows of squared magnitudes (exact integers,
+ * padded with zeros so that the pixels past the borders never win) with the gradient of each
+ * pixel. The rings start one row above the band, so the bands are independent.
+ */
+template <typename Pixel>
+void edgeMapView(
+    ConstImageView<Pixel> view, const EdgeMapOptions& options, ImageView<uint8_t> magnitude,
+    ImageView<uint8_t> direction) {
+    const long long width = view.width();
+    const long long height = view.height();
+    if (width == 0 || height == 0) {
+        return;
+    }
+    const GradientWeights weights = gradientWeights(options.gradient);
+    const int scale = 2 * weights.side + weights.center;
+    const bool suppress = options.non_max_suppression;
+
+    parallelForRows(height, rowBandCount(width, height), [&](size_t y_begin, size_t y_end) {
+        const long long padded_width = width + 2;
+        ScratchScope scratch;
+        std::span<int16_t> luma = scratch.acquire<int16_t>(3 * padded_width);
+        std::span<int16_t> smooth = scratch.acquire<int16_t>(padded_width);
+        std::span<int16_t> diff = scratch.acquire<int16_t>(padded_width);
+        std::span<int16_t> gx = scratch.acquire<int16_t>(3 * width);
+        std::span<int16_t> gy = scratch.acquire<int16_t>(3 * width);
+        std::span<int32_t> squared = scratch.acquire<int32_t>(3 * padded_width);
+        std::span<int8_t> step_x = scratch.acquire<int8_t>(width);
+        std::span<int8_t> step_y = scratch.acquire<int8_t>(width);
+        auto luma_row = [&](long long y) { return &luma[(y % 3) * padded_width + 1]; };
+        auto squared_row = [&](long long y) { return &squared[((y + 3) % 3) * padded_width + 1]; };
+
+        // the suppression reads the gradient of the row above the band, and that one the row
+        // above it
+        const long long first_row = static_cast<long long>(y_begin) - (suppress ? 1 : 0);
+        long long next_luma_row = std::max(first_row - 1, 0LL);
+        // the gradient and the squared magnitude of row y go to the ring row y % 3
+        auto compute_gradient = [&](long long y) {
+            int32_t* sq = squared_row(y);
+            if (y < 0 || y >= height) {
+                std::fill_n(sq - 1, padded_width, 0);
+                return;
+            }
+            for (; next_luma_row <= std::min(y + 1, height - 1); ++next_luma_row) {
+                lumaRow<Pixel>(view[next_luma_row], luma_row(next_luma_row));
+            }
+            int16_t* row_gx = &gx[(y % 3) * width];
+            int16_t* row_gy = &gy[(y % 3) * width];
+            gradientRow(
+                luma_row(std::max(y - 1, 0LL)), luma_row(y), luma_row(std::min(y + 1, height - 1)),
+                width, weights, &smooth[1], &diff[1], row_gx, row_gy);
+            sq[-1] = sq[width] = 0;
+            for (long long x = 0; x < width; ++x) {
+                sq[x] = row_gx[x] * row_gx[x] + row_gy[x] * row_gy[x];
+            }
+        };
+
+        if (suppress) {
+            compute_gradient(first_row);
+            compute_gradient(y_begin);
+        }
+        for (long long y = y_begin; y < static_cast<long long>(y_end); ++y) {
+            compute_gradient(suppress ? y + 1 : y);
+            const int16_t* row_gx = &gx[(y % 3) * width];
+            const int16_t* row_gy = &gy[(y % 3) * width];
+            const int32_t* sq = squared_row(y);
+            std::span<uint8_t> dst_row = magnitude[y];
+            magnitudeRow(sq, width, scale, dst_row.data());
+            if (suppress) {
+                edgeSteps(row_gx, row_gy, width, step_x.data(), step_y.data());
+                const int32_t* rows[3] = {squared_row(y - 1), sq, squared_row(y + 1)};
+                for (long long x = 0; x < width; ++x) {
+                    const int32_t before = rows[1 - step_y[x]][x - step_x[x]];
+                    const int32_t after = rows[1 + step_y[x]][x + step_x[x]];
+                    const bool is_maximum = (sq[x] > before) & (sq[x] >= after);
+                    dst_row[x] = is_maximum ? dst_row[x] : 0;
+                }
+            }
+            if (!direction.empty()) {
+                std::span<uint8_t> direction_row = direction[y];
+                for (long long x = 0; x < width; ++x) {
+                    const double angle = std::atan2(row_gy[x], row_gx[x]);
+                    direction_row[x] = static_cast<uint8_t>(std::lround(angle * 128 / M_PI) & 255);
+                }
+            }
+        }
+    });
+}
+
+template <typename Pixel>
+ImageBuffer<uint8_t> edgeMapBuffer(
+    ConstImageView<Pixel> view, const EdgeMapOptions& options, ImageBuffer<uint8_t>* direction) {
+    ImageBuffer<uint8_t> magnitude(view.width(), view.height());
+    ImageView<uint8_t> direction_view;
+    if (direction != nullptr) {
+        direction->resize(view.width(), view.height());
+        direction_view = direction->view();
+    }
+    edgeMapView(view, options, magnitude.view(), direction_view);
+    return magnitude;
 }
 
-void rotate(UncompressedImage& img, int angle, ColorRGB fill_color, bool smart_gap_interpolation) {
+}  // namespace
+
+void rotate(
+    UncompressedImage& img, int angle, ColorRGB fill_color, bool smart_gap_interpolation,
+    RotationStats* stats) {
     /*
     * Rotates the image by the given angle
     * fill_color is the color of the pixels that are not covered by the original image
     * if smart_gap_interpolation flag is up, then the function should fill the gaps with nearest neighbour interpolation
     */
+    rotateView(img.image_data.view(), angle, fill_color, smart_gap_interpolation, stats);
+}
+
+void rotate(
+    UncompressedImageRGBA& img, int angle, ColorRGBA fill_color, bool smart_gap_interpolation,
+    RotationStats* stats) {
+    rotateView(img.image_data.view(), angle, fill_color, smart_gap_interpolation, stats);
+}
+
+void rotateShear(UncompressedImage& img, double angle, ColorRGB fill_color) {
+    rotateShearView(img.image_data.view(), angle, fill_color);
+}
+
+void rotateShear(UncompressedImageRGBA& img, double angle, ColorRGBA fill_color) {
+    rotateShearView(img.image_data.view(), angle, fill_color);
 }
 
-void applyKernel(UncompressedImage& img, const std::vector<std::vector<int>>& kernel, int divisor) {
+void applyKernel(
+    UncompressedImage& img, const std::vector<std::vector<int>>& kernel, int divisor,
+    BorderMode border, ColorRGB border_color) {
     /*
     * Applies kernel to the image
-    * Mind the edge cases and their handling (how to handle pixels that are out of bounds)
+    * The pixels that are out of bounds are the ones of the border mode
     */
+    applyKernelView(img.image_data.view(), kernel, divisor, {border, border_color});
+}
 
-    // read about std::clamp and think about how it can be used for edge cases here
+void applyKernel(
+    UncompressedImageRGBA& img, const std::vector<std::vector<int>>& kernel, int divisor,
+    BorderMode border, ColorRGBA border_color) {
+    applyKernelView(img.image_data.view(), kernel, divisor, {border, border_color});
+}
 
+void applyKernel(
+    ImageView<ColorRGB> view, const std::vector<std::vector<int>>& kernel, int divisor,
+    BorderMode border, ColorRGB border_color) {
+    applyKernelView(view, kernel, divisor, {border, border_color});
 }
 
-// refer to https://en.wikipedia.org/wiki/Kernel_(image_processing)#Details
-// for exact kernel
+void applyKernel(
+    ImageView<ColorRGBA> view, const std::vector<std::vector<int>>& kernel, int divisor,
+    BorderMode border, ColorRGBA border_color) {
+    applyKernelView(view, kernel, divisor, {border, border_color});
+}
+
+void applyKernelScalar(
+    UncompressedImage& img, const std::vector<std::vector<int>>& kernel, int divisor,
+    BorderMode border, ColorRGB border_color) {
+    applyKernelView(img.image_data.view(), kernel, divisor, {border, border_color}, true);
+}
+
+void applyKernelScalar(
+    UncompressedImageRGBA& img, const std::vector<std::vector<int>>& kernel, int divisor,
+    BorderMode border, ColorRGBA border_color) {
+    applyKernelView(img.image_data.view(), kernel, divisor, {border, border_color}, true);
+}
+
+void applyKernelFft(
+    UncompressedImage& img, const std::vector<std::vector<int>>& kernel, int divisor,
+    BorderMode border, ColorRGB border_color) {
+    if (!fitsFftKernel(kernel)) {
+        throw std::invalid_argument("Kernel is empty or too large for the FFT");
+    }
+    applyKernelFftView(img.image_data.view(), kernel, divisor, {border, border_color});
+}
+
+void applyKernelFft(
+    UncompressedImageRGBA& img, const std::vector<std::vector<int>>& kernel, int divisor,
+    BorderMode border, ColorRGBA border_color) {
+    if (!fitsFftKernel(kernel)) {
+        throw std::invalid_argument("Kernel is empty or too large for the FFT");
+    }
+    applyKernelFftView(img.image_data.view(), kernel, divisor, {border, border_color});
+}
 
-void sharpen(UncompressedImage& img) {
+void applySeparableKernel(
+    UncompressedImage& img, const std::vector<int>& horizontal, const std::vector<int>& vertical,
+    int divisor) {
+    applySeparableKernelView(img.image_data.view(), horizontal, vertical, divisor);
 }
 
+void applySeparableKernel(
+    UncompressedImageRGBA& img, const std::vector<int>& horizontal,
+    const std::vector<int>& vertical, int divisor) {
+    applySeparableKernelView(img.image_data.view(), horizontal, vertical, divisor);
+}
+
+void applySeparableKernel(
+    ImageView<ColorRGB> view, const std::vector<int>& horizontal, const std::vector<int>& vertical,
+    int divisor) {
+    applySeparableKernelView(view, horizontal, vertical, divisor);
+}
+
+void applySeparableKernel(
+    ImageView<ColorRGBA> view, const std::vector<int>& horizontal,
+    const std::vector<int>& vertical, int divisor) {
+    applySeparableKernelView(view, horizontal, vertical, divisor);
+}
+
+void sharpen(UncompressedImage& img) { sharpenView(img.image_data.view()); }
+void sharpen(UncompressedImageRGBA& img) { sharpenView(img.image_data.view()); }
+void sharpen(ImageView<ColorRGB> view) { sharpenView(view); }
+void sharpen(ImageView<ColorRGBA> view) { sharpenView(view); }
+
 void gaussianBlurApprox(UncompressedImage& img, bool hard_blur) {
+    gaussianBlurApproxView(img.image_data.view(), hard_blur);
+}
+
+void gaussianBlurApprox(UncompressedImageRGBA& img, bool hard_blur) {
+    gaussianBlurApproxView(img.image_data.view(), hard_blur);
+}
+
+void gaussianBlurApprox(ImageView<ColorRGB> view, bool hard_blur) {
+    gaussianBlurApproxView(view, hard_blur);
+}
+
+void gaussianBlurApprox(ImageView<ColorRGBA> view, bool hard_blur) {
+    gaussianBlurApproxView(view, hard_blur);
+}
+
+void edgeDetect(UncompressedImage& img) { edgeDetectView(img.image_data.view()); }
+void edgeDetect(UncompressedImageRGBA& img) { edgeDetectView(img.image_data.view()); }
+void edgeDetect(ImageView<ColorRGB> view) { edgeDetectView(view); }
+void edgeDetect(ImageView<ColorRGBA> view) { edgeDetectView(view); }
+
+void boxBlur(UncompressedImage& img, uint32_t radius) {
+    boxBlurView(img.image_data.view(), radius);
+}
+void boxBlur(UncompressedImageRGBA& img, uint32_t radius) {
+    boxBlurView(img.image_data.view(), radius);
+}
+void boxBlur(ImageView<ColorRGB> view, uint32_t radius) { boxBlurView(view, radius); }
+void boxBlur(ImageView<ColorRGBA> view, uint32_t radius) { boxBlurView(view, radius); }
+
+void gaussianBlur(UncompressedImage& img, double sigma, int passes) {
+    gaussianBlurView(img.image_data.view(), sigma, passes);
+}
+void gaussianBlur(UncompressedImageRGBA& img, double sigma, int passes) {
+    gaussianBlurView(img.image_data.view(), sigma, passes);
+}
+void gaussianBlur(ImageView<ColorRGB> view, double sigma, int passes) {
+    gaussianBlurView(view, sigma, passes);
+}
+void gaussianBlur(ImageView<ColorRGBA> view, double sigma, int passes) {
+    gaussianBlurView(view, sigma, passes);
+}
+
+ImageBuffer<uint8_t> edgeMap(
+    const UncompressedImage& img, const EdgeMapOptions& options, ImageBuffer<uint8_t>* direction) {
+    return edgeMapBuffer<ColorRGB>(img.image_data.view(), options, direction);
 }
 
-void edgeDetect(UncompressedImage& img) {
+ImageBuffer<uint8_t> edgeMap(
+    const UncompressedImageRGBA& img, const EdgeMapOptions& options,
+    ImageBuffer<uint8_t>* direction) {
+    return edgeMapBuffer<ColorRGBA>(img.image_data.view(), options, direction);
 }
 
-void negative(UncompressedImage& img) {
+ImageBuffer<uint8_t> edgeMap(
+    ConstImageView<ColorRGB> view, const EdgeMapOptions& options, ImageBuffer<uint8_t>* direction) {
+    return edgeMapBuffer(view, options, direction);
+}
+
+ImageBuffer<uint8_t> edgeMap(
+    ConstImageView<ColorRGBA> view, const EdgeMapOptions& options,
+    ImageBuffer<uint8_t>* direction) {
+    return edgeMapBuffer(view, options, direction);
+}
+
+void negative(UncompressedImage& img) { negative(img.image_data.view()); }
+
+void negative(UncompressedImageRGBA& img) { negative(img.image_data.view()); }
+
+void negative(ImageView<ColorRGB> view) {
     // change the color of each id to its negative
     // negative of a color is 255 - color for each channel
-    for (long long y = 0; y < img.height; ++y) {
-        for (long long x = 0; x < img.width; ++x) {
-            ColorRGB& pixel = img.image_data[y][x];
+    for (long long y = 0; y < view.height(); ++y) {
+        for (ColorRGB& pixel : view[y]) {
+            pixel.r = 255 - pixel.r;
+            pixel.g = 255 - pixel.g;
+            pixel.b = 255 - pixel.b;
+        }
+    }
+}
+
+void negative(ImageView<ColorRGBA> view) {
+    for (long long y = 0; y < view.height(); ++y) {
+        std::span<ColorRGBA> row = view[y];
+#ifdef IMAGE_TRANSFORMS_X86
+        if (cpuHasAvx2()) {
+            negativeRowRgbaAvx2(row.data(), row.size());
+            continue;
+        }
+#endif
+        for (ColorRGBA& pixel : row) {
             pixel.r = 255 - pixel.r;
             pixel.g = 255 - pixel.g;
             pixel.b = 255 - pixel.b;
@@ -51,15 +2670,143 @@ void negative(UncompressedImage& img) {
 }
 
 void negative(CompressedImage& img) {
+    // negative is a bijection on colors, so only the pallette has to be changed
+    img.color_to_id.clear();
+    for (auto& [id, color] : img.id_to_color) {
+        color = {
+            static_cast<uint8_t>(255 - color.r),
+            static_cast<uint8_t>(255 - color.g),
+            static_cast<uint8_t>(255 - color.b)};
+        img.color_to_id[color] = id;
+    }
 }
 
 void toGrayscale(UncompressedImage& img) {
     // convert the image to grayscale
     // so, for each pixel, change its color to grayscale
     // if it is already grayscale, do nothing
+    if (img.is_grayscale) {
+        return;
+    }
+    toGrayscale(img.image_data.view());
+    img.is_grayscale = true;
+}
+
+void toGrayscale(UncompressedImageRGBA& img) {
+    if (img.is_grayscale) {
+        return;
+    }
+    toGrayscale(img.image_data.view());
+    img.is_grayscale = true;
+}
+
+void toGrayscale(ImageView<ColorRGB> view) {
+    for (long long y = 0; y < view.height(); ++y) {
+        for (ColorRGB& pixel : view[y]) {
+            uint8_t gray = colorToGrayscale(pixel);
+            pixel = {gray, gray, gray};
+        }
+    }
+}
+
+void toGrayscale(ImageView<ColorRGBA> view) {
+    for (long long y = 0; y < view.height(); ++y) {
+        std::span<ColorRGBA> row = view[y];
+#ifdef IMAGE_TRANSFORMS_X86
+        if (cpuHasAvx2()) {
+            grayscaleRowRgbaAvx2(row.data(), row.size());
+            continue;
+        }
+#endif
+        for (ColorRGBA& pixel : row) {
+            uint8_t gray = colorToGrayscale(pixel);
+            pixel = {gray, gray, gray, pixel.a};
+        }
+    }
 }
 
 void toGrayscale(CompressedImage& img) {
     // convert the image to grayscale
     // so, for each id, change its color to grayscale
-}
\ No newline at end of file
+
+    // several colors may turn into the same gray, such ids are merged into one,
+    // and the pixels are remapped in a single pass over the id plane
+    uint8_t remap[256];
+    std::iota(std::begin(remap), std::end(remap), 0);
+    bool needs_remap = false;
+    std::map<uint8_t, ColorRGB> id_to_gray;
+    img.color_to_id.clear();
+    for (const auto& [id, color] : img.id_to_color) {
+        uint8_t gray = colorToGrayscale(color);
+        auto [it, inserted] = img.color_to_id.emplace(ColorRGB{gray, gray, gray}, id);
+        if (inserted) {
+            id_to_gray.emplace(id, it->first);
+        }
+        remap[id] = it->second;
+        needs_remap |= !inserted;
+    }
+    img.id_to_color.swap(id_to_gray);
+
+    if (!needs_remap) {
+        return;
+    }
+    for (uint32_t y = 0; y < img.height; ++y) {
+        for (uint8_t& id : img.image_data[y]) {
+            id = remap[id];
+        }
+    }
+}
+FilterChain& FilterChain::addKernel(const std::vector<std::vector<int>>& kernel, int divisor) {
+    // an empty kernel leaves the image as it is, like the identity
+    if (kernel.empty() || kernel.front().empty() || isIdentityKernel(kernel, divisor)) {
+        return *this;
+    }
+    stages_.push_back({Stage::Type::Kernel, kernel, divisor});
+    return *this;
+}
+
+FilterChain& FilterChain::addSharpen() { return addKernel(kernelRows(kSharpenKernel)); }
+
+FilterChain& FilterChain::addGaussianBlurApprox(bool hard_blur) {
+    if (hard_blur) {
+        return addKernel(kernelRows(kHardBlurKernel), 256);
+    }
+    return addKernel(kernelRows(kBlurKernel), 16);
+}
+
+FilterChain& FilterChain::addEdgeDetect() { return addKernel(kernelRows(kEdgeDetectKernel)); }
+
+FilterChain& FilterChain::addNegative() {
+    if (!stages_.empty() && stages_.back().type == Stage::Type::Negative) {
+        stages_.pop_back();
+        return *this;
+    }
+    stages_.push_back({Stage::Type::Negative, {}, 1});
+    return *this;
+}
+
+FilterChain& FilterChain::addToGrayscale() {
+    // the kernels and the negative treat the channels alike, a gray image stays gray
+    if (!hasGrayscale()) {
+        stages_.push_back({Stage::Type::Grayscale, {}, 1});
+    }
+    return *this;
+}
+
+bool FilterChain::hasGrayscale() const {
+    return std::ranges::any_of(
+        stages_, [](const Stage& stage) { return stage.type == Stage::Type::Grayscale; });
+}
+
+void FilterChain::apply(UncompressedImage& img) const {
+    applyFilterChainView(img.image_data.view(), stages_);
+    img.is_grayscale = img.is_grayscale || hasGrayscale();
+}
+
+void FilterChain::apply(UncompressedImageRGBA& img) const {
+    applyFilterChainView(img.image_data.view(), stages_);
+    img.is_grayscale = img.is_grayscale || hasGrayscale();
+}
+
+void FilterChain::apply(ImageView<ColorRGB> view) const { applyFilterChainView(view, stages_); }
+void FilterChain::apply(ImageView<ColorRGBA> view) const { applyFilterChainView(view, stages_); }
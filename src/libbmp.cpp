@@ -2,6 +2,13 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <utility>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 BMP::BMP(int width, int height, bool has_alpha) {
     if (width <= 0 || height <= 0) {
@@ -27,6 +34,28 @@ BMP::BMP(int width, int height, bool has_alpha) {
     }
 }
 
+BMP::BMP(int width, int height, const std::vector<BMPColorTableEntry>& color_table) :
+    color_table(color_table) {
+    if (width <= 0 || height <= 0) {
+        throw std::runtime_error("The image width and height must be positive numbers.");
+    }
+    if (color_table.empty() || color_table.size() > 256) {
+        throw std::runtime_error("The color table must have from 1 to 256 entries.");
+    }
+
+    bmp_info_header.width = width;
+    bmp_info_header.height = height;
+    bmp_info_header.bit_count = 8;
+    bmp_info_header.size = sizeof(BMPInfoHeader);
+    bmp_info_header.colors_used = color_table.size();
+    file_header.offset_data = sizeof(BMPHeader) + sizeof(BMPInfoHeader)
+                              + color_table.size() * sizeof(BMPColorTableEntry);
+
+    row_stride = width;
+    data.resize(row_stride * height);
+    file_header.file_size = file_header.offset_data + make_stride_aligned(4) * height;
+}
+
 BMP::BMP(const char* fname) { read(fname); }
 
 void BMP::read(const char* fname) {
@@ -50,6 +79,18 @@ void BMP::read(const char* fname) {
             }
         }
 
+        // The color table of an indexed image follows the info header, whatever its size is
+        if (bmp_info_header.bit_count == 8) {
+            uint32_t colors_used =
+                bmp_info_header.colors_used == 0 ? 256 : bmp_info_header.colors_used;
+            if (colors_used > 256) {
+                throw std::runtime_error("Error! Unrecognized file format.");
+            }
+            color_table.resize(colors_used);
+            inp.seekg(sizeof(BMPHeader) + bmp_info_header.size, inp.beg);
+            inp.read((char*)color_table.data(), colors_used * sizeof(BMPColorTableEntry));
+        }
+
         // Jump to the pixel data location
         inp.seekg(file_header.offset_data, inp.beg);
 
@@ -62,15 +103,17 @@ void BMP::read(const char* fname) {
         } else {
             bmp_info_header.size = sizeof(BMPInfoHeader);
             file_header.offset_data = sizeof(BMPHeader) + sizeof(BMPInfoHeader);
+            if (bmp_info_header.bit_count == 8) {
+                bmp_info_header.colors_used = color_table.size();
+                file_header.offset_data += color_table.size() * sizeof(BMPColorTableEntry);
+            }
         }
         file_header.file_size = file_header.offset_data;
 
-        if (bmp_info_header.height < 0) {
-            throw std::runtime_error(
-                "The program can treat only BMP images with the origin in the bottom left corner!");
-        }
-
-        data.resize(bmp_info_header.width * bmp_info_header.height * bmp_info_header.bit_count / 8);
+        // Rows are kept in the file order, a top-down image (negative height) is walked
+        // bottom row first by row_data, so there is no flipping here
+        const int height = get_height();
+        data.resize(bmp_info_header.width * height * bmp_info_header.bit_count / 8);
 
         // Here we check if we need to take into account row padding
         if (bmp_info_header.width % 4 == 0) {
@@ -81,11 +124,11 @@ void BMP::read(const char* fname) {
             uint32_t new_stride = make_stride_aligned(4);
             std::vector<uint8_t> padding_row(new_stride - row_stride);
 
-            for (int y = 0; y < bmp_info_header.height; ++y) {
+            for (int y = 0; y < height; ++y) {
                 inp.read((char*)(data.data() + row_stride * y), row_stride);
                 inp.read((char*)padding_row.data(), padding_row.size());
             }
-            file_header.file_size += data.size() + bmp_info_header.height * padding_row.size();
+            file_header.file_size += data.size() + height * padding_row.size();
         }
     } else {
         throw std::runtime_error("Unable to open the input image file.");
@@ -97,7 +140,7 @@ void BMP::write(const char* fname) {
     if (of) {
         if (bmp_info_header.bit_count == 32) {
             write_headers_and_data(of);
-        } else if (bmp_info_header.bit_count == 24) {
+        } else if (bmp_info_header.bit_count == 24 || bmp_info_header.bit_count == 8) {
             if (bmp_info_header.width % 4 == 0) {
                 write_headers_and_data(of);
             } else {
@@ -106,14 +149,16 @@ void BMP::write(const char* fname) {
 
                 write_headers(of);
 
-                for (int y = 0; y < bmp_info_header.height; ++y) {
+                // rows are written in the order they are stored (the header keeps the
+                // sign of the height)
+                for (int y = 0; y < get_height(); ++y) {
                     of.write((const char*)(data.data() + row_stride * y), row_stride);
                     of.write((const char*)padding_row.data(), padding_row.size());
                 }
             }
         } else {
             throw std::runtime_error(
-                "The program can treat only 24 or 32 bits per pixel BMP files");
+                "The program can treat only 8, 24 or 32 bits per pixel BMP files");
         }
     } else {
         throw std::runtime_error("Unable to open the output image file.");
@@ -125,6 +170,9 @@ void BMP::write_headers(std::ofstream& of) {
     of.write((const char*)&bmp_info_header, sizeof(bmp_info_header));
     if (bmp_info_header.bit_count == 32) {
         of.write((const char*)&bmp_color_header, sizeof(bmp_color_header));
+    } else if (bmp_info_header.bit_count == 8) {
+        of.write(
+            (const char*)color_table.data(), color_table.size() * sizeof(BMPColorTableEntry));
     }
 }
 
@@ -133,6 +181,12 @@ void BMP::write_headers_and_data(std::ofstream& of) {
     of.write((const char*)data.data(), data.size());
 }
 
+void BMP::throw_if_indexed() const {
+    if (bmp_info_header.bit_count == 8) {
+        throw std::runtime_error("The pixels of an indexed BMP are color table indices.");
+    }
+}
+
 uint32_t BMP::make_stride_aligned(uint32_t align_stride) {
     uint32_t new_stride = row_stride;
     while (new_stride % align_stride != 0) {
@@ -143,44 +197,223 @@ uint32_t BMP::make_stride_aligned(uint32_t align_stride) {
 
 void BMP::set_pixel(int32_t x, int32_t y, uint8_t r, uint8_t g, uint8_t b) {
     // y = bmp_info_header.height - 1 - y;
-    uint32_t channels = bmp_info_header.bit_count / 8;
-    uint32_t index = (y * bmp_info_header.width + x) * channels;
-    data[index] = b;
-    data[index + 1] = g;
-    data[index + 2] = r;
+    throw_if_indexed();
+    uint8_t* pixel = row_data(y) + x * get_channels();
+    pixel[0] = b;
+    pixel[1] = g;
+    pixel[2] = r;
 }
 
 void BMP::set_pixel(int x, int y, uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
     // y = bmp_info_header.height - 1 - y;
-    uint32_t channels = bmp_info_header.bit_count / 8;
-    uint32_t index = (y * bmp_info_header.width + x) * channels;
-    data[index] = b;
-    data[index + 1] = g;
-    data[index + 2] = r;
+    throw_if_indexed();
+    uint32_t channels = get_channels();
+    uint8_t* pixel = row_data(y) + x * channels;
+    pixel[0] = b;
+    pixel[1] = g;
+    pixel[2] = r;
     if (channels == 4) {
-        data[index + 3] = a;
+        pixel[3] = a;
     }
 }
 
 void BMP::get_pixel(int x, int y, uint8_t& r, uint8_t& g, uint8_t& b) const {
-    uint32_t channels = bmp_info_header.bit_count / 8;
-    uint32_t index = (y * bmp_info_header.width + x) * channels;
-    b = data[index];
-    g = data[index + 1];
-    r = data[index + 2];
+    if (bmp_info_header.bit_count == 8) {
+        const uint8_t index = row_data(y)[x];
+        if (index >= color_table.size()) {
+            throw std::runtime_error("Error! The BMP pixel is out of its color table.");
+        }
+        const BMPColorTableEntry& color = color_table[index];
+        r = color.red;
+        g = color.green;
+        b = color.blue;
+        return;
+    }
+    const uint8_t* pixel = row_data(y) + x * get_channels();
+    b = pixel[0];
+    g = pixel[1];
+    r = pixel[2];
 }
 
 void BMP::get_pixel(int x, int y, uint8_t& r, uint8_t& g, uint8_t& b, uint8_t& a) const {
-    uint32_t channels = bmp_info_header.bit_count / 8;
-    uint32_t index = (y * bmp_info_header.width + x) * channels;
-    b = data[index];
-    g = data[index + 1];
-    r = data[index + 2];
+    throw_if_indexed();
+    uint32_t channels = get_channels();
+    const uint8_t* pixel = row_data(y) + x * channels;
+    b = pixel[0];
+    g = pixel[1];
+    r = pixel[2];
     if (channels == 4) {
-        a = data[index + 3];
+        a = pixel[3];
     }
 }
 
 int BMP::get_width() const { return bmp_info_header.width; }
 
-int BMP::get_height() const { return bmp_info_header.height; }
\ No newline at end of file
+int BMP::get_height() const { return std::abs(bmp_info_header.height); }
+
+bool BMP::is_top_down() const { return bmp_info_header.height < 0; }
+
+uint32_t BMP::get_channels() const { return bmp_info_header.bit_count / 8; }
+
+const std::vector<BMPColorTableEntry>& BMP::get_color_table() const { return color_table; }
+
+uint8_t* BMP::row_data(int y) {
+    return const_cast<uint8_t*>(std::as_const(*this).row_data(y));
+}
+
+const uint8_t* BMP::row_data(int y) const {
+    // the bottom row of a top-down image is the last one in memory, rows go up from there
+    ptrdiff_t stride = static_cast<ptrdiff_t>(bmp_info_header.width) * get_channels();
+    const uint8_t* bottom_row = data.data();
+    if (is_top_down()) {
+        bottom_row += (get_height() - 1) * stride;
+        stride = -stride;
+    }
+    return bottom_row + y * stride;
+}
+
+MappedBMP::MappedBMP(const char* fname) {
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open the input image file.");
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size < 0) {
+        close(fd);
+        throw std::runtime_error("Unable to open the input image file.");
+    }
+    mapping_size = file_stat.st_size;
+    if (mapping_size < sizeof(BMPHeader) + sizeof(BMPInfoHeader)) {
+        close(fd);
+        throw std::runtime_error("Error! Unrecognized file format.");
+    }
+
+    void* address = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // the mapping stays valid after the descriptor is closed
+    if (address == MAP_FAILED) {
+        throw std::runtime_error("Unable to map the input image file.");
+    }
+    mapping = static_cast<const uint8_t*>(address);
+    // pixels are usually touched once, front to back
+    madvise(address, mapping_size, MADV_SEQUENTIAL);
+
+    // the headers are packed, so they can be used right from the mapping
+    file_header = reinterpret_cast<const BMPHeader*>(mapping);
+    bmp_info_header = reinterpret_cast<const BMPInfoHeader*>(mapping + sizeof(BMPHeader));
+
+    if (file_header->file_type != 0x4D42) {
+        unmap();
+        throw std::runtime_error("Error! Unrecognized file format.");
+    }
+    if (bmp_info_header->bit_count != 8 && bmp_info_header->bit_count != 24
+        && bmp_info_header->bit_count != 32) {
+        unmap();
+        throw std::runtime_error(
+            "The program can treat only 8, 24 or 32 bits per pixel BMP files");
+    }
+    if (bmp_info_header->width <= 0 || bmp_info_header->height == INT32_MIN) {
+        unmap();
+        throw std::runtime_error("The image width and height must be positive numbers.");
+    }
+
+    if (bmp_info_header->bit_count == 8) {
+        // the color table follows the info header, whatever its size is
+        const uint32_t colors_used =
+            bmp_info_header->colors_used == 0 ? 256 : bmp_info_header->colors_used;
+        size_t table_offset = sizeof(BMPHeader) + static_cast<size_t>(bmp_info_header->size);
+        if (colors_used > 256 || table_offset > mapping_size
+            || colors_used * sizeof(BMPColorTableEntry) > mapping_size - table_offset) {
+            unmap();
+            throw std::runtime_error("Error! The BMP color table is invalid.");
+        }
+        view.color_table = reinterpret_cast<const BMPColorTableEntry*>(mapping + table_offset);
+        view.colors_used = colors_used;
+    }
+
+    view.width = bmp_info_header->width;
+    view.height = std::abs(bmp_info_header->height);
+    view.channels = bmp_info_header->bit_count / 8;
+    // rows in the file are padded to 4 bytes
+    const ptrdiff_t row_size =
+        (static_cast<ptrdiff_t>(view.width) * view.channels + 3) & ~ptrdiff_t(3);
+
+    size_t pixels_size = static_cast<size_t>(row_size) * view.height;
+    if (file_header->offset_data > mapping_size
+        || pixels_size > mapping_size - file_header->offset_data) {
+        unmap();
+        throw std::runtime_error("Error! The BMP file is truncated.");
+    }
+
+    // rows of a top-down image (negative height) are walked from the last one in the file
+    // with a negative stride, so row 0 is the bottom row either way and nothing is copied
+    view.data = mapping + file_header->offset_data;
+    view.stride = row_size;
+    if (bmp_info_header->height < 0 && view.height > 0) {
+        view.data += (view.height - 1) * row_size;
+        view.stride = -row_size;
+    }
+}
+
+MappedBMP::~MappedBMP() { unmap(); }
+
+MappedBMP::MappedBMP(MappedBMP&& other) noexcept :
+    mapping(std::exchange(other.mapping, nullptr)),
+    mapping_size(std::exchange(other.mapping_size, 0)),
+    file_header(std::exchange(other.file_header, nullptr)),
+    bmp_info_header(std::exchange(other.bmp_info_header, nullptr)),
+    view(std::exchange(other.view, {})) {}
+
+MappedBMP& MappedBMP::operator=(MappedBMP&& other) noexcept {
+    if (this != &other) {
+        unmap();
+        mapping = std::exchange(other.mapping, nullptr);
+        mapping_size = std::exchange(other.mapping_size, 0);
+        file_header = std::exchange(other.file_header, nullptr);
+        bmp_info_header = std::exchange(other.bmp_info_header, nullptr);
+        view = std::exchange(other.view, {});
+    }
+    return *this;
+}
+
+void MappedBMP::unmap() {
+    if (mapping != nullptr) {
+        munmap(const_cast<uint8_t*>(mapping), mapping_size);
+        mapping = nullptr;
+    }
+}
+
+int MappedBMP::get_width() const { return view.width; }
+
+int MappedBMP::get_height() const { return view.height; }
+
+uint32_t MappedBMP::get_channels() const { return view.channels; }
+
+ptrdiff_t MappedBMP::get_row_stride() const { return view.stride; }
+
+bool MappedBMP::is_top_down() const { return view.stride < 0; }
+
+const BMPColorTableEntry* MappedBMP::get_color_table() const { return view.color_table; }
+
+uint32_t MappedBMP::get_colors_used() const { return view.colors_used; }
+
+const uint8_t* MappedBMP::row_data(int y) const { return view.row(y); }
+
+BMPPixelView MappedBMP::pixels() const { return view; }
+
+void MappedBMP::get_pixel(int x, int y, uint8_t& r, uint8_t& g, uint8_t& b) const {
+    if (view.color_table != nullptr) {
+        const uint8_t index = view.row(y)[x];
+        if (index >= view.colors_used) {
+            throw std::runtime_error("Error! The BMP pixel is out of its color table.");
+        }
+        const BMPColorTableEntry& color = view.color_table[index];
+        r = color.red;
+        g = color.green;
+        b = color.blue;
+        return;
+    }
+    const uint8_t* pixel = view.row(y) + x * view.channels;
+    b = pixel[0];
+    g = pixel[1];
+    r = pixel[2];
+}
@@ -0,0 +1,387 @@
+#include "pixel_convert.h"
+#include "cpu_features.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXEL_CONVERT_X86 1
+#endif
+
+/*
+ * BMP stores pixels as B, G, R (and A for 32 bit images), while ColorRGB is R, G, B.
+ * ColorRGB is a packed 3 byte struct, so a row of ColorRGB is a plain byte array and
+ * the conversion is a byte shuffle.
+ *
+ * Vectorized versions process a fixed number of pixels per iteration with unaligned loads and
+ * stores. Some of them load or store a few bytes past the pixels they convert (those bytes are
+ * rewritten by the next iteration), so the main loops stop early enough to stay inside the rows,
+ * and the remaining pixels are converted by the scalar code.
+ */
+
+void bgrToRgbRowScalar(const uint8_t* src, ColorRGB* dst, size_t count, uint32_t channels) {
+    for (size_t i = 0; i < count; ++i, src += channels) {
+        dst[i] = {src[2], src[1], src[0]};
+    }
+}
+
+void rgbToBgrRowScalar(const ColorRGB* src, uint8_t* dst, size_t count, uint32_t channels) {
+    // alpha channel (if any) is set to fully opaque
+    for (size_t i = 0; i < count; ++i, dst += channels) {
+        dst[0] = src[i].b;
+        dst[1] = src[i].g;
+        dst[2] = src[i].r;
+        if (channels == 4) {
+            dst[3] = 255;
+        }
+    }
+}
+
+void rgbToRgbaRowScalar(const ColorRGB* src, ColorRGBA* dst, size_t count, uint8_t alpha) {
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = {src[i].r, src[i].g, src[i].b, alpha};
+    }
+}
+
+void rgbaToRgbRowScalar(const ColorRGBA* src, ColorRGB* dst, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = {src[i].r, src[i].g, src[i].b};
+    }
+}
+
+void bgrToRgbaRowScalar(const uint8_t* src, ColorRGBA* dst, size_t count, uint32_t channels) {
+    for (size_t i = 0; i < count; ++i, src += channels) {
+        dst[i] = {src[2], src[1], src[0], channels == 4 ? src[3] : uint8_t(255)};
+    }
+}
+
+void rgbaToBgraRowScalar(const ColorRGBA* src, uint8_t* dst, size_t count) {
+    for (size_t i = 0; i < count; ++i, dst += 4) {
+        dst[0] = src[i].b;
+        dst[1] = src[i].g;
+        dst[2] = src[i].r;
+        dst[3] = src[i].a;
+    }
+}
+
+#ifdef PIXEL_CONVERT_X86
+
+namespace {
+
+// swaps bytes 0 and 2 of every 3 byte pixel, for 5 pixels in a 16 byte register
+// (the last byte is left as is)
+const __m128i kSwap3x5 = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+// the same for 4 pixels, the upper 4 bytes are zeroed
+const __m128i kSwap3x4 = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, -1, -1, -1, -1);
+// 4 pixels of B, G, R, A -> 4 pixels of R, G, B, the upper 4 bytes are zeroed
+const __m128i kPack4To3 = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+// 4 pixels of R, G, B -> 4 pixels of B, G, R, 0
+const __m128i kUnpack3To4 = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+const __m128i kOpaqueAlpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+
+__attribute__((target("ssse3"))) void swapRedBlueSsse3(
+    const uint8_t* src, uint8_t* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 6 <= count; i += 5) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * i));
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(dst + 3 * i), _mm_shuffle_epi8(pixels, kSwap3x5));
+    }
+    bgrToRgbRowScalar(src + 3 * i, reinterpret_cast<ColorRGB*>(dst + 3 * i), count - i, 3);
+}
+
+__attribute__((target("ssse3"))) void bgraToRgbRowSsse3(
+    const uint8_t* src, ColorRGB* dst, size_t count) {
+    uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+    size_t i = 0;
+    for (; i + 6 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * i));
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(out + 3 * i), _mm_shuffle_epi8(pixels, kPack4To3));
+    }
+    bgrToRgbRowScalar(src + 4 * i, dst + i, count - i, 4);
+}
+
+__attribute__((target("ssse3"))) void rgbToBgraRowSsse3(
+    const ColorRGB* src, uint8_t* dst, size_t count) {
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+    size_t i = 0;
+    for (; i + 6 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 3 * i));
+        pixels = _mm_or_si128(_mm_shuffle_epi8(pixels, kUnpack3To4), kOpaqueAlpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * i), pixels);
+    }
+    rgbToBgrRowScalar(src + i, dst + 4 * i, count - i, 4);
+}
+
+// Each AVX2 iteration handles 8 pixels: 24 bytes of 3 byte pixels are spread over the two
+// 128 bit lanes (12 bytes each) with a dword permutation, since pshufb cannot cross lanes.
+
+__attribute__((target("avx2"))) __m256i loadSpread3(const uint8_t* src) {
+    const __m256i spread = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+    __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+    return _mm256_permutevar8x32_epi32(pixels, spread);
+}
+
+__attribute__((target("avx2"))) void storePacked3(uint8_t* dst, __m256i pixels) {
+    const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(dst), _mm256_permutevar8x32_epi32(pixels, pack));
+}
+
+__attribute__((target("avx2"))) void swapRedBlueAvx2(
+    const uint8_t* src, uint8_t* dst, size_t count) {
+    const __m256i swap = _mm256_broadcastsi128_si256(kSwap3x4);
+    size_t i = 0;
+    for (; i + 11 <= count; i += 8) {
+        storePacked3(dst + 3 * i, _mm256_shuffle_epi8(loadSpread3(src + 3 * i), swap));
+    }
+    swapRedBlueSsse3(src + 3 * i, dst + 3 * i, count - i);
+}
+
+__attribute__((target("avx2"))) void bgraToRgbRowAvx2(
+    const uint8_t* src, ColorRGB* dst, size_t count) {
+    const __m256i pack = _mm256_broadcastsi128_si256(kPack4To3);
+    uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+    size_t i = 0;
+    for (; i + 11 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * i));
+        storePacked3(out + 3 * i, _mm256_shuffle_epi8(pixels, pack));
+    }
+    bgraToRgbRowSsse3(src + 4 * i, dst + i, count - i);
+}
+
+__attribute__((target("avx2"))) void rgbToBgraRowAvx2(
+    const ColorRGB* src, uint8_t* dst, size_t count) {
+    const __m256i unpack = _mm256_broadcastsi128_si256(kUnpack3To4);
+    const __m256i alpha = _mm256_broadcastsi128_si256(kOpaqueAlpha);
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+    size_t i = 0;
+    for (; i + 11 <= count; i += 8) {
+        __m256i pixels = _mm256_shuffle_epi8(loadSpread3(in + 3 * i), unpack);
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i*>(dst + 4 * i), _mm256_or_si256(pixels, alpha));
+    }
+    rgbToBgraRowSsse3(src + i, dst + 4 * i, count - i);
+}
+
+/*
+ * Generic loops for the conversions between 3 and 4 byte pixels, the byte order is given by
+ * a shuffle mask of 4 pixels. They convert as many pixels as their vector loop can (with the
+ * same read and write limits as above) and return that number, the caller converts the rest.
+ */
+
+// 4 pixels of R, G, B -> 4 pixels of R, G, B, 0
+const __m128i kExpandRgb = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+// 4 pixels of R, G, B, A -> 4 pixels of R, G, B, the upper 4 bytes are zeroed
+const __m128i kPackRgba = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+// swaps bytes 0 and 2 of every 4 byte pixel
+const __m128i kSwap4 = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+__attribute__((target("ssse3"))) size_t expand3To4Ssse3(
+    const uint8_t* src, uint8_t* dst, size_t count, __m128i mask, __m128i fill) {
+    size_t i = 0;
+    for (; i + 6 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * i));
+        pixels = _mm_or_si128(_mm_shuffle_epi8(pixels, mask), fill);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * i), pixels);
+    }
+    return i;
+}
+
+__attribute__((target("ssse3"))) size_t pack4To3Ssse3(
+    const uint8_t* src, uint8_t* dst, size_t count, __m128i mask) {
+    size_t i = 0;
+    for (; i + 6 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * i));
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(dst + 3 * i), _mm_shuffle_epi8(pixels, mask));
+    }
+    return i;
+}
+
+__attribute__((target("ssse3"))) size_t shuffle4Ssse3(
+    const uint8_t* src, uint8_t* dst, size_t count, __m128i mask, __m128i fill) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * i));
+        pixels = _mm_or_si128(_mm_shuffle_epi8(pixels, mask), fill);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * i), pixels);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) size_t expand3To4Avx2(
+    const uint8_t* src, uint8_t* dst, size_t count, __m128i mask, __m128i fill) {
+    const __m256i mask256 = _mm256_broadcastsi128_si256(mask);
+    const __m256i fill256 = _mm256_broadcastsi128_si256(fill);
+    size_t i = 0;
+    for (; i + 11 <= count; i += 8) {
+        __m256i pixels = _mm256_shuffle_epi8(loadSpread3(src + 3 * i), mask256);
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i*>(dst + 4 * i), _mm256_or_si256(pixels, fill256));
+    }
+    return i + expand3To4Ssse3(src + 3 * i, dst + 4 * i, count - i, mask, fill);
+}
+
+__attribute__((target("avx2"))) size_t pack4To3Avx2(
+    const uint8_t* src, uint8_t* dst, size_t count, __m128i mask) {
+    const __m256i mask256 = _mm256_broadcastsi128_si256(mask);
+    size_t i = 0;
+    for (; i + 11 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * i));
+        storePacked3(dst + 3 * i, _mm256_shuffle_epi8(pixels, mask256));
+    }
+    return i + pack4To3Ssse3(src + 4 * i, dst + 3 * i, count - i, mask);
+}
+
+__attribute__((target("avx2"))) size_t shuffle4Avx2(
+    const uint8_t* src, uint8_t* dst, size_t count, __m128i mask, __m128i fill) {
+    const __m256i mask256 = _mm256_broadcastsi128_si256(mask);
+    const __m256i fill256 = _mm256_broadcastsi128_si256(fill);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * i));
+        pixels = _mm256_or_si256(_mm256_shuffle_epi8(pixels, mask256), fill256);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 4 * i), pixels);
+    }
+    return i + shuffle4Ssse3(src + 4 * i, dst + 4 * i, count - i, mask, fill);
+}
+
+size_t expand3To4(const void* src, void* dst, size_t count, __m128i mask, __m128i fill) {
+    auto in = static_cast<const uint8_t*>(src);
+    auto out = static_cast<uint8_t*>(dst);
+    if (cpuHasAvx2()) {
+        return expand3To4Avx2(in, out, count, mask, fill);
+    }
+    return cpuHasSsse3() ? expand3To4Ssse3(in, out, count, mask, fill) : 0;
+}
+
+size_t pack4To3(const void* src, void* dst, size_t count, __m128i mask) {
+    auto in = static_cast<const uint8_t*>(src);
+    auto out = static_cast<uint8_t*>(dst);
+    if (cpuHasAvx2()) {
+        return pack4To3Avx2(in, out, count, mask);
+    }
+    return cpuHasSsse3() ? pack4To3Ssse3(in, out, count, mask) : 0;
+}
+
+size_t shuffle4(const void* src, void* dst, size_t count, __m128i mask, __m128i fill) {
+    auto in = static_cast<const uint8_t*>(src);
+    auto out = static_cast<uint8_t*>(dst);
+    if (cpuHasAvx2()) {
+        return shuffle4Avx2(in, out, count, mask, fill);
+    }
+    return cpuHasSsse3() ? shuffle4Ssse3(in, out, count, mask, fill) : 0;
+}
+
+void bgrToRgbRowSsse3(const uint8_t* src, ColorRGB* dst, size_t count, uint32_t channels) {
+    if (channels == 3) {
+        swapRedBlueSsse3(src, reinterpret_cast<uint8_t*>(dst), count);
+    } else {
+        bgraToRgbRowSsse3(src, dst, count);
+    }
+}
+
+void bgrToRgbRowAvx2(const uint8_t* src, ColorRGB* dst, size_t count, uint32_t channels) {
+    if (channels == 3) {
+        swapRedBlueAvx2(src, reinterpret_cast<uint8_t*>(dst), count);
+    } else {
+        bgraToRgbRowAvx2(src, dst, count);
+    }
+}
+
+void rgbToBgrRowSsse3(const ColorRGB* src, uint8_t* dst, size_t count, uint32_t channels) {
+    if (channels == 3) {
+        swapRedBlueSsse3(reinterpret_cast<const uint8_t*>(src), dst, count);
+    } else {
+        rgbToBgraRowSsse3(src, dst, count);
+    }
+}
+
+void rgbToBgrRowAvx2(const ColorRGB* src, uint8_t* dst, size_t count, uint32_t channels) {
+    if (channels == 3) {
+        swapRedBlueAvx2(reinterpret_cast<const uint8_t*>(src), dst, count);
+    } else {
+        rgbToBgraRowAvx2(src, dst, count);
+    }
+}
+
+}  // namespace
+
+#endif
+
+namespace {
+
+using BgrToRgbFunc = void (*)(const uint8_t*, ColorRGB*, size_t, uint32_t);
+using RgbToBgrFunc = void (*)(const ColorRGB*, uint8_t*, size_t, uint32_t);
+
+BgrToRgbFunc selectBgrToRgb() {
+#ifdef PIXEL_CONVERT_X86
+    if (cpuHasAvx2()) {
+        return bgrToRgbRowAvx2;
+    }
+    if (cpuHasSsse3()) {
+        return bgrToRgbRowSsse3;
+    }
+#endif
+    return bgrToRgbRowScalar;
+}
+
+RgbToBgrFunc selectRgbToBgr() {
+#ifdef PIXEL_CONVERT_X86
+    if (cpuHasAvx2()) {
+        return rgbToBgrRowAvx2;
+    }
+    if (cpuHasSsse3()) {
+        return rgbToBgrRowSsse3;
+    }
+#endif
+    return rgbToBgrRowScalar;
+}
+
+}  // namespace
+
+void bgrToRgbRow(const uint8_t* src, ColorRGB* dst, size_t count, uint32_t channels) {
+    static const BgrToRgbFunc impl = selectBgrToRgb();
+    impl(src, dst, count, channels);
+}
+
+void rgbToBgrRow(const ColorRGB* src, uint8_t* dst, size_t count, uint32_t channels) {
+    static const RgbToBgrFunc impl = selectRgbToBgr();
+    impl(src, dst, count, channels);
+}
+
+void rgbToRgbaRow(const ColorRGB* src, ColorRGBA* dst, size_t count, uint8_t alpha) {
+    size_t done = 0;
+#ifdef PIXEL_CONVERT_X86
+    done = expand3To4(src, dst, count, kExpandRgb, _mm_set1_epi32(int(uint32_t(alpha) << 24)));
+#endif
+    rgbToRgbaRowScalar(src + done, dst + done, count - done, alpha);
+}
+
+void rgbaToRgbRow(const ColorRGBA* src, ColorRGB* dst, size_t count) {
+    size_t done = 0;
+#ifdef PIXEL_CONVERT_X86
+    done = pack4To3(src, dst, count, kPackRgba);
+#endif
+    rgbaToRgbRowScalar(src + done, dst + done, count - done);
+}
+
+void bgrToRgbaRow(const uint8_t* src, ColorRGBA* dst, size_t count, uint32_t channels) {
+    size_t done = 0;
+#ifdef PIXEL_CONVERT_X86
+    if (channels == 3) {
+        done = expand3To4(src, dst, count, kUnpack3To4, kOpaqueAlpha);
+    } else {
+        done = shuffle4(src, dst, count, kSwap4, _mm_setzero_si128());
+    }
+#endif
+    bgrToRgbaRowScalar(src + channels * done, dst + done, count - done, channels);
+}
+
+void rgbaToBgraRow(const ColorRGBA* src, uint8_t* dst, size_t count) {
+    size_t done = 0;
+#ifdef PIXEL_CONVERT_X86
+    done = shuffle4(src, dst, count, kSwap4, _mm_setzero_si128());
+#endif
+    rgbaToBgraRowScalar(src + done, dst + 4 * done, count - done);
+}
@@ -0,0 +1,115 @@
+#include "scratch_arena.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+namespace {
+
+constexpr size_t kPageSize = 4096;
+constexpr size_t kHugePageSize = size_t(2) << 20;
+
+size_t roundUp(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+}  // namespace
+
+ScratchArena::~ScratchArena() {
+    for (const Block& block : blocks_) {
+        freeBlock(block);
+    }
+}
+
+void ScratchArena::release() {
+    if (open_scopes_ > 0) {
+        throw std::logic_error("Scratch arena is released while its buffers are in use");
+    }
+    for (const Block& block : blocks_) {
+        freeBlock(block);
+    }
+    blocks_.clear();
+    top_ = {};
+}
+
+void* ScratchArena::allocate(size_t bytes) {
+    bytes = std::max(roundUp(bytes, kAlignment), kAlignment);
+    ++stats_.acquisitions;
+
+    for (size_t index = top_.block; index < blocks_.size(); ++index) {
+        const size_t offset = index == top_.block ? top_.offset : 0;
+        if (offset + bytes <= blocks_[index].size) {
+            top_ = {index, offset + bytes, top_.used + bytes};
+            stats_.peak_used_bytes = std::max(stats_.peak_used_bytes, top_.used);
+            return blocks_[index].data + offset;
+        }
+    }
+
+    // the arena at least doubles, so a growing batch needs only a few allocations
+    blocks_.push_back(allocateBlock(std::max(bytes, stats_.reserved_bytes)));
+    top_ = {blocks_.size() - 1, bytes, top_.used + bytes};
+    stats_.peak_used_bytes = std::max(stats_.peak_used_bytes, top_.used);
+    return blocks_.back().data;
+}
+
+void ScratchArena::leaveScope(const Mark& mark) {
+    top_ = mark;
+    --open_scopes_;
+    if (open_scopes_ > 0 || blocks_.size() <= 1) {
+        return;
+    }
+    /*
+     * The working set did not fit into one block. Now that everything is given back,
+     * the blocks are replaced with a single one that fits the largest working set seen so far.
+     */
+    const size_t total_size = stats_.peak_used_bytes;
+    for (const Block& block : blocks_) {
+        freeBlock(block);
+    }
+    blocks_.clear();
+    blocks_.push_back(allocateBlock(total_size));
+    top_ = {};
+}
+
+ScratchArena::Block ScratchArena::allocateBlock(size_t min_size) {
+    Block block;
+    block.huge_pages = use_huge_pages_ && min_size >= kHugePageSize;
+    block.size = roundUp(min_size, block.huge_pages ? kHugePageSize : kPageSize);
+
+    void* memory =
+        mmap(nullptr, block.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    if (block.huge_pages) {
+        // only a hint, the kernel falls back to regular pages if there are no huge ones
+        madvise(memory, block.size, MADV_HUGEPAGE);
+    }
+#else
+    block.huge_pages = false;
+#endif
+    block.data = static_cast<std::byte*>(memory);
+
+    ++stats_.heap_allocations;
+    stats_.reserved_bytes += block.size;
+    if (block.huge_pages) {
+        stats_.huge_page_bytes += block.size;
+    }
+    return block;
+}
+
+void ScratchArena::freeBlock(const Block& block) {
+    munmap(block.data, block.size);
+    stats_.reserved_bytes -= block.size;
+    if (block.huge_pages) {
+        stats_.huge_page_bytes -= block.size;
+    }
+}
+
+ScratchArena& threadScratchArena() {
+    thread_local ScratchArena arena;
+    return arena;
+}
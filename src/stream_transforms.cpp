@@ -0,0 +1,91 @@
+#include "stream_transforms.h"
+#include "bmp_stream.h"
+#include "image_transforms.h"
+
+#include <algorithm>
+#include <utility>
+
+void transformBMPStream(
+    const std::string& input_filename, const std::string& output_filename,
+    const std::function<void(UncompressedImage&)>& transform, uint32_t band_rows) {
+    BMPStreamReader reader(input_filename);
+    BMPStreamWriter writer(output_filename, reader.width(), reader.height());
+    band_rows = std::max(band_rows, 1u);
+
+    UncompressedImage band;
+    band.width = reader.width();
+    while (reader.rowsLeft() > 0) {
+        // only the last band may be shorter
+        uint32_t rows = std::min(band_rows, reader.rowsLeft());
+        if (band.image_data.height() != rows) {
+            band.image_data.resize(band.width, rows);
+        }
+        band.height = reader.readRows(band.image_data, 0, rows);
+        band.is_grayscale = false;
+        transform(band);
+        writer.writeRows(band.image_data, 0, band.height);
+    }
+}
+
+void negativeBMPStream(
+    const std::string& input_filename, const std::string& output_filename, uint32_t band_rows) {
+    transformBMPStream(
+        input_filename, output_filename, [](UncompressedImage& band) { negative(band); },
+        band_rows);
+}
+
+void toGrayscaleBMPStream(
+    const std::string& input_filename, const std::string& output_filename, uint32_t band_rows) {
+    transformBMPStream(
+        input_filename, output_filename, [](UncompressedImage& band) { toGrayscale(band); },
+        band_rows);
+}
+
+void applyKernelBMPStream(
+    const std::string& input_filename, const std::string& output_filename,
+    const std::vector<std::vector<int>>& kernel, int divisor, uint32_t band_rows) {
+    /*
+     * The window keeps the original rows [window_start, window_end) of the image: the rows of
+     * the current band together with halo_top rows above and halo_bottom rows below it.
+     * applyKernel clamps at the window borders, which is right, since a window border is either
+     * the image border or lies at least a halo away from every row of the band.
+     * Only the band rows of the filtered window are written, then the window slides down.
+     */
+    BMPStreamReader reader(input_filename);
+    BMPStreamWriter writer(output_filename, reader.width(), reader.height());
+
+    const uint32_t height = reader.height();
+    const uint32_t halo_top = kernel.size() / 2;
+    const uint32_t halo_bottom = kernel.empty() ? 0 : kernel.size() - 1 - halo_top;
+    band_rows = std::max(band_rows, 1u);
+
+    ImageBuffer<ColorRGB> window(
+        reader.width(), std::min(band_rows + halo_top + halo_bottom, height));
+    uint32_t window_start = 0;
+    uint32_t window_end = 0;
+
+    UncompressedImage filtered;
+    filtered.width = reader.width();
+    for (uint32_t band_start = 0; band_start < height;) {
+        const uint32_t band_end = std::min(band_start + band_rows, height);
+        const uint32_t needed_end = std::min(band_end + halo_bottom, height);
+        window_end += reader.readRows(window, window_end - window_start, needed_end - window_end);
+
+        filtered.height = window_end - window_start;
+        filtered.image_data.resize(filtered.width, filtered.height);
+        for (uint32_t y = 0; y < filtered.height; ++y) {
+            std::ranges::copy(std::as_const(window)[y], filtered.image_data[y].begin());
+        }
+        applyKernel(filtered, kernel, divisor);
+        writer.writeRows(filtered.image_data, band_start - window_start, band_end - band_start);
+
+        // keep only the rows the next band needs above it
+        const uint32_t keep_start = std::max(window_start, band_end - std::min(band_end, halo_top));
+        for (uint32_t y = keep_start; y < window_end; ++y) {
+            std::ranges::copy(
+                std::as_const(window)[y - window_start], window[y - keep_start].begin());
+        }
+        window_start = keep_start;
+        band_start = band_end;
+    }
+}
@@ -0,0 +1,144 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+namespace {
+
+// pool whose task the current thread is running, to run nested loops serially
+thread_local const ThreadPool* current_pool = nullptr;
+
+size_t resolveThreadCount(size_t threads) {
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    return std::max<size_t>(threads, 1);
+}
+
+std::unique_ptr<ThreadPool>& transformPoolStorage() {
+    static std::unique_ptr<ThreadPool> pool = std::make_unique<ThreadPool>();
+    return pool;
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool(size_t threads) {
+    threads = resolveThreadCount(threads);
+    workers_.reserve(threads - 1);
+    for (size_t i = 0; i + 1 < threads; ++i) {
+        workers_.emplace_back([this] { workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_ready_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::run(size_t count, void* context, CallFunc call) {
+    if (count == 0) {
+        return;
+    }
+    if (workers_.empty() || count == 1 || current_pool == this) {
+        for (size_t index = 0; index < count; ++index) {
+            call(context, index);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        context_ = context;
+        call_ = call;
+        count_ = count;
+        next_index_ = 0;
+        unfinished_ = count;
+        error_ = nullptr;
+        ++generation_;
+    }
+    work_ready_.notify_all();
+
+    runTasks();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    /*
+     * Every task is done once unfinished_ is 0, but a worker may still be inside runTasks()
+     * about to look for another task, so the loop is only over when all of them have left it.
+     */
+    work_done_.wait(lock, [this] { return unfinished_ == 0 && active_workers_ == 0; });
+    call_ = nullptr;
+    if (error_) {
+        std::exception_ptr error = std::exchange(error_, nullptr);
+        lock.unlock();
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::runTasks() {
+    const ThreadPool* outer_pool = std::exchange(current_pool, this);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (next_index_ < count_) {
+        const size_t index = next_index_++;
+        lock.unlock();
+        try {
+            call_(context_, index);
+        } catch (...) {
+            lock.lock();
+            if (!error_) {
+                error_ = std::current_exception();
+            }
+            lock.unlock();
+        }
+        lock.lock();
+        --unfinished_;
+    }
+    current_pool = outer_pool;
+}
+
+void ThreadPool::workerLoop() {
+    size_t seen_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_ready_.wait(lock, [&] { return stopping_ || generation_ != seen_generation; });
+            if (stopping_) {
+                return;
+            }
+            seen_generation = generation_;
+            ++active_workers_;
+        }
+        runTasks();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --active_workers_;
+        }
+        work_done_.notify_all();
+    }
+}
+
+ThreadPool& transformThreadPool() { return *transformPoolStorage(); }
+
+void setTransformThreadCount(size_t threads) {
+    std::unique_ptr<ThreadPool>& pool = transformPoolStorage();
+    if (pool->threadCount() != resolveThreadCount(threads)) {
+        pool = std::make_unique<ThreadPool>(threads);
+    }
+}
+
+size_t rowBandCount(size_t width, size_t height, size_t min_band_rows) {
+    const size_t threads = transformThreadPool().threadCount();
+    if (threads == 1) {
+        return 1;
+    }
+    min_band_rows = std::max(min_band_rows, kMinBandPixels / std::max<size_t>(width, 1));
+    const size_t max_bands = height / std::max<size_t>(min_band_rows, 1);
+    return std::max<size_t>(std::min(threads * 4, max_bands), 1);
+}
@@ -1,7 +1,10 @@
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <thread>
 
 #include "compressor_funcs.h"
 #include "image_transforms.h"
@@ -9,6 +12,12 @@
 #include "libbmp.h"
 #include "colors.h"
 #include "error_handlers.h"
+#include "fft.h"
+#include "fixed_kernel.h"
+#include "pixel_convert.h"
+#include "scratch_arena.h"
+#include "stream_transforms.h"
+#include "thread_pool.h"
 
 std::vector<uint8_t> loadFile(const std::string& filename) {
     std::ifstream file(filename, std::ios::binary);
@@ -557,7 +566,7 @@ TEST_CASE("Identity kernel filter") {
     UncompressedImage img = loadFromBMP("images/red_cross.bmp");
     UncompressedImage img_copy = img;
     applyKernel(img_copy, identity_kernel);
-    REQUIRE(matchVectors(img.image_data, img_copy.image_data));
+    REQUIRE(img.image_data == img_copy.image_data);
 
     closeLogFile();
     awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
@@ -797,3 +806,1718 @@ TEST_CASE("Conversion to compressed image and back (without color add, with appr
     closeLogFile();
     awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
 }
+
+TEST_CASE("Uncompressed image read and write") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_27.log", true);
+
+    UncompressedImage img = loadFromBMP("images/seven.bmp");
+    writeUncompressedFile("tmp_images/seven_uncompressed.img", img);
+    UncompressedImage img_copy = readUncompressedFile("tmp_images/seven_uncompressed.img");
+
+    REQUIRE(img_copy.width == img.width);
+    REQUIRE(img_copy.height == img.height);
+    REQUIRE(img_copy.image_data.width() == img.width);
+    REQUIRE(img_copy.image_data.height() == img.height);
+    REQUIRE(img_copy.image_data == img.image_data);
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Compressed image negative and grayscale conversion") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_28.log", true);
+
+    UncompressedImage img = loadFromBMP("images/seven.bmp");
+    CompressedImage comp_img = toCompressed(img);
+    REQUIRE(comp_img.image_data.stride() >= comp_img.width);
+
+    UncompressedImage img_neg = img;
+    negative(img_neg);
+    CompressedImage comp_img_neg = comp_img;
+    negative(comp_img_neg);
+    REQUIRE(toUncompressed(comp_img_neg).image_data == img_neg.image_data);
+
+    UncompressedImage img_gray = img;
+    toGrayscale(img_gray);
+    CompressedImage comp_img_gray = comp_img;
+    toGrayscale(comp_img_gray);
+    REQUIRE(comp_img_gray.id_to_color.size() == comp_img_gray.color_to_id.size());
+    REQUIRE(toUncompressed(comp_img_gray).image_data == img_gray.image_data);
+
+    for (size_t i = 0; i < img.height; ++i) {
+        for (size_t j = 0; j < img.width; ++j) {
+            REQUIRE(getColor(comp_img_gray, j, i) == img_gray.image_data[i][j]);
+        }
+    }
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Bulk BMP row conversion") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_29.log", true);
+
+    for (uint32_t channels : {3u, 4u}) {
+        for (size_t count : {0, 1, 5, 6, 11, 16, 37, 1360}) {
+            std::vector<uint8_t> bmp_row(count * channels);
+            for (size_t i = 0; i < bmp_row.size(); ++i) {
+                bmp_row[i] = static_cast<uint8_t>(i * 37 + count);
+            }
+
+            std::vector<ColorRGB> expected(count), converted(count);
+            bgrToRgbRowScalar(bmp_row.data(), expected.data(), count, channels);
+            bgrToRgbRow(bmp_row.data(), converted.data(), count, channels);
+            REQUIRE(converted == expected);
+
+            std::vector<uint8_t> expected_row(count * channels), converted_row(count * channels);
+            rgbToBgrRowScalar(expected.data(), expected_row.data(), count, channels);
+            rgbToBgrRow(expected.data(), converted_row.data(), count, channels);
+            REQUIRE(converted_row == expected_row);
+        }
+    }
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Memory mapped BMP read") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_30.log", true);
+
+    MappedBMP bmp("images/red_cross.bmp");
+    UncompressedImage img = loadFromBMP("images/red_cross.bmp");
+    REQUIRE(bmp.get_width() == 8);
+    REQUIRE(bmp.get_height() == 8);
+    REQUIRE(matchUncompressedImages(img, bmp.pixels()));
+
+    CompressedImage comp_img = toCompressed(img);
+    CompressedImage comp_img_mapped = toCompressed(bmp.pixels());
+    REQUIRE(comp_img_mapped.id_to_color == comp_img.id_to_color);
+    REQUIRE(comp_img_mapped.image_data == comp_img.image_data);
+
+    // odd width, so that the rows in the file are padded
+    UncompressedImage odd_img;
+    odd_img.width = 7;
+    odd_img.height = 5;
+    odd_img.image_data.resize(7, 5);
+    for (size_t i = 0; i < odd_img.height; ++i) {
+        for (size_t j = 0; j < odd_img.width; ++j) {
+            odd_img.image_data[i][j] = {uint8_t(i * 40), uint8_t(j * 30), uint8_t(i + j)};
+        }
+    }
+    saveAsBMP(odd_img, "tmp_images/odd_width.bmp");
+
+    MappedBMP odd_bmp("tmp_images/odd_width.bmp");
+    REQUIRE(odd_bmp.get_row_stride() == 24);
+    REQUIRE(matchUncompressedImages(odd_img, odd_bmp.pixels()));
+    REQUIRE(loadFromBMP("tmp_images/odd_width.bmp").image_data == odd_img.image_data);
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Streaming BMP transforms") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_31.log", true);
+
+    UncompressedImage img = loadFromBMP("images/kapibara.bmp");
+
+    negativeBMPStream("images/kapibara.bmp", "tmp_images/kapibara_negative_stream.bmp", 7);
+    REQUIRE(
+        loadFromBMP("tmp_images/kapibara_negative_stream.bmp").image_data
+        == loadFromBMP("correct_images/kapibara_negative.bmp").image_data);
+
+    toGrayscaleBMPStream("images/kapibara.bmp", "tmp_images/kapibara_grayscale_stream.bmp", 100);
+    REQUIRE(
+        loadFromBMP("tmp_images/kapibara_grayscale_stream.bmp").image_data
+        == loadFromBMP("correct_images/kapibara_grayscale.bmp").image_data);
+
+    const std::vector<std::vector<int>> blur_kernel = {
+        {1, 4, 6, 4, 1},
+        {4, 16, 24, 16, 4},
+        {6, 24, 36, 24, 6},
+        {4, 16, 24, 16, 4},
+        {1, 4, 6, 4, 1}};
+    for (uint32_t band_rows : {1u, 3u, 64u, 1000u}) {
+        applyKernelBMPStream(
+            "images/kapibara.bmp", "tmp_images/kapibara_blur_hard_stream.bmp", blur_kernel, 256,
+            band_rows);
+        REQUIRE(
+            loadFromBMP("tmp_images/kapibara_blur_hard_stream.bmp").image_data
+            == loadFromBMP("correct_images/kapibara_blur_hard.bmp").image_data);
+    }
+
+    std::map<uint8_t, ColorRGB> color_map = {
+        {0, {10, 10, 10}}, {1, {200, 10, 10}}, {7, {0, 0, 255}}};
+    compressBMPStream(
+        "images/kapibara.bmp", "tmp_images/kapibara_compressed_stream.img", color_map, 5);
+    CompressedImage comp_img = readCompressedFile("tmp_images/kapibara_compressed_stream.img");
+    CompressedImage expected_comp_img = toCompressed(img, color_map, true, false);
+    REQUIRE(comp_img.id_to_color == expected_comp_img.id_to_color);
+    REQUIRE(comp_img.image_data == expected_comp_img.image_data);
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Image views of a region") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_32.log", true);
+
+    UncompressedImage img = loadFromBMP("images/kapibara.bmp");
+    const UncompressedImage original = img;
+
+    // a view of the whole image is the image itself
+    UncompressedImage sharpened = img;
+    sharpen(sharpened.image_data.view());
+    REQUIRE(sharpened.image_data == loadFromBMP("correct_images/kapibara_sharp.bmp").image_data);
+
+    const uint32_t x0 = 301, y0 = 117, width = 250, height = 180;
+    ImageView<ColorRGB> roi = img.image_data.view(x0, y0, width, height);
+    REQUIRE(roi.stride() == static_cast<ptrdiff_t>(img.width * sizeof(ColorRGB)));
+    REQUIRE(roi[0].data() == &img.image_data[y0][x0]);
+
+    // a copy of the region filtered as a separate image
+    UncompressedImage crop;
+    crop.width = width;
+    crop.height = height;
+    crop.image_data.resize(width, height);
+    for (uint32_t y = 0; y < height; ++y) {
+        std::ranges::copy(roi[y], crop.image_data[y].begin());
+    }
+    gaussianBlurApprox(crop, true);
+    negative(crop);
+    mirror(crop, true);
+
+    gaussianBlurApprox(roi, true);
+    negative(roi);
+    mirror(roi, true);
+
+    // pixels outside of the region are untouched, the region matches the filtered copy
+    bool matches = true;
+    for (uint32_t y = 0; y < img.height; ++y) {
+        for (uint32_t x = 0; x < img.width; ++x) {
+            bool inside = x >= x0 && x < x0 + width && y >= y0 && y < y0 + height;
+            const ColorRGB& expected =
+                inside ? crop.image_data[y - y0][x - x0] : original.image_data[y][x];
+            matches = matches && img.image_data[y][x] == expected;
+        }
+    }
+    REQUIRE(matches);
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Scratch arena reuse") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_33.log", true);
+
+    ScratchArena arena;
+    {
+        ScratchScope outer(arena);
+        std::span<int> first = outer.acquire<int>(1000);
+        REQUIRE(reinterpret_cast<uintptr_t>(first.data()) % ScratchArena::kAlignment == 0);
+        {
+            // does not fit into the first block, a second one is added
+            ScratchScope inner(arena);
+            ImageView<ColorRGB> image = inner.acquireImage<ColorRGB>(1000, 1000);
+            REQUIRE(image[999].data() == image.data() + 999 * 1000);
+            REQUIRE(arena.stats().heap_allocations == 2);
+        }
+    }
+    // the blocks are merged once all the buffers are given back
+    REQUIRE(arena.stats().heap_allocations == 3);
+    {
+        ScratchScope outer(arena);
+        outer.acquire<int>(1000);
+        outer.acquireImage<ColorRGB>(1000, 1000);
+    }
+    REQUIRE(arena.stats().heap_allocations == 3);
+    REQUIRE(arena.stats().acquisitions == 4);
+    arena.release();
+    REQUIRE(arena.stats().reserved_bytes == 0);
+
+    // a batch of images of the same size allocates scratch memory only for the first one
+    const UncompressedImage original = loadFromBMP("images/kapibara.bmp");
+    size_t allocations = 0;
+    for (int i = 0; i < 3; ++i) {
+        UncompressedImage img = original;
+        sharpen(img);
+        rotate(img, 30, {0, 0, 0}, true);
+        if (i == 0) {
+            allocations = threadScratchArena().stats().heap_allocations;
+        }
+        REQUIRE(threadScratchArena().stats().heap_allocations == allocations);
+    }
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Indexed BMP read/write") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_34.log", true);
+
+    UncompressedImage img = loadFromBMP("images/kapibara.bmp");
+    std::map<uint8_t, ColorRGB> color_map = {
+        {0, {10, 10, 10}}, {1, {200, 10, 10}}, {2, {0, 0, 255}}, {3, {240, 240, 240}}};
+    CompressedImage comp_img = toCompressed(img, color_map, true, false);
+
+    saveAsIndexedBMP(comp_img, "tmp_images/kapibara_indexed.bmp");
+    CompressedImage loaded = loadFromIndexedBMP("tmp_images/kapibara_indexed.bmp");
+    REQUIRE(loaded.width == comp_img.width);
+    REQUIRE(loaded.height == comp_img.height);
+    REQUIRE(loaded.id_to_color == comp_img.id_to_color);
+    REQUIRE(loaded.color_to_id == comp_img.color_to_id);
+    REQUIRE(loaded.image_data == comp_img.image_data);
+    REQUIRE(
+        std::filesystem::file_size("tmp_images/kapibara_indexed.bmp")
+        == 54 + 4 * color_map.size() + size_t(img.width) * img.height);
+
+    // indexed files are expanded to RGB by the regular loader
+    REQUIRE(
+        loadFromBMP("tmp_images/kapibara_indexed.bmp").image_data
+        == toUncompressed(comp_img).image_data);
+    BMP bmp("tmp_images/kapibara_indexed.bmp");
+    REQUIRE(bmp.get_color_table().size() == color_map.size());
+    uint8_t r = 0, g = 0, b = 0;
+    bmp.get_pixel(5, 7, r, g, b);
+    REQUIRE(ColorRGB{r, g, b} == getColor(comp_img, 5, 7));
+
+    // rows of odd width are padded, ids missing from the pallette get black entries
+    CompressedImage odd_img;
+    odd_img.width = 7;
+    odd_img.height = 3;
+    odd_img.id_to_color = {{1, {1, 2, 3}}, {4, {250, 0, 9}}};
+    odd_img.image_data.resize(7, 3);
+    for (uint32_t y = 0; y < odd_img.height; ++y) {
+        for (uint32_t x = 0; x < odd_img.width; ++x) {
+            odd_img.image_data[y][x] = (x + y) % 2 == 0 ? 1 : 4;
+        }
+    }
+    saveAsIndexedBMP(odd_img, "tmp_images/odd_width_indexed.bmp");
+    MappedBMP odd_bmp("tmp_images/odd_width_indexed.bmp");
+    REQUIRE(odd_bmp.get_row_stride() == 8);
+    REQUIRE(odd_bmp.get_colors_used() == 5);
+    CompressedImage odd_loaded = loadFromIndexedBMP("tmp_images/odd_width_indexed.bmp");
+    REQUIRE(odd_loaded.image_data == odd_img.image_data);
+    REQUIRE(odd_loaded.id_to_color.at(4) == ColorRGB{250, 0, 9});
+    REQUIRE(odd_loaded.id_to_color.at(0) == ColorRGB{0, 0, 0});
+
+    // the pixel view of a mapped indexed file is expanded through the color table too
+    MappedBMP mapped("tmp_images/kapibara_indexed.bmp");
+    REQUIRE(mapped.pixels().channels == 1);
+    REQUIRE(matchUncompressedImages(toUncompressed(comp_img), mapped.pixels(), false));
+    REQUIRE(toCompressed(mapped.pixels(), comp_img.id_to_color).image_data == comp_img.image_data);
+    REQUIRE(matchUncompressedImages(toUncompressed(odd_img), odd_bmp.pixels(), false));
+    REQUIRE(toCompressed(odd_bmp.pixels(), odd_img.id_to_color).image_data == odd_img.image_data);
+
+    // pixels past the color table are rejected by get_pixel, the 3 byte accessors refuse
+    // indexed images
+    BMP small_bmp(2, 1, std::vector<BMPColorTableEntry>{{1, 2, 3, 0}, {4, 5, 6, 0}});
+    small_bmp.row_data(0)[1] = 7;
+    small_bmp.write("tmp_images/out_of_table_indexed.bmp");
+    small_bmp.get_pixel(0, 0, r, g, b);
+    REQUIRE(ColorRGB{r, g, b} == ColorRGB{3, 2, 1});
+    REQUIRE_THROWS(small_bmp.get_pixel(1, 0, r, g, b));
+    uint8_t a = 0;
+    REQUIRE_THROWS(small_bmp.get_pixel(0, 0, r, g, b, a));
+    REQUIRE_THROWS(small_bmp.set_pixel(0, 0, r, g, b));
+    REQUIRE_THROWS(small_bmp.set_pixel(0, 0, r, g, b, a));
+    MappedBMP out_of_table("tmp_images/out_of_table_indexed.bmp");
+    out_of_table.get_pixel(0, 0, r, g, b);
+    REQUIRE(ColorRGB{r, g, b} == ColorRGB{3, 2, 1});
+    REQUIRE_THROWS(out_of_table.get_pixel(1, 0, r, g, b));
+    REQUIRE(loadFromBMP("tmp_images/out_of_table_indexed.bmp").image_data[0][1] == ColorRGB{});
+    REQUIRE_THROWS(loadFromIndexedBMP("tmp_images/out_of_table_indexed.bmp"));
+
+    REQUIRE_THROWS(loadFromIndexedBMP("images/kapibara.bmp"));
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("RGBA images") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_35.log", true);
+
+    const UncompressedImage img = loadFromBMP("images/kapibara.bmp");
+    UncompressedImageRGBA rgba_img = toRGBA(img, 77);
+    REQUIRE(rgba_img.image_data.stride() % 8 == 0);
+    REQUIRE(reinterpret_cast<uintptr_t>(rgba_img.image_data.data()) % 32 == 0);
+    const ColorRGB& pixel = img.image_data[3][5];
+    REQUIRE(rgba_img.image_data[3][5] == ColorRGBA{pixel.r, pixel.g, pixel.b, 77});
+    REQUIRE(toRGB(rgba_img).image_data == img.image_data);
+
+    // every transform gives the same colors as on 3 byte pixels and keeps alpha
+    auto check = [&](const std::function<void(UncompressedImageRGBA&)>& transform,
+                     const std::string& expected_filename) {
+        UncompressedImageRGBA transformed = rgba_img;
+        transform(transformed);
+        bool alpha_kept = true;
+        for (uint32_t y = 0; y < transformed.height; ++y) {
+            for (const ColorRGBA& pixel : transformed.image_data[y]) {
+                alpha_kept = alpha_kept && pixel.a == 77;
+            }
+        }
+        REQUIRE(alpha_kept);
+        INFO(expected_filename);
+        REQUIRE(toRGB(transformed).image_data == loadFromBMP(expected_filename).image_data);
+    };
+    check([](UncompressedImageRGBA& im) { sharpen(im); }, "correct_images/kapibara_sharp.bmp");
+    check(
+        [](UncompressedImageRGBA& im) { gaussianBlurApprox(im); },
+        "correct_images/kapibara_blur.bmp");
+    check(
+        [](UncompressedImageRGBA& im) { gaussianBlurApprox(im, true); },
+        "correct_images/kapibara_blur_hard.bmp");
+    check(
+        [](UncompressedImageRGBA& im) { edgeDetect(im); },
+        "correct_images/kapibara_edge_detect.bmp");
+    check(
+        [](UncompressedImageRGBA& im) { negative(im); }, "correct_images/kapibara_negative.bmp");
+    check(
+        [](UncompressedImageRGBA& im) { toGrayscale(im); },
+        "correct_images/kapibara_grayscale.bmp");
+    check(
+        [](UncompressedImageRGBA& im) { mirror(im); },
+        "correct_images/kapibara_hor_flip.bmp");
+    check(
+        [](UncompressedImageRGBA& im) { rotate(im, 150, {0, 255, 0, 77}); },
+        "correct_images/rotated_images/kapibara_rotated_150.bmp");
+    check(
+        [](UncompressedImageRGBA& im) { rotate(im, 105, {0, 255, 0, 77}, true); },
+        "correct_images/rotated_images/kapibara_rotated_105_interpolated.bmp");
+
+    // unaligned regions and odd widths go through the scalar edges of the vector loops
+    UncompressedImageRGBA roi_img = rgba_img;
+    UncompressedImage expected = img;
+    for (auto [x, y, width, height] : {std::array<uint32_t, 4>{3, 5, 13, 9}, {1, 0, 101, 7}}) {
+        negative(roi_img.image_data.view(x, y, width, height));
+        toGrayscale(roi_img.image_data.view(x, y, width, height));
+        edgeDetect(roi_img.image_data.view(x, y, width, height));
+        negative(expected.image_data.view(x, y, width, height));
+        toGrayscale(expected.image_data.view(x, y, width, height));
+        edgeDetect(expected.image_data.view(x, y, width, height));
+    }
+    REQUIRE(toRGB(roi_img).image_data == expected.image_data);
+
+    // 32 bit BMP files keep the alpha channel
+    saveAsBMP(rgba_img, "tmp_images/kapibara_rgba.bmp");
+    REQUIRE(loadFromBMPAsRGBA("tmp_images/kapibara_rgba.bmp").image_data == rgba_img.image_data);
+    REQUIRE(loadFromBMP("tmp_images/kapibara_rgba.bmp").image_data == img.image_data);
+    REQUIRE(loadFromBMPAsRGBA("images/kapibara.bmp").image_data == toRGBA(img).image_data);
+
+    // the vector row conversions agree with the scalar ones at any length
+    std::vector<ColorRGB> rgb_row(37);
+    for (size_t i = 0; i < rgb_row.size(); ++i) {
+        rgb_row[i] = {uint8_t(i * 7), uint8_t(i * 13 + 1), uint8_t(255 - i)};
+    }
+    for (size_t count = 0; count <= rgb_row.size(); ++count) {
+        std::vector<ColorRGBA> fast(count), reference(count);
+        rgbToRgbaRow(rgb_row.data(), fast.data(), count, 9);
+        rgbToRgbaRowScalar(rgb_row.data(), reference.data(), count, 9);
+        REQUIRE(fast == reference);
+        std::vector<ColorRGB> back(count);
+        rgbaToRgbRow(fast.data(), back.data(), count);
+        REQUIRE(std::equal(back.begin(), back.end(), rgb_row.begin()));
+        std::vector<uint8_t> bgra(4 * count), bgra_reference(4 * count);
+        rgbaToBgraRow(fast.data(), bgra.data(), count);
+        rgbaToBgraRowScalar(fast.data(), bgra_reference.data(), count);
+        REQUIRE(bgra == bgra_reference);
+        bgrToRgbaRow(bgra.data(), fast.data(), count, 4);
+        REQUIRE(fast == reference);
+    }
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Top-down BMP read") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_36.log", true);
+
+    // the same image stored top-down: negative height and the rows in the reverse order
+    auto saveTopDown = [](const std::string& bottom_up_filename, const std::string& filename) {
+        std::ifstream input(bottom_up_filename, std::ios::binary);
+        std::vector<char> bytes(std::istreambuf_iterator<char>(input), {});
+        BMPHeader file_header;
+        BMPInfoHeader info_header;
+        std::memcpy(&file_header, bytes.data(), sizeof(file_header));
+        std::memcpy(&info_header, bytes.data() + sizeof(file_header), sizeof(info_header));
+        size_t row_size = (info_header.width * info_header.bit_count / 8 + 3) & ~size_t(3);
+        std::vector<char> flipped = bytes;
+        for (int y = 0; y < info_header.height; ++y) {
+            std::memcpy(
+                flipped.data() + file_header.offset_data + y * row_size,
+                bytes.data() + file_header.offset_data + (info_header.height - 1 - y) * row_size,
+                row_size);
+        }
+        info_header.height = -info_header.height;
+        std::memcpy(flipped.data() + sizeof(file_header), &info_header, sizeof(info_header));
+        std::ofstream(filename, std::ios::binary).write(flipped.data(), flipped.size());
+    };
+
+    UncompressedImage img = loadFromBMP("images/kapibara.bmp");
+    saveTopDown("images/kapibara.bmp", "tmp_images/kapibara_top_down.bmp");
+
+    MappedBMP mapped("tmp_images/kapibara_top_down.bmp");
+    REQUIRE(mapped.is_top_down());
+    REQUIRE(mapped.get_height() == img.height);
+    REQUIRE(mapped.get_row_stride() == -static_cast<ptrdiff_t>(img.width * 3));
+    REQUIRE(matchUncompressedImages(img, mapped.pixels()));
+    REQUIRE(loadFromBMP("tmp_images/kapibara_top_down.bmp").image_data == img.image_data);
+
+    BMP bmp("tmp_images/kapibara_top_down.bmp");
+    REQUIRE(bmp.is_top_down());
+    uint8_t r = 0, g = 0, b = 0;
+    bmp.get_pixel(17, 3, r, g, b);
+    REQUIRE(ColorRGB{r, g, b} == img.image_data[3][17]);
+    // a top-down file is written back top-down
+    bmp.write("tmp_images/kapibara_top_down_copy.bmp");
+    REQUIRE(MappedBMP("tmp_images/kapibara_top_down_copy.bmp").is_top_down());
+    REQUIRE(loadFromBMP("tmp_images/kapibara_top_down_copy.bmp").image_data == img.image_data);
+
+    // odd widths have padded rows
+    UncompressedImage odd_img;
+    odd_img.width = 7;
+    odd_img.height = 5;
+    odd_img.image_data.resize(7, 5);
+    for (uint32_t y = 0; y < odd_img.height; ++y) {
+        for (uint32_t x = 0; x < odd_img.width; ++x) {
+            odd_img.image_data[y][x] = {uint8_t(y * 40), uint8_t(x * 30), uint8_t(x + y)};
+        }
+    }
+    saveAsBMP(odd_img, "tmp_images/odd_width.bmp");
+    saveTopDown("tmp_images/odd_width.bmp", "tmp_images/odd_width_top_down.bmp");
+    REQUIRE(MappedBMP("tmp_images/odd_width_top_down.bmp").get_row_stride() == -24);
+    REQUIRE(loadFromBMP("tmp_images/odd_width_top_down.bmp").image_data == odd_img.image_data);
+    BMP odd_bmp("tmp_images/odd_width_top_down.bmp");
+    odd_bmp.get_pixel(6, 0, r, g, b);
+    REQUIRE(ColorRGB{r, g, b} == odd_img.image_data[0][6]);
+
+    // streaming reads the rows of a top-down file from its end
+    negativeBMPStream(
+        "tmp_images/kapibara_top_down.bmp", "tmp_images/kapibara_top_down_negative.bmp", 10);
+    REQUIRE(
+        loadFromBMP("tmp_images/kapibara_top_down_negative.bmp").image_data
+        == loadFromBMP("correct_images/kapibara_negative.bmp").image_data);
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Separable kernels") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_37.log", true);
+
+    const UncompressedImage img = loadFromBMP("images/kapibara.bmp");
+
+    UncompressedImage blurred = img;
+    applySeparableKernel(blurred, {1, 2, 1}, {1, 2, 1}, 16);
+    REQUIRE(blurred.image_data == loadFromBMP("correct_images/kapibara_blur.bmp").image_data);
+    blurred = img;
+    applySeparableKernel(blurred, {1, 4, 6, 4, 1}, {1, 4, 6, 4, 1}, 256);
+    REQUIRE(blurred.image_data == loadFromBMP("correct_images/kapibara_blur_hard.bmp").image_data);
+
+    // rank 1 kernels with negative weights and of different sizes, against a plain convolution
+    auto convolve = [](const UncompressedImage& src, const std::vector<std::vector<int>>& kernel,
+                       int divisor) {
+        UncompressedImage dst = src;
+        const int kh = kernel.size(), kw = kernel[0].size();
+        const int width = src.width, height = src.height;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                int sum[3] = {0, 0, 0};
+                for (int ky = 0; ky < kh; ++ky) {
+                    for (int kx = 0; kx < kw; ++kx) {
+                        int sy = std::clamp(y + ky - kh / 2, 0, height - 1);
+                        int sx = std::clamp(x + kx - kw / 2, 0, width - 1);
+                        const ColorRGB& pixel = src.image_data[sy][sx];
+                        sum[0] += kernel[ky][kx] * pixel.r;
+                        sum[1] += kernel[ky][kx] * pixel.g;
+                        sum[2] += kernel[ky][kx] * pixel.b;
+                    }
+                }
+                dst.image_data[y][x] = {
+                    uint8_t(std::clamp(sum[0] / divisor, 0, 255)),
+                    uint8_t(std::clamp(sum[1] / divisor, 0, 255)),
+                    uint8_t(std::clamp(sum[2] / divisor, 0, 255))};
+            }
+        }
+        return dst;
+    };
+    UncompressedImage crop;
+    crop.width = 97;
+    crop.height = 61;
+    crop.image_data.resize(crop.width, crop.height);
+    for (uint32_t y = 0; y < crop.height; ++y) {
+        std::ranges::copy(
+            img.image_data.view(500, 300, crop.width, crop.height)[y], crop.image_data[y].begin());
+    }
+    const std::vector<std::pair<std::vector<std::vector<int>>, int>> kernels = {
+        {{{1, 0, -1}, {2, 0, -2}, {1, 0, -1}}, 1},
+        {{{-2, 4, -2}, {-3, 6, -3}}, 3},
+        {{{2, 4, 6, 4, 2}, {1, 2, 3, 2, 1}, {0, 0, 0, 0, 0}, {-1, -2, -3, -2, -1}}, 5},
+        {{{1}, {3}, {3}, {1}}, 8},
+        {{{1, 2, 1}, {2, 4, 2}, {1, 2, 2}}, 16},  // not separable
+    };
+    for (const auto& [kernel, divisor] : kernels) {
+        UncompressedImage filtered = crop;
+        applyKernel(filtered, kernel, divisor);
+        REQUIRE(filtered.image_data == convolve(crop, kernel, divisor).image_data);
+        UncompressedImageRGBA rgba_filtered = toRGBA(crop);
+        applyKernel(rgba_filtered, kernel, divisor);
+        REQUIRE(toRGB(rgba_filtered).image_data == filtered.image_data);
+    }
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+// Deterministic noise for comparing the fast paths of the filters with the reference ones
+UncompressedImage noiseImage(uint32_t width, uint32_t height) {
+    UncompressedImage noise;
+    noise.width = width;
+    noise.height = height;
+    noise.image_data.resize(width, height);
+    for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+            noise.image_data[y][x] = {
+                static_cast<uint8_t>(x * 37 + y * 101),
+                static_cast<uint8_t>((x * x) ^ (y * 59)),
+                static_cast<uint8_t>(x * y * 13 + 200)};
+        }
+    }
+    return noise;
+}
+
+UncompressedImageRGBA noiseImageRGBA(uint32_t width, uint32_t height) {
+    UncompressedImageRGBA noise = toRGBA(noiseImage(width, height));
+    for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+            noise.image_data[y][x].a = static_cast<uint8_t>(x * 11 + y);
+        }
+    }
+    return noise;
+}
+
+TEST_CASE("SIMD kernels against the scalar reference") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_38.log", true);
+
+    const UncompressedImage img = loadFromBMP("images/kapibara.bmp");
+    UncompressedImage filtered = img;
+    sharpen(filtered);
+    REQUIRE(filtered.image_data == loadFromBMP("correct_images/kapibara_sharp.bmp").image_data);
+    filtered = img;
+    edgeDetect(filtered);
+    REQUIRE(
+        filtered.image_data == loadFromBMP("correct_images/kapibara_edge_detect.bmp").image_data);
+    filtered = img;
+    gaussianBlurApprox(filtered);
+    REQUIRE(filtered.image_data == loadFromBMP("correct_images/kapibara_blur.bmp").image_data);
+
+    // the vector code covers the inner pixels of a row, the sizes around the vector width check
+    // the borders and the tails, the divisors every way the division is done
+    const std::vector<std::pair<std::vector<std::vector<int>>, int>> kernels = {
+        {{{0, -1, 0}, {-1, 5, -1}, {0, -1, 0}}, 1},
+        {{{-1, -1, -1}, {-1, 8, -1}, {-1, -1, -1}}, 1},
+        {{{1, 2, 1}, {2, 4, 2}, {1, 2, 1}}, 16},
+        {{{1, 2, 1}, {2, 4, 2}, {1, 2, 2}}, 17},
+        {{{3, -1, 0}, {2, 1, -4}}, 3},
+        {{{1, 1, 1, 1, 1},
+          {1, 2, 2, 2, 1},
+          {1, 2, -9, 2, 1},
+          {1, 2, 2, 2, 1},
+          {1, 1, 1, 1, 1}},
+         7},
+        {{{1, 1, 1, 1, 1},
+          {1, 1, 1, 1, 1},
+          {1, 1, 1, 1, 1},
+          {1, 1, 1, 1, 1},
+          {1, 1, 1, 1, 1}},
+         25},
+        {{{2, -5, 1, 0, 3},
+          {4, 6, -2, 1, 1},
+          {0, 3, 8, -3, 2},
+          {1, 1, -6, 5, 0},
+          {2, 0, 1, 4, 9}},
+         1000},
+        // weights that only fit the unsigned 16 bit lanes, and too large ones
+        {{{1, 4, 6, 4, 1},
+          {4, 16, 24, 16, 4},
+          {6, 24, 36, 24, 6},
+          {4, 16, 24, 16, 4},
+          {1, 4, 6, 4, 1}},
+         256},
+        {{{1, 4, 6, 4, 1},
+          {4, 16, 24, 16, 4},
+          {6, 24, 36, 24, 6},
+          {4, 16, 24, 16, 4},
+          {1, 4, 6, 4, 1}},
+         255},
+        {{{1, 4, 6, 4, 1},
+          {4, 16, 24, 16, 4},
+          {6, 24, 99, 24, 6},
+          {4, 16, 24, 16, 4},
+          {1, 4, 6, 4, 1}},
+         256},
+    };
+    for (uint32_t width : {1u, 2u, 4u, 5u, 9u, 20u, 21u, 37u, 130u}) {
+        for (uint32_t height : {1u, 3u, 6u}) {
+            const UncompressedImage noise = noiseImage(width, height);
+            const UncompressedImageRGBA rgba_noise = noiseImageRGBA(width, height);
+
+            for (const auto& [kernel, divisor] : kernels) {
+                INFO(width << "x" << height << ", divisor " << divisor);
+                UncompressedImage expected = noise, actual = noise;
+                applyKernelScalar(expected, kernel, divisor);
+                applyKernel(actual, kernel, divisor);
+                REQUIRE(actual.image_data == expected.image_data);
+
+                UncompressedImageRGBA rgba_expected = rgba_noise, rgba_actual = rgba_noise;
+                applyKernelScalar(rgba_expected, kernel, divisor);
+                applyKernel(rgba_actual, kernel, divisor);
+                REQUIRE(rgba_actual.image_data == rgba_expected.image_data);
+                REQUIRE(toRGB(rgba_actual).image_data == actual.image_data);
+            }
+        }
+    }
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+template <auto Kernel, int Divisor>
+void checkFixedKernel() {
+    std::vector<std::vector<int>> kernel;
+    for (const auto& row : Kernel) {
+        kernel.emplace_back(row.begin(), row.end());
+    }
+    for (uint32_t width : {1u, 3u, 6u, 21u, 37u, 130u}) {
+        for (uint32_t height : {1u, 2u, 7u}) {
+            INFO(width << "x" << height << ", divisor " << Divisor);
+            UncompressedImage expected = noiseImage(width, height), actual = expected;
+            applyKernelScalar(expected, kernel, Divisor);
+            applyFixedKernel<Kernel, Divisor>(actual);
+            REQUIRE(actual.image_data == expected.image_data);
+
+            UncompressedImageRGBA rgba_expected = noiseImageRGBA(width, height);
+            UncompressedImageRGBA rgba_actual = rgba_expected;
+            applyKernelScalar(rgba_expected, kernel, Divisor);
+            applyFixedKernel<Kernel, Divisor>(rgba_actual);
+            REQUIRE(rgba_actual.image_data == rgba_expected.image_data);
+        }
+    }
+}
+
+TEST_CASE("Fixed kernels") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_39.log", true);
+
+    const UncompressedImage img = loadFromBMP("images/kapibara.bmp");
+    UncompressedImage filtered = img;
+    gaussianBlurApprox(filtered, true);
+    REQUIRE(filtered.image_data == loadFromBMP("correct_images/kapibara_blur_hard.bmp").image_data);
+
+    // signed and unsigned lanes, multiply-high and shift divisions, weights of +-1 and 0
+    checkFixedKernel<FixedKernel<3, 3>{{{0, -1, 0}, {-1, 5, -1}, {0, -1, 0}}}, 1>();
+    checkFixedKernel<FixedKernel<3, 3>{{{-1, -1, -1}, {-1, 8, -1}, {-1, -1, -1}}}, 1>();
+    checkFixedKernel<FixedKernel<3, 3>{{{1, 2, 1}, {2, 4, 2}, {1, 2, 1}}}, 16>();
+    checkFixedKernel<FixedKernel<3, 3>{{{1, 2, 1}, {2, 5, 2}, {1, 2, 1}}}, 17>();
+    checkFixedKernel<FixedKernel<2, 3>{{{3, -1, 0}, {2, 1, -4}}}, 3>();
+    checkFixedKernel<FixedKernel<1, 4>{{{1, 3, 3, 1}}}, 8>();
+    checkFixedKernel<
+        FixedKernel<5, 5>{{
+            {1, 4, 6, 4, 1},
+            {4, 16, 24, 16, 4},
+            {6, 24, 36, 24, 6},
+            {4, 16, 24, 16, 4},
+            {1, 4, 6, 4, 1},
+        }},
+        256>();
+    // too large for the 16 bit lanes, only the unrolled scalar code
+    checkFixedKernel<FixedKernel<3, 3>{{{20, 40, 20}, {40, -80, 40}, {20, 40, 20}}}, 100>();
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Multi-threaded kernels") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_40.log", true);
+
+    ThreadPool pool(4);
+    REQUIRE(pool.threadCount() == 4);
+    std::vector<int> runs(1000, 0);
+    pool.parallelFor(runs.size(), [&](size_t index) {
+        ++runs[index];
+        // a loop started from a task runs on the thread of the task
+        pool.parallelFor(3, [&](size_t) {});
+    });
+    REQUIRE(std::ranges::count(runs, 1) == runs.size());
+    REQUIRE_THROWS_AS(
+        pool.parallelFor(
+            16,
+            [](size_t index) {
+                if (index == 7) {
+                    throw std::runtime_error("task failed");
+                }
+            }),
+        std::runtime_error);
+
+    // the bands depend on the thread count, the result must not
+    const UncompressedImage img = loadFromBMP("images/kapibara.bmp");
+    const UncompressedImageRGBA rgba_img = toRGBA(img);
+    const std::vector<std::pair<std::vector<std::vector<int>>, int>> kernels = {
+        {{{1, 2, 1}, {2, 4, 2}, {1, 2, 2}}, 17},
+        {{{1, 4, 6, 4, 1}}, 16},
+        {{{10, 20, 10}, {20, 40, 20}, {10, 20, 10}}, 160},
+        {{{30, -10}, {-10, 30}}, 35},
+    };
+    std::vector<UncompressedImage> expected;
+    std::vector<UncompressedImageRGBA> rgba_expected;
+    for (size_t threads : {1, 2, 3, 8}) {
+        setTransformThreadCount(threads);
+        REQUIRE(transformThreadPool().threadCount() == threads);
+
+        std::vector<UncompressedImage> results;
+        std::vector<UncompressedImageRGBA> rgba_results;
+        for (const auto& [kernel, divisor] : kernels) {
+            results.push_back(img);
+            applyKernel(results.back(), kernel, divisor);
+            rgba_results.push_back(rgba_img);
+            applyKernel(rgba_results.back(), kernel, divisor);
+        }
+        results.push_back(img);
+        sharpen(results.back());
+        results.push_back(img);
+        gaussianBlurApprox(results.back(), true);
+
+        if (threads == 1) {
+            expected = results;
+            rgba_expected = rgba_results;
+            continue;
+        }
+        INFO(threads << " threads");
+        for (size_t i = 0; i < results.size(); ++i) {
+            REQUIRE(results[i].image_data == expected[i].image_data);
+        }
+        for (size_t i = 0; i < rgba_results.size(); ++i) {
+            REQUIRE(rgba_results[i].image_data == rgba_expected[i].image_data);
+        }
+    }
+    setTransformThreadCount(0);
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Box and gaussian blur of any radius") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_41.log", true);
+
+    // two passes of the rounded mean of 2 * radius + 1 clamped pixels, the slow way
+    auto box_blur = [](const UncompressedImage& src, int radius) {
+        const int width = src.width, height = src.height, window = 2 * radius + 1;
+        UncompressedImage rows = src, dst = src;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                int sum[3] = {0, 0, 0};
+                for (int dx = -radius; dx <= radius; ++dx) {
+                    const ColorRGB& pixel = src.image_data[y][std::clamp(x + dx, 0, width - 1)];
+                    sum[0] += pixel.r;
+                    sum[1] += pixel.g;
+                    sum[2] += pixel.b;
+                }
+                rows.image_data[y][x] = {
+                    uint8_t((sum[0] + radius) / window), uint8_t((sum[1] + radius) / window),
+                    uint8_t((sum[2] + radius) / window)};
+            }
+        }
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                int sum[3] = {0, 0, 0};
+                for (int dy = -radius; dy <= radius; ++dy) {
+                    const ColorRGB& pixel = rows.image_data[std::clamp(y + dy, 0, height - 1)][x];
+                    sum[0] += pixel.r;
+                    sum[1] += pixel.g;
+                    sum[2] += pixel.b;
+                }
+                dst.image_data[y][x] = {
+                    uint8_t((sum[0] + radius) / window), uint8_t((sum[1] + radius) / window),
+                    uint8_t((sum[2] + radius) / window)};
+            }
+        }
+        return dst;
+    };
+    for (auto [width, height] : {std::pair{1u, 1u}, {5u, 3u}, {37u, 21u}, {130u, 7u}}) {
+        for (uint32_t radius : {0u, 1u, 2u, 7u, 40u}) {
+            INFO(width << "x" << height << ", radius " << radius);
+            UncompressedImage blurred = noiseImage(width, height);
+            boxBlur(blurred, radius);
+            const UncompressedImage expected = box_blur(noiseImage(width, height), radius);
+            REQUIRE(blurred.image_data == expected.image_data);
+
+            UncompressedImageRGBA rgba_blurred = noiseImageRGBA(width, height);
+            boxBlur(rgba_blurred, radius);
+            REQUIRE(toRGB(rgba_blurred).image_data == expected.image_data);
+            for (uint32_t y = 0; y < height; ++y) {
+                for (uint32_t x = 0; x < width; ++x) {
+                    REQUIRE(rgba_blurred.image_data[y][x].a == uint8_t(x * 11 + y));
+                }
+            }
+        }
+    }
+    UncompressedImage too_large = noiseImage(4, 4);
+    REQUIRE_THROWS_AS(boxBlur(too_large, 40000), std::invalid_argument);
+
+    // a flat image stays flat, the bands of the vertical pass give the same result as one band
+    const UncompressedImage img = loadFromBMP("images/kapibara.bmp");
+    UncompressedImage flat = img;
+    for (uint32_t y = 0; y < flat.height; ++y) {
+        std::ranges::fill(flat.image_data[y], ColorRGB{12, 200, 97});
+    }
+    gaussianBlur(flat, 25);
+    REQUIRE(flat.image_data[flat.height / 2][0] == ColorRGB{12, 200, 97});
+    REQUIRE(
+        std::ranges::count(flat.image_data[flat.height - 1], ColorRGB{12, 200, 97}) == flat.width);
+
+    setTransformThreadCount(1);
+    UncompressedImage single_thread = img;
+    gaussianBlur(single_thread, 30);
+    setTransformThreadCount(3);
+    UncompressedImage three_threads = img;
+    gaussianBlur(three_threads, 30);
+    setTransformThreadCount(0);
+    REQUIRE(three_threads.image_data == single_thread.image_data);
+    REQUIRE(three_threads.image_data != img.image_data);
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Filter chains") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_42.log", true);
+
+    // folding of the stages that compose exactly
+    FilterChain folded;
+    folded.addKernel({{0, 0, 0}, {0, 3, 0}, {0, 0, 0}}, 3).addKernel({{1}}).addKernel({});
+    REQUIRE(folded.empty());
+    folded.addNegative().addNegative().addToGrayscale().addSharpen().addToGrayscale();
+    REQUIRE(folded.stages().size() == 2);
+    REQUIRE(folded.stages()[0].type == FilterChain::Stage::Type::Grayscale);
+    folded.addNegative().addNegative();
+    REQUIRE(folded.stages().size() == 2);
+
+    // the chain gives the same image as the filters called one by one
+    const UncompressedImage img = loadFromBMP("images/kapibara.bmp");
+    UncompressedImage chained = img;
+    FilterChain().addGaussianBlurApprox().apply(chained);
+    REQUIRE(chained.image_data == loadFromBMP("correct_images/kapibara_blur.bmp").image_data);
+
+    UncompressedImage expected = img;
+    gaussianBlurApprox(expected);
+    sharpen(expected);
+    gaussianBlurApprox(expected, true);
+    negative(expected);
+    edgeDetect(expected);
+    const FilterChain chain = FilterChain()
+                                  .addGaussianBlurApprox()
+                                  .addSharpen()
+                                  .addGaussianBlurApprox(true)
+                                  .addNegative()
+                                  .addEdgeDetect();
+    for (size_t threads : {1u, 2u, 3u, 8u}) {
+        INFO(threads << " threads");
+        setTransformThreadCount(threads);
+        chained = img;
+        chain.apply(chained);
+        REQUIRE(chained.image_data == expected.image_data);
+    }
+    setTransformThreadCount(0);
+
+    // borders and halos larger than the image, uneven kernels, the alpha channel
+    const std::vector<std::vector<int>> wide = {{1, 2, 3, 2, 1, 0, 4}};
+    const std::vector<std::vector<int>> tall = {{2}, {-1}, {3}, {1}};
+    const std::vector<std::vector<int>> odd = {{3, -1, 0}, {2, 1, -4}};
+    const FilterChain mixed = FilterChain()
+                                  .addKernel(tall, 3)
+                                  .addToGrayscale()
+                                  .addKernel(wide, 9)
+                                  .addNegative()
+                                  .addKernel(odd, 2)
+                                  .addSharpen();
+    for (auto [width, height] : {std::pair{1u, 1u}, {2u, 3u}, {9u, 5u}, {37u, 21u}, {130u, 6u}}) {
+        INFO(width << "x" << height);
+        UncompressedImage expected_noise = noiseImage(width, height);
+        applyKernel(expected_noise, tall, 3);
+        toGrayscale(expected_noise);
+        applyKernel(expected_noise, wide, 9);
+        negative(expected_noise);
+        applyKernel(expected_noise, odd, 2);
+        sharpen(expected_noise);
+
+        UncompressedImage noise = noiseImage(width, height);
+        mixed.apply(noise);
+        REQUIRE(noise.image_data == expected_noise.image_data);
+        REQUIRE(noise.is_grayscale);
+
+        UncompressedImageRGBA rgba_noise = noiseImageRGBA(width, height);
+        mixed.apply(rgba_noise);
+        REQUIRE(toRGB(rgba_noise).image_data == expected_noise.image_data);
+        for (uint32_t y = 0; y < height; ++y) {
+            for (uint32_t x = 0; x < width; ++x) {
+                REQUIRE(rgba_noise.image_data[y][x].a == uint8_t(x * 11 + y));
+            }
+        }
+    }
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("In-place kernels") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_43.log", true);
+
+    const UncompressedImage img = loadFromBMP("images/kapibara.bmp");
+    const std::vector<std::vector<int>> kernel_5x5 = {
+        {2, -5, 1, 0, 3}, {4, 6, -2, 1, 1}, {0, 3, 8, -3, 2}, {1, 1, -6, 5, 0}, {2, 0, 1, 4, 9}};
+    const std::vector<std::vector<int>> separable_7x7 = {
+        {1, 2, 3, 4, 3, 2, 1},
+        {2, 4, 6, 8, 6, 4, 2},
+        {3, 6, 9, 12, 9, 6, 3},
+        {4, 8, 12, 16, 12, 8, 4},
+        {3, 6, 9, 12, 9, 6, 3},
+        {2, 4, 6, 8, 6, 4, 2},
+        {1, 2, 3, 4, 3, 2, 1}};
+    const std::vector<std::pair<std::string, std::function<void(UncompressedImage&)>>> filters = {
+        {"sharpen", [](UncompressedImage& image) { sharpen(image); }},
+        {"hard blur", [](UncompressedImage& image) { gaussianBlurApprox(image, true); }},
+        {"5x5", [&](UncompressedImage& image) { applyKernel(image, kernel_5x5, 7); }},
+        {"5x5 scalar", [&](UncompressedImage& image) { applyKernelScalar(image, kernel_5x5, 7); }},
+        {"separable 7x7", [&](UncompressedImage& image) { applyKernel(image, separable_7x7, 256); }},
+    };
+
+    // a few rows of scratch, the arena of a new thread has seen nothing else
+    setTransformThreadCount(1);
+    const size_t image_bytes = size_t(img.width) * img.height * sizeof(ColorRGB);
+    for (const auto& [name, filter] : filters) {
+        INFO(name);
+        UncompressedImage filtered = img;
+        size_t peak_bytes = 0;
+        std::thread([&] {
+            filter(filtered);
+            peak_bytes = threadScratchArena().stats().peak_used_bytes;
+        }).join();
+        REQUIRE(peak_bytes > 0);
+        REQUIRE(peak_bytes < image_bytes / 10);
+    }
+
+    // a region of interest is filtered in place like a crop of the image, the rest is untouched
+    for (size_t threads : {1u, 3u}) {
+        setTransformThreadCount(threads);
+        for (const auto& [name, filter] : filters) {
+            INFO(name << ", " << threads << " threads");
+            UncompressedImage crop;
+            crop.width = 300;
+            crop.height = 500;
+            crop.image_data.resize(crop.width, crop.height);
+            for (uint32_t y = 0; y < crop.height; ++y) {
+                std::ranges::copy(
+                    img.image_data[y + 100].subspan(40, crop.width), crop.image_data[y].begin());
+            }
+            filter(crop);
+
+            UncompressedImage region = img;
+            ImageView<ColorRGB> view = region.image_data.view(40, 100, crop.width, crop.height);
+            if (name == "sharpen") {
+                sharpen(view);
+            } else if (name == "hard blur") {
+                gaussianBlurApprox(view, true);
+            } else if (name == "separable 7x7") {
+                applyKernel(view, separable_7x7, 256);
+            } else {
+                applyKernel(view, kernel_5x5, 7);
+            }
+            size_t wrong_pixels = 0;
+            for (uint32_t y = 0; y < img.height; ++y) {
+                const bool inside_rows = y >= 100 && y < 100 + crop.height;
+                for (uint32_t x = 0; x < img.width; ++x) {
+                    const bool inside = inside_rows && x >= 40 && x < 40 + crop.width;
+                    const ColorRGB& expected =
+                        inside ? crop.image_data[y - 100][x - 40] : img.image_data[y][x];
+                    wrong_pixels += region.image_data[y][x] != expected;
+                }
+            }
+            REQUIRE(wrong_pixels == 0);
+        }
+    }
+    setTransformThreadCount(0);
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("FFT kernels") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_44.log", true);
+
+    REQUIRE_THROWS_AS(FftPlan(12), std::invalid_argument);
+    // a round trip gives the values back, size times larger
+    const FftPlan plan(8);
+    std::vector<std::complex<double>> values = {{1, 2}, {-3, 0}, {5, 1}, {0, 0}, {2, -7}, {4, 4}};
+    values.resize(8);
+    const std::vector<std::complex<double>> original = values;
+    plan.forward(values.data());
+    REQUIRE(std::abs(values[0] - std::complex<double>(9, 0)) < 1e-9);
+    plan.inverse(values.data());
+    for (size_t i = 0; i < values.size(); ++i) {
+        REQUIRE(std::abs(values[i] / 8.0 - original[i]) < 1e-9);
+    }
+
+    auto make_kernel = [](size_t width, size_t height, int low, int high) {
+        std::vector<std::vector<int>> kernel(height, std::vector<int>(width));
+        for (size_t y = 0; y < height; ++y) {
+            for (size_t x = 0; x < width; ++x) {
+                const size_t hash = x * 7 + y * 13 + x * y * 5;
+                kernel[y][x] = low + static_cast<int>(hash % (high - low + 1));
+            }
+        }
+        return kernel;
+    };
+    // not of rank 1, so applyKernel takes the FFT from 100 taps on
+    const std::vector<std::pair<std::vector<std::vector<int>>, int>> kernels = {
+        {make_kernel(11, 11, 0, 9), 560},
+        {make_kernel(17, 13, -4, 6), 90},
+        {make_kernel(31, 31, -20, 25), 1},
+        {make_kernel(5, 21, 1, 3), 200},
+        {make_kernel(3, 3, -2, 5), 3},
+    };
+    for (size_t threads : {1u, 3u}) {
+        setTransformThreadCount(threads);
+        for (const auto& [width, height] : std::vector<std::pair<uint32_t, uint32_t>>{
+                 {300, 211}, {1, 40}, {9, 7}, {700, 90}}) {
+            const UncompressedImage noise = noiseImage(width, height);
+            const UncompressedImageRGBA rgba_noise = noiseImageRGBA(width, height);
+            for (const auto& [kernel, divisor] : kernels) {
+                INFO(
+                    kernel.front().size() << "x" << kernel.size() << " on " << width << "x"
+                                          << height << ", " << threads << " threads");
+                UncompressedImage expected = noise;
+                applyKernelScalar(expected, kernel, divisor);
+                UncompressedImage fft = noise;
+                applyKernelFft(fft, kernel, divisor);
+                REQUIRE(fft.image_data == expected.image_data);
+                UncompressedImage automatic = noise;
+                applyKernel(automatic, kernel, divisor);
+                REQUIRE(automatic.image_data == expected.image_data);
+
+                UncompressedImageRGBA rgba_expected = rgba_noise;
+                applyKernelScalar(rgba_expected, kernel, divisor);
+                UncompressedImageRGBA rgba_fft = rgba_noise;
+                applyKernelFft(rgba_fft, kernel, divisor);
+                REQUIRE(rgba_fft.image_data == rgba_expected.image_data);
+            }
+        }
+    }
+    setTransformThreadCount(0);
+
+    UncompressedImage img = noiseImage(20, 20);
+    REQUIRE_THROWS_AS(applyKernelFft(img, {}, 1), std::invalid_argument);
+    REQUIRE_THROWS_AS(applyKernelFft(img, make_kernel(600, 3, 0, 1), 1), std::invalid_argument);
+    REQUIRE_THROWS_AS(
+        applyKernelFft(img, make_kernel(3, 3, 1 << 24, 1 << 24), 1), std::invalid_argument);
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Kernel border modes") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_45.log", true);
+
+    // the plain definition of every mode, for a row a b c d
+    auto outside_index = [](long long i, long long size, BorderMode border) -> long long {
+        switch (border) {
+            case BorderMode::Clamp:
+                return std::clamp(i, 0LL, size - 1);
+            case BorderMode::Reflect:  // ... b a | a b c d | d c ...
+                while (i < 0 || i >= size) {
+                    i = i < 0 ? -i - 1 : 2 * size - 1 - i;
+                }
+                return i;
+            case BorderMode::Wrap:
+                return ((i % size) + size) % size;
+            default:
+                return i >= 0 && i < size ? i : -1;
+        }
+    };
+    auto convolve = [&](const UncompressedImage& src, const std::vector<std::vector<int>>& kernel,
+                        int divisor, BorderMode border, ColorRGB border_color) {
+        const long long width = src.width;
+        const long long height = src.height;
+        const long long kernel_height = kernel.size();
+        const long long kernel_width = kernel.front().size();
+        UncompressedImage dst = src;
+        for (long long y = 0; y < height; ++y) {
+            for (long long x = 0; x < width; ++x) {
+                int sum_r = 0, sum_g = 0, sum_b = 0;
+                for (long long ky = 0; ky < kernel_height; ++ky) {
+                    for (long long kx = 0; kx < kernel_width; ++kx) {
+                        const long long src_y = outside_index(
+                            y + ky - kernel_height / 2, height, border);
+                        const long long src_x = outside_index(
+                            x + kx - kernel_width / 2, width, border);
+                        const ColorRGB pixel = src_y < 0 || src_x < 0
+                                                   ? border_color
+                                                   : src.image_data[src_y][src_x];
+                        sum_r += kernel[ky][kx] * pixel.r;
+                        sum_g += kernel[ky][kx] * pixel.g;
+                        sum_b += kernel[ky][kx] * pixel.b;
+                    }
+                }
+                dst.image_data[y][x] = {
+                    static_cast<uint8_t>(std::clamp(sum_r / divisor, 0, 255)),
+                    static_cast<uint8_t>(std::clamp(sum_g / divisor, 0, 255)),
+                    static_cast<uint8_t>(std::clamp(sum_b / divisor, 0, 255))};
+            }
+        }
+        return dst;
+    };
+
+    std::vector<std::vector<int>> kernel_11x11(11, std::vector<int>(11));
+    for (size_t y = 0; y < 11; ++y) {
+        for (size_t x = 0; x < 11; ++x) {
+            kernel_11x11[y][x] = static_cast<int>((x * 5 + y * 3 + x * y) % 9) - 2;
+        }
+    }
+    const std::vector<std::pair<std::vector<std::vector<int>>, int>> kernels = {
+        {{{1, 2, 1}, {2, 4, 2}, {1, 2, 1}}, 16},
+        {{{0, -1, 0}, {-1, 5, -1}, {0, -1, 0}}, 1},
+        {{{2, -5, 1, 0, 3}, {4, 6, -2, 1, 1}, {0, 3, 8, -3, 2}, {1, 1, -6, 5, 0}}, 7},
+        {{{1, 6, 15, 20, 15, 6, 1}, {2, 12, 30, 40, 30, 12, 2}}, 192},
+        {kernel_11x11, 150},
+    };
+    const std::vector<std::pair<BorderMode, std::string>> borders = {
+        {BorderMode::Clamp, "clamp"},
+        {BorderMode::Reflect, "reflect"},
+        {BorderMode::Wrap, "wrap"},
+        {BorderMode::Constant, "constant"},
+    };
+    const ColorRGB border_color = {200, 17, 90};
+    for (size_t threads : {1u, 3u}) {
+        setTransformThreadCount(threads);
+        for (const auto& [width, height] : std::vector<std::pair<uint32_t, uint32_t>>{
+                 {600, 500}, {37, 23}, {3, 2}, {1, 1}}) {
+            const UncompressedImage noise = noiseImage(width, height);
+            const UncompressedImageRGBA rgba_noise = noiseImageRGBA(width, height);
+            for (const auto& [kernel, divisor] : kernels) {
+                for (const auto& [border, name] : borders) {
+                    INFO(
+                        kernel.front().size() << "x" << kernel.size() << " " << name << " on "
+                                              << width << "x" << height << ", " << threads
+                                              << " threads");
+                    const UncompressedImage expected =
+                        convolve(noise, kernel, divisor, border, border_color);
+                    UncompressedImage filtered = noise;
+                    applyKernel(filtered, kernel, divisor, border, border_color);
+                    REQUIRE(filtered.image_data == expected.image_data);
+                    UncompressedImage scalar = noise;
+                    applyKernelScalar(scalar, kernel, divisor, border, border_color);
+                    REQUIRE(scalar.image_data == expected.image_data);
+                    UncompressedImage fft = noise;
+                    applyKernelFft(fft, kernel, divisor, border, border_color);
+                    REQUIRE(fft.image_data == expected.image_data);
+
+                    // the alpha of the constant color is not used, the one of the pixels is kept
+                    UncompressedImageRGBA rgba = rgba_noise;
+                    const ColorRGBA rgba_color = {
+                        border_color.r, border_color.g, border_color.b, 3};
+                    applyKernel(rgba, kernel, divisor, border, rgba_color);
+                    REQUIRE(toRGB(rgba).image_data == expected.image_data);
+                    size_t wrong_alpha = 0;
+                    for (uint32_t y = 0; y < height; ++y) {
+                        for (uint32_t x = 0; x < width; ++x) {
+                            wrong_alpha += rgba.image_data[y][x].a != rgba_noise.image_data[y][x].a;
+                        }
+                    }
+                    REQUIRE(wrong_alpha == 0);
+                }
+            }
+        }
+    }
+    setTransformThreadCount(0);
+
+    // fixed kernels take the border mode as well
+    UncompressedImage img = noiseImage(45, 31);
+    UncompressedImage expected = convolve(
+        img, {{1, 2, 1}, {2, 4, 2}, {1, 2, 1}}, 16, BorderMode::Wrap, border_color);
+    applyFixedKernel<FixedKernel<3, 3>{{{1, 2, 1}, {2, 4, 2}, {1, 2, 1}}}, 16>(
+        img.image_data.view(), BorderMode::Wrap);
+    REQUIRE(img.image_data == expected.image_data);
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Gradient edge maps") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_46.log", true);
+
+    // the 2D operators on the gray image, with the borders clamped
+    auto reference_map = [](const UncompressedImage& img, GradientOperator gradient,
+                            bool suppress) {
+        const long long width = img.width;
+        const long long height = img.height;
+        const int side = gradient == GradientOperator::Scharr ? 3 : 1;
+        const int center = gradient == GradientOperator::Scharr ? 10 : 2;
+        const int kernel_x[3][3] = {{-side, 0, side}, {-center, 0, center}, {-side, 0, side}};
+        auto gray = [&](long long y, long long x) {
+            return static_cast<int>(colorToGrayscale(img.image_data[std::clamp(
+                y, 0LL, height - 1)][std::clamp(x, 0LL, width - 1)]));
+        };
+        std::vector<std::vector<long long>> squared(height, std::vector<long long>(width));
+        std::vector<std::vector<double>> angle(height, std::vector<double>(width));
+        for (long long y = 0; y < height; ++y) {
+            for (long long x = 0; x < width; ++x) {
+                int gx = 0, gy = 0;
+                for (int ky = 0; ky < 3; ++ky) {
+                    for (int kx = 0; kx < 3; ++kx) {
+                        gx += kernel_x[ky][kx] * gray(y + ky - 1, x + kx - 1);
+                        gy += kernel_x[kx][ky] * gray(y + ky - 1, x + kx - 1);
+                    }
+                }
+                squared[y][x] = gx * gx + gy * gy;
+                angle[y][x] = std::atan2(gy, gx) * 180 / M_PI;
+            }
+        }
+        auto squared_at = [&](long long y, long long x) {
+            return y < 0 || y >= height || x < 0 || x >= width ? 0 : squared[y][x];
+        };
+        ImageBuffer<uint8_t> map(width, height);
+        for (long long y = 0; y < height; ++y) {
+            for (long long x = 0; x < width; ++x) {
+                const double value = std::sqrt(squared[y][x]) / (2 * side + center);
+                map[y][x] = static_cast<uint8_t>(std::min(std::floor(value + 0.5), 255.0));
+                if (!suppress) {
+                    continue;
+                }
+                // the direction across the edge, folded to [0, 180)
+                const double a = angle[y][x] < 0 ? angle[y][x] + 180 : angle[y][x];
+                const int dx = a < 67.5 || a > 112.5 ? 1 : 0;
+                const int dy = a < 22.5 || a > 157.5 ? 0 : (a < 67.5 ? 1 : (a > 112.5 ? -1 : 1));
+                if (!(squared[y][x] > squared_at(y - dy, x - dx)
+                      && squared[y][x] >= squared_at(y + dy, x + dx))) {
+                    map[y][x] = 0;
+                }
+            }
+        }
+        return map;
+    };
+
+    for (size_t threads : {1u, 3u}) {
+        setTransformThreadCount(threads);
+        for (const auto& [width, height] : std::vector<std::pair<uint32_t, uint32_t>>{
+                 {700, 400}, {31, 17}, {2, 3}, {1, 1}}) {
+            const UncompressedImage noise = noiseImage(width, height);
+            const UncompressedImageRGBA rgba_noise = noiseImageRGBA(width, height);
+            for (GradientOperator gradient : {GradientOperator::Sobel, GradientOperator::Scharr}) {
+                for (bool suppress : {false, true}) {
+                    const bool scharr = gradient == GradientOperator::Scharr;
+                    INFO(
+                        width << "x" << height << ", scharr " << scharr << ", suppression "
+                              << suppress << ", " << threads << " threads");
+                    const ImageBuffer<uint8_t> expected = reference_map(noise, gradient, suppress);
+                    REQUIRE(edgeMap(noise, {gradient, suppress}) == expected);
+                    REQUIRE(edgeMap(rgba_noise, {gradient, suppress}) == expected);
+                }
+            }
+        }
+    }
+    setTransformThreadCount(0);
+
+    // a black to white step is an edge of 255, one pixel thin after the suppression,
+    // and the gradient points to the white side
+    UncompressedImage steps;
+    steps.width = 20;
+    steps.height = 20;
+    steps.image_data.resize(20, 20);
+    for (uint32_t y = 0; y < 20; ++y) {
+        for (uint32_t x = 0; x < 20; ++x) {
+            const bool white = y < 10 ? x >= 10 : y >= 15;
+            steps.image_data[y][x] = white ? ColorRGB{255, 255, 255} : ColorRGB{0, 0, 0};
+        }
+    }
+    ImageBuffer<uint8_t> direction;
+    const ImageBuffer<uint8_t> thin = edgeMap(steps, {GradientOperator::Sobel, true}, &direction);
+    for (uint32_t y = 2; y < 8; ++y) {
+        for (uint32_t x = 0; x < 20; ++x) {
+            REQUIRE(thin[y][x] == (x == 9 ? 255 : 0));
+        }
+        REQUIRE(direction[y][9] == 0);
+    }
+    for (uint32_t x = 2; x < 18; ++x) {
+        REQUIRE(thin[14][x] == 255);
+        REQUIRE(thin[15][x] == 0);
+        REQUIRE(direction[14][x] == 64);
+    }
+    // a view of the region of interest, the direction of a flat image is 0
+    const ImageBuffer<uint8_t> region =
+        edgeMap(steps.image_data.view(0, 0, 10, 10), {}, &direction);
+    REQUIRE(region == ImageBuffer<uint8_t>(10, 10, 0));
+    REQUIRE(direction == ImageBuffer<uint8_t>(10, 10, 0));
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+// The rotation of the arbitrary angles with the per pixel mapping: the inverse one, or the
+// forward one with the gaps filled by the mean of their neighbours (counted in stats)
+template <typename Image, typename Pixel>
+Image referenceRotate(
+    Image img, int angle, Pixel fill_color, bool smart, RotationStats* stats = nullptr) {
+    const long long width = img.width;
+    const long long height = img.height;
+    const long long center_x = width / 2;
+    const long long center_y = height / 2;
+    const double cos_theta = std::cos(angle * M_PI / 180.0);
+    const double sin_theta = std::sin(angle * M_PI / 180.0);
+    const auto source = img.image_data;
+    std::vector<std::vector<bool>> is_gap(height, std::vector<bool>(width, true));
+    for (long long y = 0; y < height; ++y) {
+        for (long long x = 0; x < width; ++x) {
+            const long long dx = x - center_x;
+            const long long dy = y - center_y;
+            if (!smart) {
+                const long long src_x = center_x + std::lround(cos_theta * dx - sin_theta * dy);
+                const long long src_y = center_y + std::lround(sin_theta * dx + cos_theta * dy);
+                const bool inside = src_x >= 0 && src_x < width && src_y >= 0 && src_y < height;
+                img.image_data[y][x] = inside ? source[src_y][src_x] : fill_color;
+                continue;
+            }
+            img.image_data[y][x] = fill_color;
+        }
+    }
+    if (!smart) {
+        return img;
+    }
+    for (long long y = 0; y < height; ++y) {
+        for (long long x = 0; x < width; ++x) {
+            const long long dx = x - center_x;
+            const long long dy = y - center_y;
+            const long long dst_x = center_x + std::lround(cos_theta * dx + sin_theta * dy);
+            const long long dst_y = center_y + std::lround(-sin_theta * dx + cos_theta * dy);
+            if (dst_x >= 0 && dst_x < width && dst_y >= 0 && dst_y < height) {
+                img.image_data[dst_y][dst_x] = source[y][x];
+                is_gap[dst_y][dst_x] = false;
+            }
+        }
+    }
+    const auto covered = img.image_data;
+    for (long long y = 0; y < height; ++y) {
+        for (long long x = 0; x < width; ++x) {
+            if (!is_gap[y][x]) {
+                continue;
+            }
+            if (stats) {
+                ++stats->gap_pixels;
+            }
+            int sums[4] = {0, 0, 0, 0}, count = 0;
+            for (long long ny = y - 1; ny <= y + 1; ++ny) {
+                for (long long nx = x - 1; nx <= x + 1; ++nx) {
+                    if (ny < 0 || ny >= height || nx < 0 || nx >= width || is_gap[ny][nx]) {
+                        continue;
+                    }
+                    const Pixel& pixel = covered[ny][nx];
+                    sums[0] += pixel.r;
+                    sums[1] += pixel.g;
+                    sums[2] += pixel.b;
+                    if constexpr (std::is_same_v<Pixel, ColorRGBA>) {
+                        sums[3] += pixel.a;
+                    }
+                    ++count;
+                }
+            }
+            if (count > 0) {
+                if (stats) {
+                    ++stats->filled_gap_pixels;
+                }
+                Pixel& pixel = img.image_data[y][x];
+                pixel.r = sums[0] / count;
+                pixel.g = sums[1] / count;
+                pixel.b = sums[2] / count;
+                if constexpr (std::is_same_v<Pixel, ColorRGBA>) {
+                    pixel.a = sums[3] / count;
+                }
+            }
+        }
+    }
+    return img;
+}
+
+TEST_CASE("Right angle rotation") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_47.log", true);
+
+    for (const auto& [width, height] : std::vector<std::pair<uint32_t, uint32_t>>{
+             {70, 41}, {41, 70}, {64, 64}, {33, 33}, {19, 8}, {1, 5}, {1, 1}}) {
+        const UncompressedImage noise = noiseImage(width, height);
+        const UncompressedImageRGBA rgba_noise = noiseImageRGBA(width, height);
+        for (int angle : {0, 90, 180, 270, -90, -180, 360, 450, 900}) {
+            for (bool smart : {false, true}) {
+                INFO(width << "x" << height << ", " << angle << " degrees, smart " << smart);
+                UncompressedImage img = noise;
+                rotate(img, angle, {0, 255, 0}, smart);
+                REQUIRE(
+                    img.image_data
+                    == referenceRotate(noise, angle, ColorRGB{0, 255, 0}, smart).image_data);
+                UncompressedImageRGBA rgba = rgba_noise;
+                rotate(rgba, angle, {0, 255, 0, 128}, smart);
+                REQUIRE(
+                    rgba.image_data
+                    == referenceRotate(rgba_noise, angle, ColorRGBA{0, 255, 0, 128}, smart)
+                           .image_data);
+            }
+        }
+    }
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Three-shear rotation") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_48.log", true);
+
+    UncompressedImage smooth;
+    smooth.width = 160;
+    smooth.height = 90;
+    smooth.image_data.resize(160, 90);
+    for (uint32_t y = 0; y < 90; ++y) {
+        for (uint32_t x = 0; x < 160; ++x) {
+            smooth.image_data[y][x] = {
+                static_cast<uint8_t>(x + y), static_cast<uint8_t>(2 * y),
+                static_cast<uint8_t>(128 + 100 * std::sin(x * 0.1))};
+        }
+    }
+    const UncompressedImageRGBA smooth_rgba = toRGBA(smooth);
+
+    // right angles are the exact ones of rotate
+    for (int angle : {0, 90, 180, 270, -90, 360}) {
+        INFO(angle << " degrees");
+        UncompressedImage expected = smooth;
+        rotate(expected, angle, {0, 255, 0});
+        UncompressedImage img = smooth;
+        rotateShear(img, angle, {0, 255, 0});
+        REQUIRE(img.image_data == expected.image_data);
+        UncompressedImageRGBA expected_rgba = smooth_rgba;
+        rotate(expected_rgba, angle, {0, 255, 0, 128});
+        UncompressedImageRGBA rgba = smooth_rgba;
+        rotateShear(rgba, angle, {0, 255, 0, 128});
+        REQUIRE(rgba.image_data == expected_rgba.image_data);
+    }
+
+    // other angles are close to the nearest neighbour rotation, which differs by a pixel at most,
+    // and do not depend on the number of threads
+    for (int angle : {30, -60, 135, 200, 1}) {
+        INFO(angle << " degrees");
+        UncompressedImage nearest = smooth;
+        rotate(nearest, angle, {0, 255, 0});
+        setTransformThreadCount(1);
+        UncompressedImage img = smooth;
+        rotateShear(img, angle, {0, 255, 0});
+        setTransformThreadCount(3);
+        UncompressedImage threaded = smooth;
+        rotateShear(threaded, angle, {0, 255, 0});
+        REQUIRE(threaded.image_data == img.image_data);
+        setTransformThreadCount(0);
+
+        long long difference = 0;
+        for (uint32_t y = 0; y < smooth.height; ++y) {
+            for (uint32_t x = 0; x < smooth.width; ++x) {
+                const ColorRGB a = img.image_data[y][x];
+                const ColorRGB b = nearest.image_data[y][x];
+                difference += std::abs(a.r - b.r) + std::abs(a.g - b.g) + std::abs(a.b - b.b);
+            }
+        }
+        REQUIRE(difference < 6LL * smooth.width * smooth.height);
+
+        UncompressedImageRGBA rgba = smooth_rgba;
+        rotateShear(rgba, angle, {0, 255, 0, 255});
+        REQUIRE(toRGB(rgba).image_data == img.image_data);
+    }
+
+    // a flat image stays flat inside, the corners it leaves get the fill color
+    UncompressedImage flat;
+    flat.width = 101;
+    flat.height = 61;
+    flat.image_data.resize(101, 61, ColorRGB{10, 20, 30});
+    rotateShear(flat, 40, {200, 200, 200});
+    REQUIRE(flat.image_data[30][50] == ColorRGB{10, 20, 30});
+    REQUIRE(flat.image_data[30][30] == ColorRGB{10, 20, 30});
+    REQUIRE(flat.image_data[0][0] == ColorRGB{200, 200, 200});
+    REQUIRE(flat.image_data[60][100] == ColorRGB{200, 200, 200});
+
+    UncompressedImage single = noiseImage(1, 1);
+    const ColorRGB pixel = single.image_data[0][0];
+    rotateShear(single, 33, {0, 0, 0});
+    REQUIRE(single.image_data[0][0] == pixel);
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Rotation with stepped coordinates") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_49.log", true);
+
+    // every angle on sizes of both parities, and the thin images where the rows are mostly
+    // outside of the canvas
+    for (const auto& [width, height] : std::vector<std::pair<uint32_t, uint32_t>>{
+             {57, 38}, {38, 57}, {40, 40}, {201, 3}, {1, 9}, {1, 1}}) {
+        const UncompressedImage noise = noiseImage(width, height);
+        const UncompressedImageRGBA rgba_noise = noiseImageRGBA(width, height);
+        for (int angle = -361; angle <= 361; angle += (width == 40 ? 1 : 7)) {
+            for (bool smart : {false, true}) {
+                INFO(width << "x" << height << ", " << angle << " degrees, smart " << smart);
+                UncompressedImage img = noise;
+                rotate(img, angle, {0, 255, 0}, smart);
+                REQUIRE(
+                    img.image_data
+                    == referenceRotate(noise, angle, ColorRGB{0, 255, 0}, smart).image_data);
+                UncompressedImageRGBA rgba = rgba_noise;
+                rotate(rgba, angle, {0, 255, 0, 128}, smart);
+                REQUIRE(
+                    rgba.image_data
+                    == referenceRotate(rgba_noise, angle, ColorRGBA{0, 255, 0, 128}, smart)
+                           .image_data);
+            }
+        }
+    }
+
+    // a large image, where the coordinates are stepped over thousands of pixels
+    const UncompressedImage large = noiseImage(2500, 1500);
+    for (int angle : {1, 37, 179, -89}) {
+        for (bool smart : {false, true}) {
+            INFO(angle << " degrees, smart " << smart);
+            UncompressedImage img = large;
+            rotate(img, angle, {0, 0, 0}, smart);
+            REQUIRE(
+                img.image_data
+                == referenceRotate(large, angle, ColorRGB{0, 0, 0}, smart).image_data);
+        }
+    }
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Multi-threaded rotation") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_50.log", true);
+
+    // the split of the rows does not change the result, with either mapping
+    setTransformThreadCount(3);
+    const UncompressedImage kapibara = loadFromBMP("images/kapibara.bmp");
+    for (int angle : {45, 120}) {
+        for (bool smart : {false, true}) {
+            const std::string name =
+                "kapibara_rotated_" + std::to_string(angle) + (smart ? "_interpolated" : "");
+            INFO(name);
+            UncompressedImage img = kapibara;
+            rotate(img, angle, {0, 255, 0}, smart);
+            saveAsBMP(img, "tmp_images/" + name + "_threads.bmp");
+            REQUIRE(matchVectors(
+                loadFile("tmp_images/" + name + "_threads.bmp"),
+                loadFile("correct_images/rotated_images/" + name + ".bmp")));
+        }
+    }
+
+    const UncompressedImage noise = noiseImage(700, 401);
+    const UncompressedImageRGBA rgba_noise = noiseImageRGBA(700, 401);
+    for (int angle : {-150, -33, 10, 89, 91, 200}) {
+        for (bool smart : {false, true}) {
+            INFO(angle << " degrees, smart " << smart);
+            UncompressedImage img = noise;
+            rotate(img, angle, {0, 255, 0}, smart);
+            REQUIRE(
+                img.image_data
+                == referenceRotate(noise, angle, ColorRGB{0, 255, 0}, smart).image_data);
+            UncompressedImageRGBA rgba = rgba_noise;
+            rotate(rgba, angle, {0, 255, 0, 128}, smart);
+            REQUIRE(
+                rgba.image_data
+                == referenceRotate(rgba_noise, angle, ColorRGBA{0, 255, 0, 128}, smart)
+                       .image_data);
+        }
+    }
+    setTransformThreadCount(0);
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}
+
+TEST_CASE("Rotation gap statistics") {
+    constexpr size_t TEST_AWARD_POINTS = 1;
+    openLogFile("logs/test_51.log", true);
+
+    // the counts of the gap interpolation match the per pixel reference, with any split of the
+    // rows (the rows at the edges of the bands are filled last) and any width modulo 64
+    const UncompressedImageRGBA rgba_noise = noiseImageRGBA(1000, 260);
+    for (size_t threads : {1, 3}) {
+        setTransformThreadCount(threads);
+        for (uint32_t width : {1u, 63u, 64u, 65u, 130u, 700u}) {
+            const UncompressedImage noise = noiseImage(width, 301);
+            for (int angle : {-150, -33, 10, 45, 91}) {
+                INFO(threads << " threads, width " << width << ", " << angle << " degrees");
+                RotationStats expected;
+                const UncompressedImage reference =
+                    referenceRotate(noise, angle, ColorRGB{0, 255, 0}, true, &expected);
+                UncompressedImage img = noise;
+                RotationStats stats;
+                rotate(img, angle, {0, 255, 0}, true, &stats);
+                REQUIRE(img.image_data == reference.image_data);
+                REQUIRE(stats.gap_pixels == expected.gap_pixels);
+                REQUIRE(stats.filled_gap_pixels == expected.filled_gap_pixels);
+                REQUIRE(stats.filled_gap_pixels > 0);
+                REQUIRE(stats.filled_gap_pixels < stats.gap_pixels);
+            }
+        }
+        RotationStats expected;
+        const UncompressedImageRGBA reference =
+            referenceRotate(rgba_noise, 30, ColorRGBA{0, 255, 0, 128}, true, &expected);
+        UncompressedImageRGBA rgba = rgba_noise;
+        RotationStats stats;
+        rotate(rgba, 30, {0, 255, 0, 128}, true, &stats);
+        REQUIRE(rgba.image_data == reference.image_data);
+        REQUIRE(stats.gap_pixels == expected.gap_pixels);
+        REQUIRE(stats.filled_gap_pixels == expected.filled_gap_pixels);
+    }
+    setTransformThreadCount(0);
+
+    // right angles: the gaps are the strips around the turned image, only their inner edge is
+    // filled, and rotations without the interpolation report no gaps
+    UncompressedImage img = noiseImage(200, 120);
+    RotationStats stats;
+    rotate(img, 90, {0, 0, 0}, true, &stats);
+    REQUIRE(stats.gap_pixels == 200 * 120 - 120 * 120);
+    REQUIRE(stats.filled_gap_pixels == 2 * 120);
+    rotate(img, 45, {0, 0, 0}, false, &stats);
+    REQUIRE(stats.gap_pixels == 0);
+    REQUIRE(stats.filled_gap_pixels == 0);
+    // x -> 200 - x leaves the column 0 and the row 0 uncovered
+    rotate(img, 180, {0, 0, 0}, true, &stats);
+    REQUIRE(stats.gap_pixels == 200 + 120 - 1);
+    REQUIRE(stats.filled_gap_pixels == stats.gap_pixels);
+
+    closeLogFile();
+    awarder.awardPoints(TEST_AWARD_POINTS, Catch::getResultCapture().getCurrentTestName());
+}